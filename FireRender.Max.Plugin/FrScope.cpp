@@ -152,13 +152,8 @@ void Scope::gc()
 	// Not supported for cache value objects, they don't derive from frw::Object
 
 	// Delete any image objects in the cache not referenced elsewhere
-	Cache<size_t, Image>::EntryMap::iterator it_image = m->cache.image.map.begin();
-	while( it_image != m->cache.image.map.end() )
-	{
-		if( it_image->second.value.use_count() == 1 )
-			it_image = m->cache.image.map.erase(it_image);
-		else it_image++;
-	}
+	m->cache.image.CollectUnused();
+	m->cache.image.Report();
 
 	// Delete any shape objects in the cache not referenced elsewhere, within shapeSets
 	// Delete entire shapeSet if no members remain
@@ -183,6 +178,7 @@ Scope Scope::CreateChildScope() const
 	assert(m);
 	Scope child(m->context.Handle(), false);
 	child.m->parent = m;
+	child.m->cache.image.SetBudget(m->cache.image.GetBudget());
 	return child;
 }
 
@@ -193,6 +189,7 @@ Scope Scope::CreateLocalScope() const
 	child.m->materialSystem = m->materialSystem;
 	child.m->parent = m;
 	child.m->scene = m->scene;
+	child.m->cache.image.SetBudget(m->cache.image.GetBudget());
 	return child;
 }
 
@@ -207,6 +204,106 @@ Scope Scope::ParentScope(bool orSelf) const
 	return Scope();
 }
 
+void ImageCache::Clear()
+{
+	entries.clear();
+	index.clear();
+	bytes = 0;
+}
+
+const Image& ImageCache::Get(size_t k)
+{
+	if (!enabled)
+		return defaultValue;
+
+	auto it = index.find(k);
+	if (it == index.end())
+	{
+		stats.misses++;
+		return defaultValue;
+	}
+
+	stats.hits++;
+
+	// move to the front, list iterators stay valid
+	entries.splice(entries.begin(), entries, it->second);
+	return it->second->value;
+}
+
+void ImageCache::Set(size_t k, const Image& v)
+{
+	if (!enabled)
+		return;
+
+	auto it = index.find(k);
+	if (it != index.end())
+		Erase(it->second);
+
+	if (!v)
+		return;
+
+	entries.push_front(Entry{ k, v, 0 });
+	Entry& entry = entries.front();
+	entry.bytes = entry.value.GetSizeInBytes();
+	bytes += entry.bytes;
+	index[k] = entries.begin();
+
+	Evict();
+}
+
+void ImageCache::SetBudget(size_t budgetBytes)
+{
+	budget = budgetBytes;
+	Evict();
+}
+
+void ImageCache::CollectUnused()
+{
+	auto it = entries.begin();
+	while (it != entries.end())
+	{
+		if (it->value.use_count() == 1)
+			it = Erase(it);
+		else
+			++it;
+	}
+}
+
+void ImageCache::Report() const
+{
+	DebugPrint(L"Image cache: %llu images, %llu MB of %llu MB, %llu hits, %llu misses, %llu evictions (%llu MB)\n",
+		(unsigned long long)index.size(), (unsigned long long)(bytes >> 20), (unsigned long long)(budget >> 20),
+		(unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.evictions,
+		(unsigned long long)(stats.evictedBytes >> 20));
+}
+
+ImageCache::EntryList::iterator ImageCache::Erase(EntryList::iterator it)
+{
+	bytes -= it->bytes;
+	index.erase(it->key);
+	return entries.erase(it);
+}
+
+void ImageCache::Evict()
+{
+	if (budget == 0)
+		return;
+
+	// walk from the least recently used entry, skipping images which are still referenced elsewhere
+	auto it = entries.end();
+	while (bytes > budget && it != entries.begin())
+	{
+		--it;
+
+		if (it->value.use_count() == 1)
+		{
+			stats.evictions++;
+			stats.evictedBytes += it->bytes;
+			it = Erase(it);
+		}
+	}
+}
+
 Scope::Data::Data(Context c, bool bCreateContextEx /*= false*/) :
 	context(c), materialSystem(c)
 {
@@ -17,6 +17,8 @@ limitations under the License.
 #include <frwrap.h>
 #include <memory>
 #include <map>
+#include <list>
+#include <unordered_map>
 #include <vector>
 
 namespace frw 
@@ -76,6 +78,64 @@ public:
 	}
 };
 
+/// Cache of images bounded by a byte budget. Keys are looked up through a hash map, while the entries are kept in a list
+/// ordered from the most to the least recently used one. When the cached images exceed the budget, the least recently used
+/// images not referenced outside of the cache are released; images still used by the scene stay, as dropping them wouldn't
+/// free any memory.
+class ImageCache
+{
+public:
+	struct Entry
+	{
+		size_t key;
+		Image value;
+		size_t bytes; // size of the pixel data, see Image::GetSizeInBytes
+	};
+
+	typedef std::list<Entry> EntryList;
+
+	struct Stats
+	{
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t evictions = 0;
+		size_t evictedBytes = 0;
+	};
+
+private:
+	Image defaultValue;
+	EntryList entries; // most recently used first
+	std::unordered_map<size_t, EntryList::iterator> index;
+	size_t budget = 0;
+	size_t bytes = 0;
+	Stats stats;
+
+public:
+	bool enabled = true;
+
+	void Clear();
+	const Image& Get(size_t k);
+	void Set(size_t k, const Image& v);
+
+	/// Maximum size of the cached images in bytes, 0 for no limit. The cache is trimmed right away to the new budget.
+	void SetBudget(size_t budgetBytes);
+
+	size_t GetBudget() const { return budget; }
+	size_t GetBytes() const { return bytes; }
+	size_t GetCount() const { return index.size(); }
+	const Stats& GetStats() const { return stats; }
+
+	/// Releases all images not referenced outside of the cache
+	void CollectUnused();
+
+	/// Prints the size of the cache and its counters to the debug output
+	void Report() const;
+
+private:
+	EntryList::iterator Erase(EntryList::iterator it);
+	void Evict();
+};
+
 // reference type
 class Scope
 {
@@ -102,7 +162,7 @@ class Scope
 
 		struct CacheStruct
 		{
-			Cache<size_t, Image> image;
+			ImageCache image;
 			Cache<size_t, Shader> shader;
 			Cache<size_t, Shape> shape;
 			Cache<size_t, Value> value;
@@ -195,6 +255,8 @@ public:
 
 	Image GetImage(size_t key) { return m->cache.image.Get(key); }
 	void SetImage(size_t key, Image image) { m->cache.image.Set(key, image); }
+	void SetImageCacheBudget(size_t bytes) { m->cache.image.SetBudget(bytes); }
+	const ImageCache::Stats& GetImageCacheStats() const { return m->cache.image.GetStats(); }
 
 	Value GetValue(size_t key) { return m->cache.value.Get(key); }
 	void SetValue(size_t key, Value value) { m->cache.value.Set(key, value); }
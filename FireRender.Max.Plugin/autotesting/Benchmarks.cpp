@@ -0,0 +1,615 @@
+/**********************************************************************
+Copyright 2020 Advanced Micro Devices, Inc
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+    http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+********************************************************************/
+
+#include "Common.h"
+#include "Benchmarks.h"
+#include "parser/MeshSplitter.h"
+#include "plugin/ScopeManager.h"
+#include "utils/Utils.h"
+#include <MeshNormalSpec.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+FIRERENDER_NAMESPACE_BEGIN;
+
+namespace {
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    double millisecondsSince(const Clock::time_point& start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    double megabytes(size_t bytes) {
+        return double(bytes) / (1024.0 * 1024.0);
+    }
+
+    /// Builds a textured grid of gridSize x gridSize quads whose triangles get random material IDs below numMtlIds
+    void buildSyntheticMesh(Mesh& mesh, int gridSize, int numMtlIds, std::mt19937& random) {
+        const int rowVerts = gridSize + 1;
+        const int numVerts = rowVerts * rowVerts;
+        const int numFaces = gridSize * gridSize * 2;
+
+        mesh.setNumVerts(numVerts);
+        mesh.setNumFaces(numFaces);
+        mesh.setMapSupport(1, TRUE);
+        MeshMap& map = mesh.Map(1);
+        map.setNumVerts(numVerts);
+        map.setNumFaces(numFaces);
+
+        for (int y = 0; y < rowVerts; y++) {
+            for (int x = 0; x < rowVerts; x++) {
+                mesh.setVert(y * rowVerts + x, Point3(float(x), float(y), 0.f));
+                map.tv[y * rowVerts + x] = UVVert(float(x) / gridSize, float(y) / gridSize, 0.f);
+            }
+        }
+
+        std::uniform_int_distribution<int> mtlId(0, numMtlIds - 1);
+        for (int y = 0; y < gridSize; y++) {
+            for (int x = 0; x < gridSize; x++) {
+                const DWORD v0 = y * rowVerts + x;
+                const DWORD v1 = v0 + 1;
+                const DWORD v2 = v0 + rowVerts;
+                const DWORD v3 = v2 + 1;
+                const int f = (y * gridSize + x) * 2;
+
+                mesh.faces[f].setVerts(v0, v1, v3);
+                mesh.faces[f + 1].setVerts(v0, v3, v2);
+                map.tf[f].setTVerts(v0, v1, v3);
+                map.tf[f + 1].setTVerts(v0, v3, v2);
+                for (int i = f; i < f + 2; i++) {
+                    mesh.faces[i].setEdgeVisFlags(1, 1, 0);
+                    mesh.faces[i].setMatID(MtlID(mtlId(random)));
+                }
+            }
+        }
+
+        mesh.InvalidateGeomCache();
+        mesh.SpecifyNormals();
+        mesh.GetSpecifiedNormals()->CheckNormals();
+    }
+
+    /// Index streams of a single material
+    struct MaterialBin {
+        std::vector<rpr_int> vertIndices;
+        std::vector<rpr_int> normalIndices;
+        std::vector<rpr_int> texcoordIndices;
+    };
+
+    /// Bins the triangles the way CreateMesh did before SplitMeshByMaterial: one growing set of index streams per material
+    void splitIntoBins(Mesh& mesh, MeshNormalSpec& normals, int numSubmtls, std::vector<MaterialBin>& bins) {
+#ifdef SWITCH_AXES
+        const int corners[3] = { 0, 2, 1 };
+#else
+        const int corners[3] = { 0, 1, 2 };
+#endif
+        bins.assign(numSubmtls, MaterialBin());
+        for (int i = 0; i < mesh.getNumFaces(); i++) {
+            Face& face = mesh.faces[i];
+            MaterialBin& bin = bins[face.getMatID() % numSubmtls];
+            for (int j = 0; j < 3; j++) {
+                bin.vertIndices.push_back(face.getVert(corners[j]));
+                bin.normalIndices.push_back(normals.GetNormalIndex(i, corners[j]));
+                bin.texcoordIndices.push_back(mesh.maps[1].tf[i].t[corners[j]]);
+            }
+        }
+    }
+
+    /// Counts the materials whose range of the split mesh differs from their bin
+    size_t compareSplit(const SplitMesh& split, const std::vector<MaterialBin>& bins) {
+        auto sameRange = [&split](const std::vector<rpr_int>& stream, int m, const std::vector<rpr_int>& bin) {
+            const size_t first = split.offsets[m];
+            const size_t last = split.offsets[m + 1];
+            return last - first == bin.size() && stream.size() >= last &&
+                std::equal(stream.begin() + first, stream.begin() + last, bin.begin());
+        };
+
+        size_t mismatches = 0;
+        for (int m = 0; m < split.numSubmtls; m++) {
+            if (split.numChannels != 1 ||
+                !sameRange(split.vertIndices, m, bins[m].vertIndices) ||
+                !sameRange(split.normalIndices, m, bins[m].normalIndices) ||
+                !sameRange(split.texcoordIndices[0], m, bins[m].texcoordIndices)) {
+                mismatches++;
+            }
+        }
+        return mismatches;
+    }
+
+    /// Render objects of synthetic nodes, tracked per kind the way the Synchronizer tracks them
+    struct TrackedObjects {
+        std::map<INode*, std::vector<frw::Shape>> shapes;
+        std::map<INode*, frw::Shape> lightShapes;
+        std::map<INode*, frw::Light> lights;
+        std::map<INode*, frw::Shape> portals;
+        size_t count = 0;
+    };
+
+    /// Same layout as Synchronizer::TransformTargets
+    struct TransformTargets {
+        std::vector<frw::Shape> shapes;
+        std::vector<frw::Light> lights;
+    };
+
+    /// Creates the render objects of numNodes nodes: most of them get one to three instances of a single triangle, the rest a
+    /// light shape, a light or a portal. The nodes are never dereferenced, their addresses only serve as keys.
+    void createTrackedObjects(frw::Context& context, const frw::Shape& triangle, std::vector<char>& nodeStorage,
+        std::mt19937& random, TrackedObjects& objects) {
+        std::uniform_int_distribution<int> kind(0, 19);
+        std::uniform_int_distribution<int> instances(1, 3);
+
+        for (size_t i = 0; i < nodeStorage.size(); i++) {
+            INode* node = reinterpret_cast<INode*>(&nodeStorage[i]);
+            const int k = kind(random);
+            if (k < 14) {
+                auto& shapes = objects.shapes[node];
+                for (int j = instances(random); j > 0; j--) {
+                    shapes.push_back(triangle.CreateInstance(context));
+                }
+                objects.count += shapes.size();
+                continue;
+            }
+
+            if (k < 16) {
+                objects.lightShapes[node] = triangle.CreateInstance(context);
+            } else if (k < 19) {
+                objects.lights[node] = context.CreatePointLight();
+            } else {
+                objects.portals[node] = triangle.CreateInstance(context);
+            }
+            objects.count++;
+        }
+    }
+
+    /// Transform command of a single node as it was executed before the reverse index: the maps are probed in turn and the
+    /// matrix is evaluated in the branch which matches
+    size_t updateByProbing(TrackedObjects& objects, INode* node, const Matrix3& nodeTm, float masterScale) {
+        auto ss = objects.shapes.find(node);
+        if (ss != objects.shapes.end()) {
+            Matrix3 tm = nodeTm;
+            tm.SetTrans(tm.GetTrans() * masterScale);
+            for (auto& shape : ss->second) {
+                shape.SetTransform(tm);
+            }
+            return ss->second.size();
+        }
+
+        auto sl = objects.lightShapes.find(node);
+        if (sl != objects.lightShapes.end()) {
+            Matrix3 tm = nodeTm;
+            tm.SetTrans(tm.GetTrans() * masterScale);
+            sl->second.SetTransform(tm);
+            return 1;
+        }
+
+        auto ll = objects.lights.find(node);
+        if (ll != objects.lights.end()) {
+            Matrix3 tm = nodeTm;
+            tm.SetTrans(tm.GetTrans() * masterScale);
+            ll->second.SetTransform(tm);
+            return 1;
+        }
+
+        auto pp = objects.portals.find(node);
+        if (pp != objects.portals.end()) {
+            Matrix3 tm = nodeTm;
+            tm.SetTrans(tm.GetTrans() * masterScale);
+            pp->second.SetTransform(tm);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    /// Conversion of frame buffer pixels as the bitmap copies did it before the SSE/AVX kernels: normalization by the weight,
+    /// normals remap and alpha interleave as separate scalar steps
+    void transformPixelsScalar(const float* src, const float* alpha, float* dst, size_t count, bool isNormals, bool normalize) {
+        for (size_t i = 0; i < count; i++) {
+            const float* in = src + 4 * i;
+            float* out = dst + 4 * i;
+            const float weight = in[3];
+            for (int c = 0; c < 4; c++) {
+                float v = (normalize && c < 3) ? in[c] / weight : in[c];
+                if (isNormals) {
+                    v = v * 0.5f + 0.5f;
+                }
+                out[c] = v;
+            }
+            if (alpha) {
+                out[3] = alpha[4 * i];
+            }
+        }
+    }
+
+    /// Counts the first count pixels of result which differ from the reference by more than rounding
+    size_t countDifferentPixels(const std::vector<float>& result, const std::vector<float>& reference, size_t count) {
+        size_t different = 0;
+        for (size_t i = 0; i < count * 4; i += 4) {
+            for (int c = 0; c < 4; c++) {
+                if (!(std::abs(result[i + c] - reference[i + c]) <= 1e-6f * std::max(1.f, std::abs(reference[i + c])))) {
+                    different++;
+                    break;
+                }
+            }
+        }
+        return different;
+    }
+
+    /// Depth range search of the production renderer before the SSE kernels: finite depths only, pixel by pixel
+    void searchDepthMinMaxScalar(const float* data, size_t count, float& min, float& max) {
+        for (size_t i = 0; i < count; i++) {
+            const float val = data[4 * i];
+            if (!std::isinf(val)) {
+                if (min > val) {
+                    min = val;
+                }
+                if (max < val) {
+                    max = val;
+                }
+            }
+        }
+    }
+
+    /// Depth normalization of the production renderer before the SSE kernels
+    void normalizeDepthScalar(float* data, size_t count, float min, float max) {
+        for (size_t i = 0; i < count; i++) {
+            float val = data[4 * i];
+            if (std::isinf(val) || val >= max) {
+                val = 1.f;
+            } else if (val <= min) {
+                val = 0.f;
+            } else {
+                val = (val - min) / (max - min);
+            }
+            data[4 * i] = data[4 * i + 1] = data[4 * i + 2] = val;
+        }
+    }
+
+    /// Counts the pixels of result which are not bit for bit the same as the reference; NaNs match any NaN
+    size_t countDifferentDepthPixels(const std::vector<float>& result, const std::vector<float>& reference, size_t count) {
+        size_t different = 0;
+        for (size_t i = 0; i < count * 4; i += 4) {
+            for (int c = 0; c < 4; c++) {
+                const bool bothNaN = std::isnan(result[i + c]) && std::isnan(reference[i + c]);
+                if (!bothNaN && result[i + c] != reference[i + c]) {
+                    different++;
+                    break;
+                }
+            }
+        }
+        return different;
+    }
+
+    /// Builds the reverse index the way Synchronizer::BuildTransformTargets does
+    void buildTransformTargets(const TrackedObjects& objects, std::unordered_map<INode*, TransformTargets>& targets) {
+        targets.clear();
+        targets.reserve(objects.shapes.size() + objects.lightShapes.size() + objects.lights.size() + objects.portals.size());
+
+        for (auto& ss : objects.shapes) {
+            auto& shapes = targets[ss.first].shapes;
+            shapes.insert(shapes.end(), ss.second.begin(), ss.second.end());
+        }
+        for (auto& ll : objects.lightShapes) {
+            targets[ll.first].shapes.push_back(ll.second);
+        }
+        for (auto& ll : objects.lights) {
+            targets[ll.first].lights.push_back(ll.second);
+        }
+        for (auto& pp : objects.portals) {
+            targets[pp.first].shapes.push_back(pp.second);
+        }
+    }
+}
+
+size_t benchmarkMeshSplit(std::ostream& output) {
+    const int gridSize = 512;
+    const int mtlIdCounts[] = { 1, 4, 16, 64, 256 };
+
+    std::mt19937 random(1234);
+    size_t mismatches = 0;
+
+    for (int numMtlIds : mtlIdCounts) {
+        Mesh mesh;
+        buildSyntheticMesh(mesh, gridSize, numMtlIds, random);
+        MeshNormalSpec& normals = *mesh.GetSpecifiedNormals();
+        const size_t faceCount = size_t(mesh.getNumFaces());
+
+        auto start = Clock::now();
+        SplitMesh split;
+        SplitMeshByMaterial(mesh, normals, numMtlIds, 1.f, false, split);
+        const double splitTime = millisecondsSince(start);
+
+        start = Clock::now();
+        std::vector<MaterialBin> bins;
+        splitIntoBins(mesh, normals, numMtlIds, bins);
+        const double binsTime = millisecondsSince(start);
+
+        const size_t errors = compareSplit(split, bins);
+        mismatches += errors;
+
+        // the bins used to reserve room for all faces in each of them: 3 vertex, 3 normal and 9 texture coordinate indices
+        const size_t splitBytes = (split.vertIndices.size() + split.normalIndices.size() + split.texcoordIndices[0].size()) *
+            sizeof(rpr_int);
+        const size_t reservedBytes = size_t(numMtlIds) * faceCount * (3 + 3 + 9) * sizeof(rpr_int);
+
+        output << "mesh split, " << numMtlIds << " material IDs, " << faceCount << " faces: counting sort " << splitTime <<
+            " ms, per-material bins " << binsTime << " ms; index buffers " << megabytes(splitBytes) << " MB, bins reserved " <<
+            megabytes(reservedBytes) << " MB; " << errors << " mismatching materials" << std::endl;
+    }
+
+    return mismatches;
+}
+
+size_t benchmarkTransformUpdates(std::ostream& output, IParamBlock2* pblock) {
+    const ScopeID scopeId = ScopeManagerMax::TheManager.CreateScope(pblock);
+    if (scopeId < 0) {
+        output << "transform updates: no RPR context" << std::endl;
+        return 1;
+    }
+
+    size_t missed = 0;
+    {
+        frw::Scope scope = ScopeManagerMax::TheManager.GetScope(scopeId);
+        frw::Context context = scope.GetContext();
+
+        const Point3 vertices[3] = { Point3(0.f, 0.f, 0.f), Point3(1.f, 0.f, 0.f), Point3(0.f, 1.f, 0.f) };
+        const Point3 normal(0.f, 0.f, 1.f);
+        const rpr_int indices[3] = { 0, 1, 2 };
+        const rpr_int normalIndices[3] = { 0, 0, 0 };
+        const rpr_int numFaceVertices = 3;
+        frw::Shape triangle = context.CreateMesh(&vertices[0].x, 3, sizeof(Point3), &normal.x, 1, sizeof(Point3), nullptr, 0, 0,
+            indices, sizeof(rpr_int), normalIndices, sizeof(rpr_int), nullptr, 0, &numFaceVertices, 1);
+
+        const float masterScale = 0.0254f;
+        const int nodeCounts[] = { 100, 1000, 10000 };
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> value(-100.f, 100.f);
+
+        for (int numNodes : nodeCounts) {
+            std::vector<char> nodeStorage(numNodes);
+            TrackedObjects objects;
+            createTrackedObjects(context, triangle, nodeStorage, random, objects);
+
+            // one transform command per node, in a shuffled order
+            std::vector<INode*> nodes(numNodes);
+            std::vector<Matrix3> tms(numNodes);
+            for (int i = 0; i < numNodes; i++) {
+                nodes[i] = reinterpret_cast<INode*>(&nodeStorage[i]);
+                tms[i] = RotateXMatrix(value(random)) * RotateZMatrix(value(random));
+                tms[i].SetTrans(Point3(value(random), value(random), value(random)));
+            }
+            std::shuffle(nodes.begin(), nodes.end(), random);
+
+            auto start = Clock::now();
+            size_t probed = 0;
+            for (INode* node : nodes) {
+                probed += updateByProbing(objects, node, tms[reinterpret_cast<char*>(node) - nodeStorage.data()], masterScale);
+            }
+            const double probingTime = millisecondsSince(start);
+
+            start = Clock::now();
+            std::unordered_map<INode*, TransformTargets> targets;
+            buildTransformTargets(objects, targets);
+            const double indexTime = millisecondsSince(start);
+
+            start = Clock::now();
+            size_t updated = 0;
+            for (INode* node : nodes) {
+                auto tt = targets.find(node);
+                if (tt == targets.end()) {
+                    continue;
+                }
+
+                Matrix3 tm = tms[reinterpret_cast<char*>(node) - nodeStorage.data()];
+                tm.SetTrans(tm.GetTrans() * masterScale);
+                for (auto& shape : tt->second.shapes) {
+                    shape.SetTransform(tm);
+                }
+                for (auto& light : tt->second.lights) {
+                    light.SetTransform(tm);
+                }
+                updated += tt->second.shapes.size() + tt->second.lights.size();
+            }
+            const double indexedTime = millisecondsSince(start);
+
+            const size_t errors = objects.count - std::min(updated, objects.count);
+            missed += errors;
+
+            output << "transform updates, " << numNodes << " nodes, " << objects.count << " render objects: map probing " <<
+                probingTime << " ms (" << probed << " updated), reverse index " << indexedTime << " ms + " << indexTime <<
+                " ms to build (" << updated << " updated); " << errors << " objects missed" << std::endl;
+        }
+    }
+
+    ScopeManagerMax::TheManager.DestroyScope(scopeId);
+    return missed;
+}
+
+size_t benchmarkPixelKernels(std::ostream& output) {
+    struct Mode {
+        const char* name;
+        bool isNormals;
+        bool normalize;
+        bool alpha;
+    };
+    const Mode modes[] = {
+        { "color with alpha", false, false, true },
+        { "normals with alpha", true, false, true },
+        { "preview", false, true, false },
+    };
+
+    struct Kernel {
+        const char* name;
+        PixelKernel kernel;
+    };
+    const Kernel kernels[] = { { "SSE", PixelKernel::Sse }, { "AVX", PixelKernel::Avx } };
+
+    const int maxWidth = 16384;
+    const int stripRows = 64; // rows of synthetic data, reused for all rows of the frame
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> value(-1.f, 4.f);
+    std::uniform_real_distribution<float> weight(0.5f, 64.f);
+    std::uniform_real_distribution<float> coverage(0.f, 1.f);
+
+    const size_t stripFloats = size_t(maxWidth) * stripRows * 4;
+    std::vector<float> src(stripFloats), alpha(stripFloats), reference(stripFloats), converted(stripFloats);
+    for (size_t i = 0; i < stripFloats; i += 4) {
+        const float w = weight(random);
+        for (int c = 0; c < 3; c++) {
+            src[i + c] = value(random) * w;
+        }
+        src[i + 3] = w;
+        alpha[i] = coverage(random);
+    }
+
+    size_t mismatches = 0;
+    for (int width = 1024; width <= maxWidth; width *= 2) {
+        const int height = width / 2;
+        const double megapixels = double(width) * height / 1e6;
+        const size_t stripPixels = size_t(width) * std::min(height, stripRows);
+
+        for (const Mode& mode : modes) {
+            const float* alphaData = mode.alpha ? alpha.data() : nullptr;
+
+            auto convertFrame = [&](auto convertRow) {
+                const auto start = Clock::now();
+                for (int y = 0; y < height; y++) {
+                    const size_t rowStart = size_t(y % stripRows) * width * 4;
+                    convertRow(src.data() + rowStart, alphaData ? alphaData + rowStart : nullptr, converted.data() + rowStart);
+                }
+                return millisecondsSince(start);
+            };
+
+            const double scalarTime = convertFrame([&](const float* in, const float* a, float* out) {
+                transformPixelsScalar(in, a, out, width, mode.isNormals, mode.normalize);
+            });
+            std::copy(converted.begin(), converted.begin() + stripPixels * 4, reference.begin());
+
+            output << "pixel conversion, " << width << "x" << height << ", " << mode.name << ": scalar " <<
+                megapixels / scalarTime * 1000.0 << " Mpixels/s";
+
+            size_t errors = 0;
+            for (const Kernel& kernel : kernels) {
+                if (!IsPixelKernelSupported(kernel.kernel)) {
+                    continue;
+                }
+
+                std::fill(converted.begin(), converted.begin() + stripPixels * 4, 0.f);
+                const double kernelTime = convertFrame([&](const float* in, const float* a, float* out) {
+                    TransformFrameBufferPixels(kernel.kernel, in, a, out, width, mode.isNormals, mode.normalize);
+                });
+                errors += countDifferentPixels(converted, reference, stripPixels);
+
+                output << ", " << kernel.name << " " << megapixels / kernelTime * 1000.0 << " Mpixels/s";
+            }
+
+            output << "; " << errors << " mismatching pixels" << std::endl;
+            mismatches += errors;
+        }
+    }
+
+    return mismatches;
+}
+
+size_t benchmarkDepthKernels(std::ostream& output) {
+    struct Size {
+        int width;
+        int height;
+    };
+    const Size sizes[] = { { 1001, 333 }, { 1920, 1080 }, { 3840, 2160 } };
+    const size_t chunkPixels = 16 * 1024; // same chunks as PRManagerMax::PostProcessDepth
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> depth(0.1f, 1000.f);
+    std::uniform_int_distribution<int> special(0, 999);
+
+    size_t mismatches = 0;
+    for (const Size& size : sizes) {
+        const size_t pixelCount = size_t(size.width) * size.height;
+        const double megapixels = double(pixelCount) / 1e6;
+
+        // depths with background (infinite) pixels and a few NaNs, alpha as coverage
+        std::vector<float> source(pixelCount * 4);
+        for (size_t i = 0; i < source.size(); i += 4) {
+            const int kind = special(random);
+            source[i] = kind < 100 ? std::numeric_limits<float>::infinity() :
+                kind < 102 ? -std::numeric_limits<float>::infinity() :
+                kind < 103 ? std::numeric_limits<float>::quiet_NaN() : depth(random);
+            source[i + 1] = source[i + 2] = 0.f;
+            source[i + 3] = float(i % 7) / 6.f;
+        }
+
+        std::vector<float> reference(source);
+        float referenceMin = std::numeric_limits<float>::max();
+        float referenceMax = std::numeric_limits<float>::lowest();
+        auto start = Clock::now();
+        searchDepthMinMaxScalar(reference.data(), pixelCount, referenceMin, referenceMax);
+        normalizeDepthScalar(reference.data(), pixelCount, referenceMin, referenceMax);
+        const double scalarTime = millisecondsSince(start);
+
+        std::vector<float> result(source);
+        float min = std::numeric_limits<float>::max();
+        float max = std::numeric_limits<float>::lowest();
+        start = Clock::now();
+        SearchDepthMinMax(result.data(), 0, pixelCount, min, max);
+        NormalizeDepth(result.data(), 0, pixelCount, min, max);
+        const double sseTime = millisecondsSince(start);
+        size_t errors = countDifferentDepthPixels(result, reference, pixelCount) + (min != referenceMin || max != referenceMax);
+
+        // the same kernels on chunks run by OpenMP threads, as the production renderer runs them
+        std::copy(source.begin(), source.end(), result.begin());
+        const int chunkCount = int((pixelCount + chunkPixels - 1) / chunkPixels);
+        min = std::numeric_limits<float>::max();
+        max = std::numeric_limits<float>::lowest();
+        start = Clock::now();
+        #pragma omp parallel
+        {
+            float localMin = std::numeric_limits<float>::max();
+            float localMax = std::numeric_limits<float>::lowest();
+
+            #pragma omp for nowait
+            for (int chunk = 0; chunk < chunkCount; ++chunk) {
+                const size_t begin = chunk * chunkPixels;
+                SearchDepthMinMax(result.data(), begin, std::min(begin + chunkPixels, pixelCount), localMin, localMax);
+            }
+
+            #pragma omp critical
+            {
+                min = std::min(min, localMin);
+                max = std::max(max, localMax);
+            }
+        }
+        #pragma omp parallel for
+        for (int chunk = 0; chunk < chunkCount; ++chunk) {
+            const size_t begin = chunk * chunkPixels;
+            NormalizeDepth(result.data(), begin, std::min(begin + chunkPixels, pixelCount), min, max);
+        }
+        const double parallelTime = millisecondsSince(start);
+        errors += countDifferentDepthPixels(result, reference, pixelCount) + (min != referenceMin || max != referenceMax);
+
+        output << "depth normalization, " << size.width << "x" << size.height << ": scalar " << megapixels / scalarTime * 1000.0 <<
+            " Mpixels/s, SSE " << megapixels / sseTime * 1000.0 << " Mpixels/s, SSE on OpenMP threads " <<
+            megapixels / parallelTime * 1000.0 << " Mpixels/s; " << errors << " mismatching pixels" << std::endl;
+        mismatches += errors;
+    }
+
+    return mismatches;
+}
+
+FIRERENDER_NAMESPACE_END;
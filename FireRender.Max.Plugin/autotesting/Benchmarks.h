@@ -0,0 +1,46 @@
+/**********************************************************************
+Copyright 2020 Advanced Micro Devices, Inc
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+    http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+********************************************************************/
+
+#pragma once
+#include "Common.h"
+#include <iparamb2.h>
+#include <ostream>
+FIRERENDER_NAMESPACE_BEGIN;
+
+// Benchmarks of the translation and post-processing kernels on synthetic data, run by the auto-tester and reported in its
+// selfcheck.txt. Each of them checks the kernel against a straightforward reference implementation, writes the timings of both
+// to the output and returns the number of mismatches found.
+
+/// Splits synthetic meshes with 1 to 256 material IDs with SplitMeshByMaterial and with per-material bins, as the meshes were
+/// split before, and compares the index streams of each material
+size_t benchmarkMeshSplit(std::ostream& output);
+
+/// Moves 100 to 10000 synthetic nodes with RPR shapes, lights and portals, once by probing the per-kind maps node by node, as
+/// the transform commands used to be executed, and once through a reverse index from nodes to their render objects, as
+/// Synchronizer::UpdateTransforms does. The objects are created in a new RPR context set up from the given render settings.
+/// Returns the number of render objects the reverse index didn't update.
+size_t benchmarkTransformUpdates(std::ostream& output, IParamBlock2* pblock);
+
+/// Converts synthetic frame buffers 1K to 16K pixels wide, and half as high, to bitmap pixels with the scalar code the bitmap
+/// copies used before and with each SSE/AVX kernel the CPU supports: color with alpha, normals with alpha and the weight
+/// normalized tone operator preview. Rows are converted one by one on a single thread, as each OpenMP thread does. Returns
+/// the number of pixels a kernel converted differently from the scalar code.
+size_t benchmarkPixelKernels(std::ostream& output);
+
+/// Normalizes synthetic depth AOVs from 1001x333 to 3840x2160 pixels, with background and NaN depths, with the scalar code the
+/// production renderer used before and with the SSE depth kernels, on a single thread and on chunks run by OpenMP threads as
+/// PRManagerMax::PostProcessDepth runs them. Returns the number of pixels normalized differently from the scalar code, plus
+/// one for each depth range which differs.
+size_t benchmarkDepthKernels(std::ostream& output);
+
+FIRERENDER_NAMESPACE_END;
@@ -0,0 +1,341 @@
+/**********************************************************************
+Copyright 2020 Advanced Micro Devices, Inc
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+    http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+********************************************************************/
+
+#include "Common.h"
+#include "HashCheck.h"
+#include "utils/HashValue.h"
+#include <iparamb2.h>
+#include <triobj.h>
+#include <stdmat.h>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+FIRERENDER_NAMESPACE_BEGIN;
+
+namespace {
+
+    /// The CRC32 HashValue used before the 64-bit hash: Slicing-by-16 by Bulat Ziganshin, based on the work of Stephan Brumme
+    /// (see http://create.stephan-brumme.com/disclaimer.html). The tables are computed on first use instead of being spelled out.
+    class Crc32Hash {
+        static const uint32_t Polynomial = 0xEDB88320;
+
+        static const uint32_t (&lookup())[16][256] {
+            static uint32_t table[16][256];
+            static bool initialized = false;
+            if (!initialized) {
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t crc = i;
+                    for (int j = 0; j < 8; j++) {
+                        crc = (crc >> 1) ^ (uint32_t(-int32_t(crc & 1)) & Polynomial);
+                    }
+                    table[0][i] = crc;
+                }
+                for (uint32_t i = 0; i < 256; i++) {
+                    for (int slice = 1; slice < 16; slice++) {
+                        table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+                    }
+                }
+                initialized = true;
+            }
+            return table;
+        }
+
+        static uint32_t update(const void* data, size_t length, uint32_t previousCrc32) {
+            const uint32_t (&table)[16][256] = lookup();
+            uint32_t crc = ~previousCrc32;
+            const uint8_t* current = static_cast<const uint8_t*>(data);
+
+            for (; length >= 16; length -= 16, current += 16) {
+                uint32_t one, two, three, four;
+                memcpy(&one, current, 4);
+                memcpy(&two, current + 4, 4);
+                memcpy(&three, current + 8, 4);
+                memcpy(&four, current + 12, 4);
+                one ^= crc;
+
+                crc = table[0][(four >> 24) & 0xFF] ^ table[1][(four >> 16) & 0xFF] ^ table[2][(four >> 8) & 0xFF] ^ table[3][four & 0xFF] ^
+                    table[4][(three >> 24) & 0xFF] ^ table[5][(three >> 16) & 0xFF] ^ table[6][(three >> 8) & 0xFF] ^ table[7][three & 0xFF] ^
+                    table[8][(two >> 24) & 0xFF] ^ table[9][(two >> 16) & 0xFF] ^ table[10][(two >> 8) & 0xFF] ^ table[11][two & 0xFF] ^
+                    table[12][(one >> 24) & 0xFF] ^ table[13][(one >> 16) & 0xFF] ^ table[14][(one >> 8) & 0xFF] ^ table[15][one & 0xFF];
+            }
+
+            while (length-- != 0) {
+                crc = (crc >> 8) ^ table[0][(crc & 0xFF) ^ *current++];
+            }
+
+            return ~crc;
+        }
+
+        uint32_t crc = 0;
+
+    public:
+        Crc32Hash& Append(const void* data, size_t length) {
+            crc = update(data, length, crc);
+            return *this;
+        }
+
+        operator uint32_t() const {
+            return crc;
+        }
+    };
+
+    /// Records the key of a material or texture map the way MaterialParser::HashParamBlock does: every parameter of every param
+    /// block, with referenced maps and materials expanded in place
+    void recordAnimatable(HashKeyCheck& key, Animatable* anim, TimeValue t, std::unordered_set<Animatable*>& path) {
+        key << anim;
+        if (!anim || !path.insert(anim).second) {
+            return;
+        }
+
+        key << anim->ClassID();
+
+        for (int i = 0; i < anim->NumParamBlocks(); i++) {
+            IParamBlock2* pb = anim->GetParamBlock(i);
+            if (!pb) {
+                continue;
+            }
+
+            auto pbd = pb->GetDesc();
+            key << pb << pbd->count;
+
+            for (USHORT j = 0; j < pbd->count; j++) {
+                ParamID id = pbd->IndextoID(j);
+                ParamDef &pdef = pbd->GetParamDef(id);
+                key << id << pdef.type;
+
+                const int count = is_tab(pdef.type) ? pb->Count(id) : 1;
+                for (int tabIndex = 0; tabIndex < count; tabIndex++) {
+                    switch (base_type(pdef.type)) {
+                    case TYPE_FLOAT: case TYPE_ANGLE: case TYPE_PCNT_FRAC: case TYPE_WORLD: case TYPE_COLOR_CHANNEL: {
+                        float v = 0;
+                        pb->GetValue(id, t, v, FOREVER, tabIndex);
+                        key << v;
+                        break;
+                    }
+                    case TYPE_INT: case TYPE_BOOL: case TYPE_TIMEVALUE: case TYPE_RADIOBTN_INDEX: case TYPE_INDEX: {
+                        int v = 0;
+                        pb->GetValue(id, t, v, FOREVER, tabIndex);
+                        key << v;
+                        break;
+                    }
+                    case TYPE_STRING: case TYPE_FILENAME: {
+                        const MCHAR* v = 0;
+                        if (pb->GetValue(id, t, v, FOREVER, tabIndex) && v) {
+                            key << v;
+                        }
+                        break;
+                    }
+                    case TYPE_MTL: case TYPE_TEXMAP: case TYPE_REFTARG: {
+                        ReferenceTarget* v = 0;
+                        pb->GetValue(id, t, v, FOREVER, tabIndex);
+                        recordAnimatable(key, v, t, path);
+                        break;
+                    }
+                    case TYPE_POINT3: case TYPE_RGBA: case TYPE_HSV: {
+                        Point3 v;
+                        pb->GetValue(id, t, v, FOREVER, tabIndex);
+                        key << v;
+                        break;
+                    }
+                    case TYPE_POINT4: case TYPE_FRGBA: {
+                        Point4 v;
+                        pb->GetValue(id, t, v, FOREVER, tabIndex);
+                        key << v;
+                        break;
+                    }
+                    default:
+                        break;
+                    }
+                }
+            }
+        }
+
+        path.erase(anim);
+    }
+
+    /// Collects a material and all the materials and maps it references
+    void collectMaterials(MtlBase* mtl, std::vector<MtlBase*>& result, std::unordered_set<MtlBase*>& seen) {
+        if (!mtl || !seen.insert(mtl).second) {
+            return;
+        }
+        result.push_back(mtl);
+
+        if (mtl->IsMtl()) {
+            Mtl* m = static_cast<Mtl*>(mtl);
+            for (int i = 0; i < m->NumSubMtls(); i++) {
+                collectMaterials(m->GetSubMtl(i), result, seen);
+            }
+        }
+        for (int i = 0; i < mtl->NumSubTexmaps(); i++) {
+            collectMaterials(mtl->GetSubTexmap(i), result, seen);
+        }
+    }
+
+    void collectNodes(INode* node, std::vector<INode*>& result) {
+        result.push_back(node);
+        for (int i = 0; i < node->NumberOfChildren(); i++) {
+            collectNodes(node->GetChildNode(i), result);
+        }
+    }
+
+    /// Records the key of a mesh the way ComputeGeometryCacheKey does: a few settings followed by the vertex, face and map
+    /// channel arrays as bulk blocks
+    void recordMesh(HashKeyCheck& key, Mesh& mesh, int numSubmtls) {
+        key << 3 << numSubmtls << 1.f << false << false;
+
+        key.Append(mesh.verts, mesh.getNumVerts() * sizeof(Point3));
+        key.Append(mesh.faces, mesh.getNumFaces() * sizeof(Face));
+
+        const int numChannels = std::min(mesh.getNumMaps() - 1, 2);
+        key << numChannels;
+        for (int i = 1; i <= numChannels; i++) {
+            if (!mesh.mapSupport(i)) {
+                key << false;
+                continue;
+            }
+            MeshMap& map = mesh.maps[i];
+            key << true;
+            key.Append(map.tv, map.vnum * sizeof(UVVert));
+            key.Append(map.tf, map.fnum * sizeof(TVFace));
+        }
+    }
+
+    template <class Hash, class KeyType>
+    double hashKeys(const std::vector<uint8_t>& bytes, const std::vector<uint32_t>& blockSizes, const std::vector<size_t>& keyBlocks,
+        std::vector<KeyType>& result) {
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        result.resize(keyBlocks.size());
+        const uint8_t* p = bytes.data();
+        for (size_t k = 0; k < keyBlocks.size(); k++) {
+            const size_t end = (k + 1 < keyBlocks.size()) ? keyBlocks[k + 1] : blockSizes.size();
+            Hash hash;
+            for (size_t b = keyBlocks[k]; b < end; b++) {
+                hash.Append(p, blockSizes[b]);
+                p += blockSizes[b];
+            }
+            result[k] = KeyType(hash);
+        }
+
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    /// Counts the keys which share their value with a key of a different input. Equal inputs give equal values with both
+    /// hashes, so a value of one hash paired with several values of the other one is a collision of the first hash.
+    template <class KeyType, class OtherKeyType>
+    size_t countCollisions(const std::vector<KeyType>& keys, const std::vector<OtherKeyType>& otherKeys) {
+        std::unordered_map<KeyType, std::set<OtherKeyType>> inputs;
+        for (size_t k = 0; k < keys.size(); k++) {
+            inputs[keys[k]].insert(otherKeys[k]);
+        }
+
+        size_t collisions = 0;
+        for (auto& it : inputs) {
+            collisions += it.second.size() - 1;
+        }
+        return collisions;
+    }
+}
+
+void HashKeyCheck::addCurrentScene() {
+    Interface* ip = GetCOREInterface();
+
+    std::vector<INode*> nodes;
+    collectNodes(ip->GetRootNode(), nodes);
+
+    // materials and maps, sampled over the animation range as their keys change with the time
+    std::vector<MtlBase*> materials;
+    std::unordered_set<MtlBase*> seen;
+    for (INode* node : nodes) {
+        collectMaterials(node->GetMtl(), materials, seen);
+    }
+
+    const Interval range = ip->GetAnimRange();
+    const TimeValue step = std::max<TimeValue>(GetTicksPerFrame(), (range.End() - range.Start()) / 100);
+    for (TimeValue t = range.Start(); t <= range.End(); t += step) {
+        for (MtlBase* mtl : materials) {
+            std::unordered_set<Animatable*> path;
+            beginKey();
+            recordAnimatable(*this, mtl, t, path);
+            materialKeys++;
+
+            // textures are keyed by the map and the image flags
+            if (mtl->ClassID() == Class_ID(BMTEX_CLASS_ID, 0)) {
+                for (int flags = 0; flags < 4; flags++) {
+                    path.clear();
+                    beginKey();
+                    recordAnimatable(*this, mtl, t, path);
+                    *this << flags;
+                    materialKeys++;
+                }
+            }
+        }
+    }
+
+    // geometry
+    for (INode* node : nodes) {
+        ObjectState os = node->EvalWorldState(0);
+        if (!os.obj || os.obj->SuperClassID() != GEOMOBJECT_CLASS_ID || !os.obj->CanConvertToType(triObjectClassID)) {
+            continue;
+        }
+
+        TriObject* tri = static_cast<TriObject*>(os.obj->ConvertToType(0, triObjectClassID));
+        if (!tri) {
+            continue;
+        }
+
+        Mtl* mtl = node->GetMtl();
+        beginKey();
+        recordMesh(*this, tri->GetMesh(), mtl ? std::max(mtl->NumSubMtls(), 1) : 1);
+        geometryKeys++;
+
+        if (tri != os.obj) {
+            tri->MaybeAutoDelete();
+        }
+    }
+}
+
+size_t HashKeyCheck::report(std::ostream& output) const {
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> crcKeys;
+
+    // repeat the hashing until the timings are long enough to be meaningful
+    double seconds = 0, crcSeconds = 0;
+    int repeats = 0;
+    do {
+        seconds += hashKeys<HashValue>(bytes, blockSizes, keyBlocks, keys);
+        crcSeconds += hashKeys<Crc32Hash>(bytes, blockSizes, keyBlocks, crcKeys);
+        repeats++;
+    } while (seconds + crcSeconds < 0.5 && repeats < 1000);
+
+    const size_t collisions = countCollisions(keys, crcKeys);
+    const size_t crcCollisions = countCollisions(crcKeys, keys);
+
+    std::set<std::pair<uint64_t, uint32_t>> distinct;
+    for (size_t k = 0; k < keys.size(); k++) {
+        distinct.emplace(keys[k], crcKeys[k]);
+    }
+
+    const double megabytes = double(bytes.size()) * repeats / (1024.0 * 1024.0);
+    output << "hash keys: " << materialKeys << " material and texture keys, " << geometryKeys << " geometry keys, " <<
+        distinct.size() << " distinct, " << bytes.size() << " bytes in " << blockSizes.size() << " blocks" << std::endl;
+    output << "hash keys, HashValue: " << collisions << " collisions, " << (seconds > 0 ? megabytes / seconds : 0) << " MB/s" << std::endl;
+    output << "hash keys, CRC32 slicing-by-16: " << crcCollisions << " collisions, " << (crcSeconds > 0 ? megabytes / crcSeconds : 0) <<
+        " MB/s" << std::endl;
+
+    return collisions;
+}
+
+FIRERENDER_NAMESPACE_END;
@@ -0,0 +1,67 @@
+/**********************************************************************
+Copyright 2020 Advanced Micro Devices, Inc
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+    http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+********************************************************************/
+
+#pragma once
+#include "Common.h"
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+FIRERENDER_NAMESPACE_BEGIN;
+
+/// Collision test and benchmark of HashValue against the slicing-by-16 CRC32 it replaced, run on the keys of the test scenes.
+/// The keys are built from the materials, textures and meshes of each scene the same way the plugin builds its cache keys,
+/// and recorded as the sequence of blocks fed to the hash, so that both hashes are run on exactly the same input and the
+/// timings don't include the 3ds Max queries.
+class HashKeyCheck {
+
+    /// Recorded blocks of all keys, in order
+    std::vector<uint8_t> bytes;
+    std::vector<uint32_t> blockSizes;
+
+    /// For each key, the index of its first block; the key ends where the next one starts
+    std::vector<size_t> keyBlocks;
+
+    /// Number of keys of each kind
+    size_t materialKeys = 0;
+    size_t geometryKeys = 0;
+
+public:
+
+    /// Records the material, texture and geometry keys of the scene currently loaded in 3ds Max
+    void addCurrentScene();
+
+    /// Hashes all recorded keys with both hashes and writes the number of distinct keys, the collisions of each hash and the
+    /// hashing throughput to the output
+    /// \return number of collisions of HashValue
+    size_t report(std::ostream& output) const;
+
+    // Same interface as HashValue (operator<< and Append), so the key builders can record into this object directly
+    template <class T>
+    HashKeyCheck& operator<<(const T& v) {
+        return Append(&v, sizeof(v));
+    }
+
+    HashKeyCheck& Append(const void* data, size_t length) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        bytes.insert(bytes.end(), p, p + length);
+        blockSizes.push_back(uint32_t(length));
+        return *this;
+    }
+
+    /// Starts recording a new key
+    void beginKey() {
+        keyBlocks.push_back(blockSizes.size());
+    }
+};
+
+FIRERENDER_NAMESPACE_END;
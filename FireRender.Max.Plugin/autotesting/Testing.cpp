@@ -13,23 +13,23 @@ limitations under the License.
 
 #include "Common.h"
 #include "Testing.h"
+#include "HashCheck.h"
+#include "Benchmarks.h"
 #include "utils\Utils.h"
 #include "utils/Stack.h"
 #include <direct.h>
 #include "bitmap.h"
 #include "plugin/FireRenderer.h"
 #include "plugin/ParamBlock.h"
+#include "plugin/FRSettingsFileHandler.h"
+#include <fstream>
+#include <random>
 FIRERENDER_NAMESPACE_BEGIN;
 
-/// Renders an image in 3ds Max and saves it to specified path. The scene must exist at location testPath/testName/scene.max
-/// and it must be set up to render with RPR
-/// \param testPath Root folder where the test sub-directory is located
-/// \param testName Name of the test, which is also the name of sub-directory inside testPath
-/// \param passes How many passes to render
-/// \param outputPath where to write the result image
-/// \return true if the operation succeeded, false if there was any problem (non-existing scene, RPR not set as renderer, 
-///         ...)
-bool renderSingle(const std::string& testPath, const std::string& testName, const int passes, const std::string& outputPath) {
+/// Loads the scene of a test. The scene must exist at location testPath/testName/scene.max and it must be set up to render 
+/// with RPR
+/// \return the renderer, or nullptr if there was any problem (non-existing scene, RPR not set as renderer, ...)
+Renderer* loadTestScene(const std::string& testPath, const std::string& testName) {
     Interface11* ip = GetCOREInterface11();
     
     const std::string fullName = testPath + "/" + testName + "/scene.max";
@@ -39,7 +39,7 @@ bool renderSingle(const std::string& testPath, const std::string& testName, cons
     
     if(!res) { //scene cannot be open
         FASSERT(false);
-        return false;
+        return nullptr;
     }
 
     Renderer* renderer = ip->GetCurrentRenderer(true);
@@ -47,14 +47,16 @@ bool renderSingle(const std::string& testPath, const std::string& testName, cons
 
     if(!(renderer && dynamic_cast<FireRenderer*>(renderer))) { //RPR is not the current renderer
         FASSERT(false);
-        return false;
+        return nullptr;
     }
 
-    IParamBlock2* pb = renderer->GetParamBlock(0); // sets the required number of passes
-    SetInPb(pb, PARAM_PASS_LIMIT, passes);
+    return renderer;
+}
+
+/// Renders the current scene at time 0 into a new float bitmap, which has to be deleted by the caller
+::Bitmap* renderCurrentScene(BitmapInfo& bi) {
+    Interface11* ip = GetCOREInterface11();
 
-    // Prepare the bitmap where the results are written
-    BitmapInfo bi;
     bi.SetType(BMM_FLOAT_RGBA_32);
     bi.SetWidth(WORD(ip->GetRendWidth()));
     bi.SetHeight(WORD(ip->GetRendHeight()));
@@ -63,13 +65,40 @@ bool renderSingle(const std::string& testPath, const std::string& testName, cons
     bi.SetAspect(1.f);
     ::Bitmap *bmap = TheManager->Create(&bi);
     FASSERT(bmap != NULL);
-     
-    // Render the image at time 0 into our bitmap
-    ip->QuickRender(0, bmap);
+
+    if (bmap) {
+        ip->QuickRender(0, bmap);
+    }
+    return bmap;
+}
+
+/// Renders an image in 3ds Max and saves it to specified path. The scene must exist at location testPath/testName/scene.max
+/// and it must be set up to render with RPR
+/// \param testPath Root folder where the test sub-directory is located
+/// \param testName Name of the test, which is also the name of sub-directory inside testPath
+/// \param passes How many passes to render
+/// \param outputPath where to write the result image
+/// \return true if the operation succeeded, false if there was any problem (non-existing scene, RPR not set as renderer, 
+///         ...)
+bool renderSingle(const std::string& testPath, const std::string& testName, const int passes, const std::string& outputPath) {
+    Renderer* renderer = loadTestScene(testPath, testName);
+    if (!renderer) {
+        return false;
+    }
+
+    IParamBlock2* pb = renderer->GetParamBlock(0); // sets the required number of passes
+    SetInPb(pb, PARAM_PASS_LIMIT, passes);
+
+    // Render the image at time 0 into a new bitmap
+    BitmapInfo bi;
+    ::Bitmap *bmap = renderCurrentScene(bi);
+    if (!bmap) {
+        return false;
+    }
     
     // Save the image
     bi.SetName(ToUnicode(outputPath + testName + ".png").c_str());
-    res = bmap->OpenOutput(&bi);
+    int res = bmap->OpenOutput(&bi);
     FASSERT(res == BMMRES_SUCCESS);
     res = bmap->Write(&bi);
     FASSERT(res == BMMRES_SUCCESS);
@@ -80,6 +109,301 @@ bool renderSingle(const std::string& testPath, const std::string& testName, cons
 }
 
 
+/// Node by node evaluation of the shadow catcher composite graph of the production renderer (ShadowCatcherComposite in 
+/// PRManager.cpp) for a single pixel of raw, not yet normalized AOVs
+void evaluateShadowCatcherGraph(const float* color, const float* background, const float* opacity, const float* shadowCatcher,
+    const float shadowColor[4], float shadowWeight, bool bgIsEnv, float* result) {
+    // normalize nodes: color divided by the accumulated weight; with aovtype RPR_AOV_SHADOW_CATCHER also clamped to 0..1
+    auto normalize = [](const float* in, bool isShadowCatcher, float* out) {
+        for (int c = 0; c < 4; ++c) {
+            float v = in[3] > 0.f ? in[c] / in[3] : 0.f;
+            if (isShadowCatcher) {
+                v = std::min(std::max(v, 0.f), 1.f);
+            }
+            out[c] = v;
+        }
+    };
+
+    float colorNorm[4], bgNorm[4], opacityNorm[4], scNorm[4];
+    normalize(color, false, colorNorm);
+    normalize(background, false, bgNorm);
+    normalize(opacity, false, opacityNorm);
+    normalize(shadowCatcher, true, scNorm);
+
+    for (int c = 0; c < 4; ++c) {
+        const float lerp1 = bgNorm[c] * (1.f - opacityNorm[c]) + colorNorm[c] * opacityNorm[c];
+        const float color0 = bgIsEnv ? lerp1 : colorNorm[c];
+        const float weight = scNorm[c] * shadowWeight;
+        result[c] = color0 * (1.f - weight) + shadowColor[c] * weight;
+    }
+}
+
+/// Self-check of the CPU shadow catcher composite: compares CompositeShadowCatcherPixels with the graph evaluated node by node
+/// on random AOVs, including pixels without samples and shadow catcher values outside 0..1.
+/// \return largest absolute difference found
+float checkShadowCatcherComposite() {
+    const int pixelCount = 4096;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> value(-0.5f, 4.f);
+    std::uniform_real_distribution<float> samples(0.f, 16.f);
+
+    std::vector<float> color(pixelCount * 4), background(pixelCount * 4), opacity(pixelCount * 4), shadowCatcher(pixelCount * 4);
+    for (int i = 0; i < pixelCount; ++i) {
+        const float weight = (i % 97 == 0) ? 0.f : samples(random);
+        for (int c = 0; c < 4; ++c) {
+            color[i * 4 + c] = (c == 3) ? weight : value(random) * weight;
+            background[i * 4 + c] = (c == 3) ? weight : value(random) * weight;
+            opacity[i * 4 + c] = (c == 3) ? weight : std::min(std::max(value(random), 0.f), 1.f) * weight;
+            shadowCatcher[i * 4 + c] = (c == 3) ? weight : value(random) * weight;
+        }
+    }
+
+    // the CPU path gets resolved color, background and opacity, and the raw shadow catcher AOV
+    auto resolve = [](const std::vector<float>& raw) {
+        std::vector<float> resolved(raw.size());
+        for (size_t i = 0; i < raw.size(); i += 4) {
+            for (int c = 0; c < 4; ++c) {
+                resolved[i + c] = raw[i + 3] > 0.f ? raw[i + c] / raw[i + 3] : 0.f;
+            }
+        }
+        return resolved;
+    };
+
+    const float shadowColor[4] = { 0.1f, 0.2f, 0.3f, 0.8f };
+    const float shadowWeight = 0.7f;
+
+    float maxDifference = 0.f;
+    for (int bgIsEnv = 0; bgIsEnv < 2; ++bgIsEnv) {
+        std::vector<float> composited = resolve(color);
+        const std::vector<float> backgroundResolved = resolve(background);
+        const std::vector<float> opacityResolved = resolve(opacity);
+        CompositeShadowCatcherPixels(composited.data(), backgroundResolved.data(), opacityResolved.data(), shadowCatcher.data(),
+            pixelCount, shadowColor, shadowWeight, bgIsEnv != 0);
+
+        for (int i = 0; i < pixelCount; ++i) {
+            float expected[4];
+            evaluateShadowCatcherGraph(&color[i * 4], &background[i * 4], &opacity[i * 4], &shadowCatcher[i * 4], shadowColor,
+                shadowWeight, bgIsEnv != 0, expected);
+            for (int c = 0; c < 4; ++c) {
+                maxDifference = std::max(maxDifference, std::abs(composited[i * 4 + c] - expected[c]));
+            }
+        }
+    }
+
+    return maxDifference;
+}
+
+/// Renders a test scene with the shadow catcher composited by the RPR composite graph and on the CPU, and returns the largest
+/// absolute difference between the two images, or a negative value if the scene could not be rendered
+float compareShadowCatcherPaths(const std::string& testPath, const std::string& testName, const int passes) {
+    Renderer* renderer = loadTestScene(testPath, testName);
+    if (!renderer) {
+        return -1.f;
+    }
+    SetInPb(renderer->GetParamBlock(0), PARAM_PASS_LIMIT, passes);
+
+    const std::string& setting = FRSettingsFileHandler::ShadowCatcherCpuComposite;
+    const std::string previous = FRSettingsFileHandler::getAttributeSettingsFor(setting);
+
+    ::Bitmap* images[2] = {};
+    for (int cpu = 0; cpu < 2; ++cpu) {
+        FRSettingsFileHandler::setAttributeSettingsFor(setting, cpu ? "1" : "0");
+        BitmapInfo bi;
+        images[cpu] = renderCurrentScene(bi);
+    }
+    FRSettingsFileHandler::setAttributeSettingsFor(setting, previous);
+
+    float maxDifference = -1.f;
+    if (images[0] && images[1]) {
+        maxDifference = 0.f;
+        const int width = images[0]->Width();
+        std::vector<BMM_Color_fl> gpuRow(width), cpuRow(width);
+        for (int y = 0; y < images[0]->Height(); ++y) {
+            images[0]->GetPixels(0, y, width, gpuRow.data());
+            images[1]->GetPixels(0, y, width, cpuRow.data());
+            for (int x = 0; x < width; ++x) {
+                maxDifference = std::max({ maxDifference, std::abs(gpuRow[x].r - cpuRow[x].r), std::abs(gpuRow[x].g - cpuRow[x].g),
+                    std::abs(gpuRow[x].b - cpuRow[x].b), std::abs(gpuRow[x].a - cpuRow[x].a) });
+            }
+        }
+    }
+
+    for (auto image : images) {
+        if (image) {
+            image->DeleteThis();
+        }
+    }
+    return maxDifference;
+}
+
+/// Keeps the 3ds Max message loop running until done() returns true or the timeout elapses, so that the timers and window
+/// messages the ActiveShade synchronizer relies on are processed while a test waits on the UI thread
+/// \return true if done() returned true before the timeout
+template <class Done>
+bool pumpMessagesUntil(const DWORD timeout, Done done) {
+    const DWORD start = GetTickCount();
+    while (!done()) {
+        const DWORD elapsed = GetTickCount() - start;
+        if (elapsed >= timeout) {
+            return false;
+        }
+        MsgWaitForMultipleObjects(0, nullptr, FALSE, std::min<DWORD>(timeout - elapsed, 10), QS_ALLINPUT);
+        MSG msg;
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+    }
+    return true;
+}
+
+/// CPU time used so far by all threads of the 3ds Max process, in milliseconds
+ULONGLONG getProcessCpuTime() {
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+    ULARGE_INTEGER kernel = { kernelTime.dwLowDateTime, kernelTime.dwHighDateTime };
+    ULARGE_INTEGER user = { userTime.dwLowDateTime, userTime.dwHighDateTime };
+    return (kernel.QuadPart + user.QuadPart) / 10000; // 100ns units to ms
+}
+
+/// Runs an ActiveShade session on the current scene until it reaches the given pass limit, then measures the CPU time the
+/// 3ds Max process uses while the session idles, and how long the session takes to restart rendering after camera changes.
+/// The session is driven directly, without an ActiveShade window, and its bitmap is not displayed.
+/// \return CPU time used while idle as a fraction of one core, or a negative value if the session could not be run
+float measureActiveShadeIdle(std::ostream& output, const int passes) {
+    Interface11* ip = GetCOREInterface11();
+    FireRenderer* renderer = dynamic_cast<FireRenderer*>(ip->GetRenderer(RS_IReshade));
+    if (!renderer) {
+        output << "ActiveShade idle: skipped, the ActiveShade renderer is not Radeon ProRender" << std::endl;
+        return -1.f;
+    }
+    IFireRender* interactive = static_cast<IFireRender*>(renderer->GetIInteractiveRender());
+    ActiveShader* activeShader = interactive ? interactive->GetActiveShader() : nullptr;
+    if (!activeShader || activeShader->IsRunning()) {
+        output << "ActiveShade idle: skipped, ActiveShade is not available or already running" << std::endl;
+        return -1.f;
+    }
+
+    // render a fixed number of passes, after which the session has nothing to do until the scene changes
+    IParamBlock2* pblock = renderer->GetParamBlock(0);
+    const int previousLimitType = GetFromPb<int>(pblock, PARAM_RENDER_LIMIT);
+    const int previousPassLimit = GetFromPb<int>(pblock, PARAM_PASS_LIMIT);
+    SetInPb(pblock, PARAM_RENDER_LIMIT, int(Termination_Passes));
+    SetInPb(pblock, PARAM_PASS_LIMIT, passes);
+
+    BitmapInfo bi;
+    bi.SetType(BMM_FLOAT_RGBA_32);
+    bi.SetWidth(640);
+    bi.SetHeight(360);
+    bi.SetFlags(MAP_HAS_ALPHA);
+    bi.SetCustomFlag(0);
+    bi.SetAspect(1.f);
+    ::Bitmap* bmap = TheManager->Create(&bi);
+    FASSERT(bmap != NULL);
+    if (!bmap) {
+        SetInPb(pblock, PARAM_RENDER_LIMIT, previousLimitType);
+        SetInPb(pblock, PARAM_PASS_LIMIT, previousPassLimit);
+        return -1.f;
+    }
+
+    ViewExp& view = ip->GetActiveViewExp();
+    interactive->SetOwnerWnd(NULL);
+    interactive->SetIIRenderMgr(nullptr);
+    interactive->SetBitmap(bmap);
+    interactive->SetSceneINode(ip->GetRootNode());
+    interactive->SetUseViewINode(false);
+    interactive->SetViewExp(&view);
+    interactive->SetRegion(Box2());
+    interactive->SetDefaultLights(nullptr, 0);
+    interactive->SetProgressCallback(nullptr);
+    interactive->BeginSession();
+
+    auto converged = [activeShader, passes]() {
+        unsigned int passesDone = 0, restartsDone = 0;
+        activeShader->GetProgress(passesDone, restartsDone);
+        return passesDone >= static_cast<unsigned int>(passes);
+    };
+    const DWORD renderTimeout = 120000;
+    bool finished = pumpMessagesUntil(renderTimeout, converged);
+
+    // idle: the session has reached its pass limit and only waits for changes
+    const DWORD idleWindow = 5000;
+    const ULONGLONG idleCpuStart = getProcessCpuTime();
+    const DWORD idleStart = GetTickCount();
+    pumpMessagesUntil(idleWindow, []() { return false; });
+    const DWORD idleWallTime = std::max<DWORD>(GetTickCount() - idleStart, 1);
+    const ULONGLONG idleCpuTime = getProcessCpuTime() - idleCpuStart;
+    const float idleCores = float(idleCpuTime) / float(idleWallTime);
+
+    // camera changes: the view is moved back and forth, so that it ends where it started, and each change must restart the
+    // session; the latency is measured from the change to the render thread picking up the restart
+    INode* viewCamera = view.GetViewCamera();
+    auto moveView = [&](const float distance) {
+        if (viewCamera) {
+            Matrix3 tm = viewCamera->GetNodeTM(ip->GetTime());
+            tm.PreTranslate(Point3(distance, 0.f, 0.f));
+            viewCamera->SetNodeTM(ip->GetTime(), tm);
+        } else {
+            Matrix3 tm;
+            view.GetAffineTM(tm);
+            tm.Translate(Point3(distance, 0.f, 0.f));
+            view.SetAffineTM(tm);
+        }
+        ip->RedrawViews(ip->GetTime());
+    };
+
+    const int cameraChanges = 6;
+    int cameraMoves = 0, cameraRestarts = 0;
+    DWORD latencySum = 0, latencyMax = 0;
+    for (int change = 0; finished && change < cameraChanges; ++change) {
+        unsigned int passesBefore = 0, restartsBefore = 0;
+        activeShader->GetProgress(passesBefore, restartsBefore);
+
+        const DWORD changed = GetTickCount();
+        moveView((change % 2) ? -1.f : 1.f);
+        ++cameraMoves;
+        const bool restarted = pumpMessagesUntil(renderTimeout, [activeShader, restartsBefore]() {
+            unsigned int passesDone = 0, restartsDone = 0;
+            activeShader->GetProgress(passesDone, restartsDone);
+            return restartsDone > restartsBefore;
+        });
+        if (restarted) {
+            const DWORD latency = GetTickCount() - changed;
+            latencySum += latency;
+            latencyMax = std::max(latencyMax, latency);
+            ++cameraRestarts;
+        }
+        finished = pumpMessagesUntil(renderTimeout, converged);
+    }
+    if (cameraMoves % 2) {
+        moveView(-1.f); // the loop stopped early after an odd number of moves
+    }
+
+    interactive->EndSession();
+    interactive->SetBitmap(nullptr);
+    bmap->DeleteThis();
+    SetInPb(pblock, PARAM_RENDER_LIMIT, previousLimitType);
+    SetInPb(pblock, PARAM_PASS_LIMIT, previousPassLimit);
+
+    if (!finished) {
+        output << "ActiveShade idle: the session did not reach " << passes << " passes in " << renderTimeout / 1000 << " s" << std::endl;
+        return -1.f;
+    }
+
+    const ActiveShadeIdleStats& stats = activeShader->GetLastIdleStats();
+    output << "ActiveShade idle: process CPU " << idleCpuTime << " ms in " << idleWallTime << " ms (" << idleCores * 100.f
+        << "% of a core)" << std::endl;
+    output << "ActiveShade camera changes: " << cameraRestarts << "/" << cameraChanges << " restarted, change to restart latency avg "
+        << (cameraRestarts ? latencySum / cameraRestarts : 0) << " ms, max " << latencyMax << " ms" << std::endl;
+    output << "ActiveShade render thread: ran " << stats.wallTime << " ms, cpu " << stats.cpuTime << " ms, idle " << stats.idleTime
+        << " ms in " << stats.idleWaits << " waits, camera wake latency avg " << stats.cameraWakeLatencyAvg << " ms, max "
+        << stats.cameraWakeLatencyMax << " ms (" << stats.cameraWakes << " changes)" << std::endl;
+
+    return cameraRestarts == cameraChanges ? idleCores : -1.f;
+}
+
 void Tester::stopRender() {
     this->cancelled = true;
     GetCOREInterface11()->AbortRender();
@@ -119,6 +443,23 @@ void Tester::renderTests(std::string directory, std::string filter, const int pa
 
     if ((mkres == 0) || errno == EEXIST)
 	{
+		// self-checks, reported in the output folder next to the images
+		std::ofstream report(outputPath + "selfcheck.txt");
+		const float kernelDifference = checkShadowCatcherComposite();
+		report << "shadow catcher composite, CPU kernel vs graph: max difference " << kernelDifference << std::endl;
+		FASSERT(kernelDifference < 1e-4f);
+
+		const size_t meshSplitMismatches = benchmarkMeshSplit(report);
+		FASSERT(meshSplitMismatches == 0);
+
+		const size_t pixelMismatches = benchmarkPixelKernels(report);
+		FASSERT(pixelMismatches == 0);
+
+		const size_t depthMismatches = benchmarkDepthKernels(report);
+		FASSERT(depthMismatches == 0);
+
+		HashKeyCheck hashKeys;
+
 		Stack<std::string> dirs = getSuitableDirs(directory);
 		if (filter.size() > 0) { //non-empty filter -> we will use it to remove some directories
 			Stack<std::string> tmp = dirs;
@@ -136,7 +477,32 @@ void Tester::renderTests(std::string directory, std::string filter, const int pa
 
 			bool res = renderSingle(directory, i, passes, outputPath);
 			FASSERT(res);
+
+			if (res) {
+				hashKeys.addCurrentScene();
+			}
+
+			// scenes with a shadow catcher are rendered once more with each composite path, which must give the same image
+			if (i.find("shadowcatcher") != i.npos) {
+				const float difference = compareShadowCatcherPaths(directory, i, passes);
+				report << i << ", CPU vs RPR shadow catcher composite: max difference " << difference << std::endl;
+				FASSERT(difference >= 0.f && difference < 1e-3f);
+			}
 		}
+
+		const size_t hashCollisions = hashKeys.report(report);
+		FASSERT(hashCollisions == 0);
+
+		// the RPR context of the benchmark is set up like the one of the last test scene
+		Renderer* renderer = GetCOREInterface11()->GetCurrentRenderer(true);
+		if (renderer && dynamic_cast<FireRenderer*>(renderer)) {
+			const size_t transformsMissed = benchmarkTransformUpdates(report, renderer->GetParamBlock(0));
+			FASSERT(transformsMissed == 0);
+		}
+
+		// ActiveShade on the last test scene must not keep the CPU busy once it has reached its pass limit
+		const float activeShadeIdleCores = measureActiveShadeIdle(report, passes);
+		FASSERT(activeShadeIdleCores >= 0.f && activeShadeIdleCores < 0.25f);
 	}
 }
 
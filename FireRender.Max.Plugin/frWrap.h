@@ -376,6 +376,38 @@ namespace frw
 			return ret;
 		}
 
+		/// Calls visitor(owner, target) for every reference held by this object and by all objects reachable from it through
+		/// their references. Objects are visited depth first, each one once.
+		template <class Visitor>
+		void VisitReferences(Visitor visitor) const
+		{
+			std::set<Data*> visited;
+			std::vector<DataPtr> stack(1, m);
+			visited.insert(m.get());
+
+			while (!stack.empty())
+			{
+				Object owner(stack.back());
+				stack.pop_back();
+
+				for (const auto& ref : owner.m->references)
+				{
+					visitor(owner, Object(ref));
+
+					if (visited.insert(ref.get()).second)
+						stack.push_back(ref);
+				}
+			}
+		}
+
+		/// Replaces the reference to an object by a reference to another one, once the input of the RPR object that used
+		/// the former has been pointed at the latter
+		void ReplaceReference(const Object& from, const Object& to)
+		{
+			if (m->references.erase(from.m))
+				AddReference(to);
+		}
+
 	protected:
 		void RemoveAllReferences()
 		{
@@ -776,15 +808,8 @@ namespace frw
 #ifdef FRW_USE_MAX_TYPES
 		void SetTransform(const Matrix3& tm)
 		{
-			float m44[16] = {};
-			float* p = m44;
-			for (int x = 0; x < 4; ++x) 
-			{
-				for (int y = 0; y < 3; ++y) 
-					*p++ = tm.GetRow(x)[y];
-
-				*p++ = (x == 3) ? 1.f : 0.f;
-			}
+			float m44[16];
+			PackFrMatrix(tm, m44);
 			SetTransform(m44);
 		}
 #endif
@@ -879,15 +904,8 @@ namespace frw
 #ifdef FRW_USE_MAX_TYPES
 		void SetTransform(const Matrix3& tm)
 		{
-			float m44[16] = {};
-			float* p = m44;
-			for (int x = 0; x < 4; ++x)
-			{
-				for (int y = 0; y < 3; ++y)
-					*p++ = tm.GetRow(x)[y];
-
-				*p++ = (x == 3) ? 1.f : 0.f;
-			}
+			float m44[16];
+			PackFrMatrix(tm, m44);
 			SetTransform(m44);
 		}
 #endif
@@ -911,6 +929,9 @@ namespace frw
 		}
 
 		bool IsGrayScale();
+
+		/// Size of the pixel data held by the image, computed from its description and format
+		size_t GetSizeInBytes();
 	};
 
 	class PointLight : public Light
@@ -2179,7 +2200,16 @@ namespace frw
 		std::vector<float> GetPixelData()
 		{
 			std::vector<float> result;
+			GetPixelData(result);
 			
+			// Just to be sure, move it
+			return std::move(result);
+		}
+
+		/// Reads the pixels into a caller provided buffer. The buffer is only reallocated if it is smaller than the frame 
+		/// buffer, so a buffer reused for every pass is allocated once.
+		void GetPixelData(std::vector<float>& result)
+		{
 			size_t fbSize;
 			int res = rprFrameBufferGetInfo(Handle(), RPR_FRAMEBUFFER_DATA, 0, NULL, &fbSize);
 			FCHECK(res);
@@ -2188,9 +2218,6 @@ namespace frw
 			result.resize(int(fbSize / sizeof(float)));
 			res = rprFrameBufferGetInfo(Handle(), RPR_FRAMEBUFFER_DATA, result.size() * sizeof(float), result.data(), NULL);
 			FCHECK(res);
-			
-			// Just to be sure, move it
-			return std::move(result);
 		}
 	};
 
@@ -2640,6 +2667,7 @@ namespace frw
 		{
 			Node n = v.GetNode();
 			data().displacementShader = n;
+			AddReference(n);
 			auto res = rprShapeSetDisplacementMaterial(Handle(), n.Handle());
 			FCHECK(res);
 			res = rprShapeSetDisplacementScale(Handle(), minscale, maxscale);
@@ -2655,6 +2683,7 @@ namespace frw
 			FCHECK(res);
 			res = rprShapeSetSubdivisionFactor(Handle(), 0);
 			FCHECK(res);
+			RemoveReference(data().displacementShader);
 			data().displacementShader = nullptr;
 		}
 	}
@@ -2750,6 +2779,32 @@ namespace frw
 		return format.num_components == 1;
 	}
 
+	inline size_t Image::GetSizeInBytes()
+	{
+		rpr_image img = Handle();
+
+		if (!img)
+			return 0;
+
+		rpr_image_desc desc;
+		rpr_int status = rprImageGetInfo(img, RPR_IMAGE_DESC, sizeof(desc), &desc, nullptr);
+		FCHECK(status);
+
+		rpr_image_format format;
+		status = rprImageGetInfo(img, RPR_IMAGE_FORMAT, sizeof(format), &format, nullptr);
+		FCHECK(status);
+
+		size_t componentSize = 4;
+		switch (format.type)
+		{
+		case RPR_COMPONENT_TYPE_UINT8: componentSize = 1; break;
+		case RPR_COMPONENT_TYPE_FLOAT16: componentSize = 2; break;
+		}
+
+		const size_t depth = desc.image_depth > 0 ? desc.image_depth : 1;
+		return size_t(desc.image_width) * desc.image_height * depth * format.num_components * componentSize;
+	}
+
 	inline void EnvironmentLight::SetImage(Image img)
 	{
 		auto res = rprEnvironmentLightSetImage(Handle(), img.Handle());
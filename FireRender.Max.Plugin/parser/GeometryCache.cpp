@@ -0,0 +1,468 @@
+/**********************************************************************
+Copyright 2020 Advanced Micro Devices, Inc
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+    http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+********************************************************************/
+
+#include "GeometryCache.h"
+#include "MeshSplitter.h"
+#include "utils/HashValue.h"
+#include <MeshNormalSpec.h>
+#include <stdio.h>
+#include <algorithm>
+
+FIRERENDER_NAMESPACE_BEGIN;
+
+namespace
+{
+	const uint32_t GeometryCacheMagic = 0x47525052; // "RPRG"
+
+	// Increase whenever the file layout or the way buffers are flattened changes
+	const uint32_t GeometryCacheVersion = 3;
+
+	// Each buffer starts at a multiple of this, so mapped arrays are suitably aligned
+	const size_t GeometryCacheAlignment = 16;
+
+	const int GeometryCacheStreamCount = 13;
+
+	struct GeometryCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		GeometryCacheKey key;
+		int32_t numSubmtls;
+		int32_t numChannels;
+		uint64_t counts[GeometryCacheStreamCount]; // number of elements of each buffer, in the order of ForEachStream
+	};
+
+	inline size_t AlignCacheOffset(size_t offset)
+	{
+		return (offset + GeometryCacheAlignment - 1) & ~(GeometryCacheAlignment - 1);
+	}
+
+	/// Calls the functor for all buffers of the view, in the order they are stored in the file
+	template<class View, class Fn>
+	void ForEachStream(View& view, Fn& fn)
+	{
+		fn(view.verts);
+		fn(view.normals);
+		for (int i = 0; i < SplitMeshView::MaxChannels; ++i)
+			fn(view.texcoords[i]);
+
+		fn(view.vertIndices);
+		fn(view.normalIndices);
+		for (int i = 0; i < SplitMeshView::MaxChannels; ++i)
+			fn(view.texcoordIndices[i]);
+
+		fn(view.offsets);
+		fn(view.vertOffsets);
+		fn(view.normalOffsets);
+		for (int i = 0; i < SplitMeshView::MaxChannels; ++i)
+			fn(view.texcoordOffsets[i]);
+	}
+
+	struct StreamCounter
+	{
+		uint64_t* counts;
+		int index;
+
+		template<class T>
+		void operator()(const ArrayView<T>& stream)
+		{
+			counts[index++] = stream.size();
+		}
+	};
+
+	struct StreamWriter
+	{
+		FILE* file;
+		size_t offset;
+		bool ok;
+
+		template<class T>
+		void operator()(const ArrayView<T>& stream)
+		{
+			static const char padding[GeometryCacheAlignment] = {};
+
+			const size_t aligned = AlignCacheOffset(offset);
+			if (aligned != offset)
+				ok &= fwrite(padding, 1, aligned - offset, file) == aligned - offset;
+
+			const size_t bytes = stream.size() * sizeof(T);
+			if (bytes > 0)
+				ok &= fwrite(stream.data(), 1, bytes, file) == bytes;
+
+			offset = aligned + bytes;
+		}
+	};
+
+	struct StreamReader
+	{
+		const char* data;
+		size_t size;
+		const uint64_t* counts;
+		int index;
+		size_t offset;
+		bool ok;
+
+		template<class T>
+		void operator()(ArrayView<T>& stream)
+		{
+			const size_t count = size_t(counts[index++]);
+			offset = AlignCacheOffset(offset);
+
+			if (count > (size - std::min(offset, size)) / sizeof(T))
+			{
+				ok = false;
+				stream = ArrayView<T>();
+				return;
+			}
+
+			stream = ArrayView<T>(reinterpret_cast<const T*>(data + offset), count);
+			offset += count * sizeof(T);
+		}
+	};
+
+	/// An offsets stream is either empty (if allowed) or holds numSubmtls + 1 non-decreasing entries from 0 to total
+	bool IsValidOffsets(const ArrayView<size_t>& offsets, int numSubmtls, size_t total, bool allowEmpty)
+	{
+		if (offsets.empty())
+			return allowEmpty;
+
+		if (offsets.size() != size_t(numSubmtls) + 1 || offsets[0] != 0 || offsets[numSubmtls] != total)
+			return false;
+
+		for (int i = 0; i < numSubmtls; ++i)
+		{
+			if (offsets[i + 1] < offsets[i])
+				return false;
+		}
+
+		return true;
+	}
+
+	/// Every index of a material has to point into the attributes of that material (see SplitMeshView::GetAttributes)
+	bool AreValidIndices(const ArrayView<rpr_int>& indices, const ArrayView<size_t>& offsets, size_t attributeCount,
+		const ArrayView<size_t>& attrOffsets, int numSubmtls)
+	{
+		for (int i = 0; i < numSubmtls; ++i)
+		{
+			const size_t count = attrOffsets.empty() ? attributeCount : attrOffsets[i + 1] - attrOffsets[i];
+
+			for (size_t j = offsets[i]; j < offsets[i + 1]; ++j)
+			{
+				if (indices[j] < 0 || size_t(indices[j]) >= count)
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	/// Checks the consistency of all buffers of a mapped file, so that a stale or corrupt file can't make shape creation
+	/// read out of bounds
+	bool IsValidCacheView(const SplitMeshView& view)
+	{
+		const size_t numIndices = view.vertIndices.size();
+		const int numSubmtls = view.numSubmtls;
+
+		if (numSubmtls < 1 || view.numChannels < 0 || view.numChannels > SplitMeshView::MaxChannels)
+			return false;
+
+		if (numIndices % 3 != 0 || view.normalIndices.size() != numIndices ||
+			!IsValidOffsets(view.offsets, numSubmtls, numIndices, false) ||
+			!IsValidOffsets(view.vertOffsets, numSubmtls, view.verts.size(), true) ||
+			!IsValidOffsets(view.normalOffsets, numSubmtls, view.normals.size(), true))
+			return false;
+
+		for (int i = 0; i < numSubmtls; ++i)
+		{
+			if ((view.offsets[i + 1] - view.offsets[i]) % 3 != 0)
+				return false;
+		}
+
+		if (!AreValidIndices(view.vertIndices, view.offsets, view.verts.size(), view.vertOffsets, numSubmtls) ||
+			!AreValidIndices(view.normalIndices, view.offsets, view.normals.size(), view.normalOffsets, numSubmtls))
+			return false;
+
+		for (int j = 0; j < SplitMeshView::MaxChannels; ++j)
+		{
+			// layers without texture coordinates are skipped by shape creation, so they must not carry anything else
+			if (j >= view.numChannels || view.texcoords[j].empty())
+			{
+				if (!view.texcoords[j].empty() || !view.texcoordIndices[j].empty() || !view.texcoordOffsets[j].empty())
+					return false;
+				continue;
+			}
+
+			if (view.texcoordIndices[j].size() != numIndices ||
+				!IsValidOffsets(view.texcoordOffsets[j], numSubmtls, view.texcoords[j].size(), true) ||
+				!AreValidIndices(view.texcoordIndices[j], view.offsets, view.texcoords[j].size(), view.texcoordOffsets[j],
+					numSubmtls))
+				return false;
+		}
+
+		return true;
+	}
+
+	std::wstring GetGeometryCacheFileName(const std::wstring& folder, const GeometryCacheKey& key)
+	{
+		wchar_t name[64] = {};
+		swprintf(name, 64, L"%016llX_%08X.rprmesh", (unsigned long long)key.hash, key.numFaces);
+		return folder + name;
+	}
+}
+
+GeometryCacheKey ComputeGeometryCacheKey(Mesh& mesh, MeshNormalSpec& normals, int numSubmtls, float masterScale, bool flipFaces,
+	bool compact)
+{
+	GeometryCacheKey key;
+	key.numVerts = mesh.getNumVerts();
+	key.numFaces = mesh.getNumFaces();
+	key.numNormals = normals.GetNumNormals();
+
+	HashValue hash;
+	hash << GeometryCacheVersion << numSubmtls << masterScale << flipFaces << compact;
+#ifdef SWITCH_AXES
+	hash << true;
+#endif
+
+	hash.Append(mesh.verts, key.numVerts * sizeof(Point3));
+
+	// Faces hold the vertex indices and the material ID. They also hold edge visibility, which doesn't affect the result but
+	// isn't worth filtering out.
+	hash.Append(mesh.faces, key.numFaces * sizeof(Face));
+
+	hash.Append(normals.GetNormalArray(), key.numNormals * sizeof(Point3));
+
+	// Normal faces are not plain data, so their indices are gathered into a small buffer first
+	int normalIndices[3 * 256];
+	size_t count = 0;
+	for (uint32_t i = 0; i < key.numFaces; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+			normalIndices[count++] = normals.GetNormalIndex(i, j);
+
+		if (count == _countof(normalIndices))
+		{
+			hash.Append(normalIndices, sizeof(normalIndices));
+			count = 0;
+		}
+	}
+	hash.Append(normalIndices, count * sizeof(int));
+
+	const int numChannels = GetSplitMeshChannelCount(mesh);
+	hash << numChannels;
+	for (int i = 0; i < numChannels; ++i)
+	{
+		if (!IsSplitMeshChannelUsable(mesh, i))
+		{
+			hash << false;
+			continue;
+		}
+
+		const MeshMap& mapChannel = mesh.maps[i + 1];
+		hash << true << mapChannel.vnum;
+		hash.Append(mapChannel.tv, mapChannel.vnum * sizeof(UVVert));
+		hash.Append(mapChannel.tf, mapChannel.fnum * sizeof(TVFace));
+	}
+
+	key.hash = hash;
+	return key;
+}
+
+std::wstring GetGeometryCacheFolder()
+{
+	std::wstring folder = GetDataStoreFolder() + L"GeometryCache\\";
+
+	if (!FolderExists(folder.c_str()) && !CreateDirectory(folder.c_str(), NULL))
+	{
+		debugPrint(L"Failed to create geometry cache folder " + folder);
+		return std::wstring();
+	}
+
+	return folder;
+}
+
+void TrimGeometryCache(const std::wstring& folder, uint64_t maxBytes)
+{
+	struct CacheFile
+	{
+		std::wstring name;
+		uint64_t size;
+		uint64_t time;
+	};
+
+	std::vector<CacheFile> files;
+	uint64_t totalBytes = 0;
+
+	WIN32_FIND_DATA data;
+	HANDLE find = FindFirstFile((folder + L"*.rprmesh").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		CacheFile file;
+		file.name = folder + data.cFileName;
+		file.size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+		file.time = (uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+		totalBytes += file.size;
+		files.push_back(file);
+	} while (FindNextFile(find, &data));
+
+	FindClose(find);
+
+	if (totalBytes <= maxBytes)
+		return;
+
+	std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.time < b.time; });
+
+	// files still mapped by a render are opened with FILE_SHARE_DELETE, so they are removed once closed
+	size_t deleted = 0;
+	for (size_t i = 0; i < files.size() && totalBytes > maxBytes; ++i)
+	{
+		if (DeleteFile(files[i].name.c_str()))
+		{
+			totalBytes -= files[i].size;
+			deleted++;
+		}
+	}
+
+	wchar_t buf[256 + 1];
+	wsprintf(buf, L"Geometry cache: deleted %d least recently used files, %d MB left", int(deleted), int(totalBytes >> 20));
+	debugPrint(buf);
+}
+
+bool GeometryCacheFile::Open(const std::wstring& folder, const GeometryCacheKey& key, SplitMeshView& view)
+{
+	Close();
+
+	const std::wstring fileName = GetGeometryCacheFileName(folder, key);
+
+	// FILE_WRITE_ATTRIBUTES lets a hit refresh the write time, which TrimGeometryCache evicts by
+	mFile = CreateFile(fileName.c_str(), GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize) || size_t(fileSize.QuadPart) < sizeof(GeometryCacheHeader))
+	{
+		Close();
+		return false;
+	}
+
+	mMapping = CreateFileMapping(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mMapping)
+		mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+
+	if (!mData)
+	{
+		Close();
+		return false;
+	}
+	mSize = size_t(fileSize.QuadPart);
+
+	const GeometryCacheHeader& header = *reinterpret_cast<const GeometryCacheHeader*>(mData);
+
+	bool ok = header.magic == GeometryCacheMagic &&
+		header.version == GeometryCacheVersion &&
+		header.key == key &&
+		header.numSubmtls > 0 &&
+		header.numChannels >= 0 && header.numChannels <= SplitMeshView::MaxChannels;
+
+	if (ok)
+	{
+		view = SplitMeshView();
+		view.numSubmtls = header.numSubmtls;
+		view.numChannels = header.numChannels;
+
+		StreamReader reader = { mData, mSize, header.counts, 0, sizeof(GeometryCacheHeader), true };
+		ForEachStream(view, reader);
+
+		ok = reader.ok && IsValidCacheView(view);
+	}
+
+	if (!ok)
+	{
+		debugPrint(L"Ignoring invalid geometry cache file " + fileName);
+		view = SplitMeshView();
+		Close();
+		return false;
+	}
+
+	// mark the file as recently used; the access time is not reliable as NTFS may not maintain it
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	SetFileTime(mFile, NULL, NULL, &now);
+
+	return true;
+}
+
+void GeometryCacheFile::Close()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+
+	if (mMapping)
+		CloseHandle(mMapping);
+
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = NULL;
+	mData = nullptr;
+	mSize = 0;
+}
+
+bool StoreGeometryCacheFile(const std::wstring& folder, const GeometryCacheKey& key, const SplitMeshView& mesh)
+{
+	const std::wstring fileName = GetGeometryCacheFileName(folder, key);
+
+	wchar_t suffix[64] = {};
+	swprintf(suffix, 64, L".%u.%u.tmp", GetCurrentProcessId(), GetCurrentThreadId());
+	const std::wstring tempName = fileName + suffix;
+
+	FILE* file = nullptr;
+	if (_wfopen_s(&file, tempName.c_str(), L"wb") != 0 || !file)
+		return false;
+
+	GeometryCacheHeader header = {};
+	header.magic = GeometryCacheMagic;
+	header.version = GeometryCacheVersion;
+	header.key = key;
+	header.numSubmtls = mesh.numSubmtls;
+	header.numChannels = mesh.numChannels;
+
+	StreamCounter counter = { header.counts, 0 };
+	ForEachStream(mesh, counter);
+
+	StreamWriter writer = { file, sizeof(header), true };
+	writer.ok = fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+	ForEachStream(mesh, writer);
+
+	const bool ok = fclose(file) == 0 && writer.ok;
+
+	// Another thread or process may have stored the same mesh in the meantime. Its file is left alone, as it might be mapped.
+	if (!ok || !MoveFileEx(tempName.c_str(), fileName.c_str(), 0))
+	{
+		DeleteFile(tempName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+FIRERENDER_NAMESPACE_END;
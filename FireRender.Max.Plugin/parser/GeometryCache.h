@@ -0,0 +1,94 @@
+/**********************************************************************
+Copyright 2020 Advanced Micro Devices, Inc
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+    http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+********************************************************************/
+
+#pragma once
+
+#include "Common.h"
+#include <string>
+#include <stdint.h>
+
+class MeshNormalSpec;
+
+FIRERENDER_NAMESPACE_BEGIN;
+
+struct SplitMeshView;
+
+/// Identifies the content of a source mesh in the geometry cache. The element counts are stored in the cache file together
+/// with the hash and compared on load, so that a hash collision between differently sized meshes is detected.
+struct GeometryCacheKey
+{
+	uint64_t hash = 0;
+	uint32_t numVerts = 0;
+	uint32_t numFaces = 0;
+	uint32_t numNormals = 0;
+
+	inline bool operator==(const GeometryCacheKey& other) const
+	{
+		return hash == other.hash && numVerts == other.numVerts && numFaces == other.numFaces && numNormals == other.numNormals;
+	}
+};
+
+/// Hashes vertices, faces (including their material IDs), normals and texture coordinates of the mesh, together with all
+/// options which change the flattened buffers. Only reads plain memory, so it may run on worker threads.
+GeometryCacheKey ComputeGeometryCacheKey(Mesh& mesh, MeshNormalSpec& normals, int numSubmtls, float masterScale, bool flipFaces,
+	bool compact);
+
+/// Returns the folder of the geometry cache in the plugin data store, creating it if needed. Returns an empty string if the
+/// folder can't be created.
+std::wstring GetGeometryCacheFolder();
+
+/// Default size limit of the geometry cache folder, used when the GeometryCacheSize setting is missing
+const uint64_t DefaultGeometryCacheBytes = uint64_t(4096) << 20;
+
+/// Deletes the least recently used files of the geometry cache until the folder holds at most maxBytes. Files are ordered by
+/// their last write time, which GeometryCacheFile::Open refreshes on every hit.
+void TrimGeometryCache(const std::wstring& folder, uint64_t maxBytes);
+
+/// Read-only memory mapping of a geometry cache file. Views opened from it point directly into the mapping and stay valid
+/// until Close() is called.
+class GeometryCacheFile
+{
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = NULL;
+	const char* mData = nullptr;
+	size_t mSize = 0;
+
+	GeometryCacheFile(const GeometryCacheFile&) = delete;
+	GeometryCacheFile& operator=(const GeometryCacheFile&) = delete;
+
+public:
+	GeometryCacheFile() = default;
+
+	~GeometryCacheFile()
+	{
+		Close();
+	}
+
+	/// Maps the cache file of the key and points the view at the buffers it holds. Returns false if there is no such file,
+	/// if it doesn't match the key or the current file format, or if its buffers are inconsistent (offsets out of order,
+	/// index streams of different lengths or indices out of range).
+	bool Open(const std::wstring& folder, const GeometryCacheKey& key, SplitMeshView& view);
+
+	void Close();
+
+	inline bool IsOpen() const
+	{
+		return mData != nullptr;
+	}
+};
+
+/// Writes the buffers of the split mesh to the cache file of the key. The file is written under a temporary name and then
+/// renamed, so that other threads or processes never map a partially written file. Returns false on I/O errors.
+bool StoreGeometryCacheFile(const std::wstring& folder, const GeometryCacheKey& key, const SplitMeshView& mesh);
+
+FIRERENDER_NAMESPACE_END;
@@ -55,6 +55,9 @@ limitations under the License.
 #include <shaders.h>
 #include <icurvctl.h>
 #include <max.h>
+#include <emmintrin.h>
+#include <cmath>
+#include <memory>
 
 FIRERENDER_NAMESPACE_BEGIN
 
@@ -71,6 +74,119 @@ namespace
 	{
 		unsigned char r, g, b;
 	};
+
+	// Number of rows fetched from a bitmap before they are packed in parallel, bounds the size of the staging buffer
+	const int BitmapRowsPerBlock = 64;
+
+	/// Packs a row of bitmap pixels into RGB floats. Each pixel is written with a single 4-float store which spills into the
+	/// next pixel, overwritten right after; the last pixel is written separately so that the row is never overrun.
+	void PackBitmapRow(const BMM_Color_fl* src, RgbFloat32* dest, int count)
+	{
+		float* out = &dest->r;
+		for (int x = 0; x < count - 1; ++x)
+			_mm_storeu_ps(out + 3 * x, _mm_loadu_ps(&src[x].r));
+
+		if (count > 0)
+		{
+			dest[count - 1].r = src[count - 1].r;
+			dest[count - 1].g = src[count - 1].g;
+			dest[count - 1].b = src[count - 1].b;
+		}
+	}
+
+	/// NaN maps to 255, the same as in the SSE body, where _mm_min_ps returns its second operand (255) for NaN. std::isnan
+	/// tests the bits, so it isn't folded away by /fp:fast like a v != v comparison could be.
+	inline unsigned char QuantizeComponent(float v)
+	{
+		if (std::isnan(v))
+			return 255;
+		return unsigned char(std::min(std::max(v, 0.f), 1.f) * 255.f);
+	}
+
+	/// Packs a row of bitmap pixels into RGB bytes, 4 pixels at a time. Components are clamped and truncated, the same as the
+	/// scalar conversion. The alpha bytes are squeezed out of the packed pixels with masks and byte shifts, and the resulting
+	/// 12 bytes are written with a 16-byte store spilling into the next pixels, which are written right after.
+	void PackBitmapRow(const BMM_Color_fl* src, RgbByte* dest, int count)
+	{
+		const __m128 scale = _mm_set1_ps(255.f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128i mask = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+		unsigned char* out = &dest->r;
+
+		int x = 0;
+		for (; x + 5 < count; x += 4)
+		{
+			__m128i c[4];
+			for (int i = 0; i < 4; ++i)
+			{
+				__m128 v = _mm_mul_ps(_mm_loadu_ps(&src[x + i].r), scale);
+				c[i] = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(v, scale), zero));
+			}
+
+			// bytes r0 g0 b0 a0 r1 g1 b1 a1 ... r3 g3 b3 a3
+			const __m128i rgba = _mm_packus_epi16(_mm_packs_epi32(c[0], c[1]), _mm_packs_epi32(c[2], c[3]));
+
+			__m128i rgb = _mm_and_si128(rgba, mask);
+			rgb = _mm_or_si128(rgb, _mm_srli_si128(_mm_and_si128(rgba, _mm_slli_si128(mask, 4)), 1));
+			rgb = _mm_or_si128(rgb, _mm_srli_si128(_mm_and_si128(rgba, _mm_slli_si128(mask, 8)), 2));
+			rgb = _mm_or_si128(rgb, _mm_srli_si128(_mm_and_si128(rgba, _mm_slli_si128(mask, 12)), 3));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3 * x), rgb);
+		}
+
+		for (; x < count; ++x)
+		{
+			dest[x].r = QuantizeComponent(src[x].r);
+			dest[x].g = QuantizeComponent(src[x].g);
+			dest[x].b = QuantizeComponent(src[x].b);
+		}
+	}
+
+	/// Converts the whole bitmap into tightly packed RGB pixels. The 3ds Max bitmap API is not thread safe, so rows are
+	/// fetched in blocks on the calling thread, and each block is then packed on all cores. Float bitmaps read without gamma
+	/// correction are packed straight from their storage, all rows in parallel.
+	template<class T>
+	void ConvertBitmap(Bitmap* bitmap, bool linear, T* dest)
+	{
+		const int width = bitmap->Width();
+		const int height = bitmap->Height();
+
+		if (!linear)
+		{
+			int type = 0;
+			const void* storage = bitmap->GetStoragePtr(&type);
+
+			if (storage && type == BMM_FLOAT_RGBA_32)
+			{
+				const BMM_Color_fl* pixels = static_cast<const BMM_Color_fl*>(storage);
+
+				#pragma omp parallel for
+				for (int y = 0; y < height; ++y)
+					PackBitmapRow(pixels + size_t(y) * width, dest + size_t(y) * width, width);
+
+				return;
+			}
+		}
+
+		std::vector<BMM_Color_fl> block(size_t(width) * std::min(height, BitmapRowsPerBlock));
+
+		for (int y0 = 0; y0 < height; y0 += BitmapRowsPerBlock)
+		{
+			const int rows = std::min(BitmapRowsPerBlock, height - y0);
+
+			for (int i = 0; i < rows; ++i)
+			{
+				if (linear)
+					bitmap->GetLinearPixels(0, y0 + i, width, &block[size_t(i) * width]);
+				else
+					bitmap->GetPixels(0, y0 + i, width, &block[size_t(i) * width]);
+			}
+
+			#pragma omp parallel for if (rows * width > 4096)
+			for (int i = 0; i < rows; ++i)
+				PackBitmapRow(&block[size_t(i) * width], dest + size_t(y0 + i) * width, width);
+		}
+	}
 }
 
 frw::Image MaterialParser::createImageFromMap(Texmap* input, const int flags, bool force)
@@ -185,8 +301,7 @@ frw::Image MaterialParser::createImage(Bitmap* bitmap, const HashValue& kkey, co
 	if (!bitmap)
 		return frw::Image();
 
-	HashValue key = kkey;
-	key << getBitmapHash(bitmap) << flags;
+	HashValue key = getImageKey(bitmap, kkey, flags);
 
 	frw::Image image = mScope.GetImage(key);
 
@@ -221,29 +336,11 @@ frw::Image MaterialParser::createImage(Bitmap* bitmap, const HashValue& kkey, co
 
 			if (isHDR)
 			{
-				size_t bufsize = imgDesc.image_width * imgDesc.image_height;
-				std::vector<BMM_Color_fl> buffer(imgDesc.image_width);
-				std::vector<RgbFloat32> buffer32(bufsize);
-
-				for (int y = 0; y < imgDesc.image_height; y++)
-				{
-					if (flags & MAP_FLAG_NOGAMMA)
-						bitmap->GetPixels(0, y, imgDesc.image_width, &buffer[0]);
-					else
-						bitmap->GetLinearPixels(0, y, imgDesc.image_width, &buffer[0]);
-
-					for (int x = 0; x < imgDesc.image_width; x++)
-					{
-						const BMM_Color_fl& src = buffer[x];
-						RgbFloat32& dest = buffer32[y * imgDesc.image_width + x];
-
-						dest.r = src.r;
-						dest.g = src.g;
-						dest.b = src.b;
-					}
-				}
+				// the buffer is filled entirely, so its elements are left uninitialized
+				std::unique_ptr<RgbFloat32[]> buffer32(new RgbFloat32[size_t(w) * h]);
+				ConvertBitmap(bitmap, !(flags & MAP_FLAG_NOGAMMA), buffer32.get());
 
-				image = frw::Image(mScope, { 3, RPR_COMPONENT_TYPE_FLOAT32 }, imgDesc, &buffer32[0]);
+				image = frw::Image(mScope, { 3, RPR_COMPONENT_TYPE_FLOAT32 }, imgDesc, buffer32.get());
 				mScope.SetImage(key, image);
 			}
 			else
@@ -262,28 +359,10 @@ frw::Image MaterialParser::createImage(Bitmap* bitmap, const HashValue& kkey, co
 					}
 				}
 
-				std::vector<BMM_Color_fl> buffer(imgDesc.image_width);
-				std::vector<RgbByte> buffer8(imgDesc.image_width * imgDesc.image_height);
-
-				for (int y = 0; y < imgDesc.image_height; y++)
-				{
-					if (flags & MAP_FLAG_NOGAMMA)
-						bitmap->GetPixels(0, y, imgDesc.image_width, &buffer[0]);
-					else
-						bitmap->GetLinearPixels(0, y, imgDesc.image_width, &buffer[0]);
-
-					for (int x = 0; x < imgDesc.image_width; x++)
-					{
-						const BMM_Color_fl& src = buffer[x];
-						RgbByte& dest = buffer8[y * imgDesc.image_width + x];
-
-						dest.r = unsigned char(src.r * 255.f);
-						dest.g = unsigned char(src.g * 255.f);
-						dest.b = unsigned char(src.b * 255.f);
-					}
-				}
+				std::unique_ptr<RgbByte[]> buffer8(new RgbByte[size_t(w) * h]);
+				ConvertBitmap(bitmap, !(flags & MAP_FLAG_NOGAMMA), buffer8.get());
 
-				image = frw::Image(mScope, { 3, RPR_COMPONENT_TYPE_UINT8 }, imgDesc, &buffer8[0]);
+				image = frw::Image(mScope, { 3, RPR_COMPONENT_TYPE_UINT8 }, imgDesc, buffer8.get());
 				mScope.SetImage(key, image);
 			}
 		}
@@ -305,6 +384,160 @@ frw::Image MaterialParser::createImage(Bitmap* bitmap, const HashValue& kkey, co
 	return image;
 }
 
+HashValue MaterialParser::getImageKey(Bitmap* bitmap, const HashValue& key, const int flags)
+{
+	HashValue imageKey = key;
+	imageKey << getBitmapHash(bitmap) << flags;
+	return imageKey;
+}
+
+frw::Image MaterialParser::createDeferredImage(BitmapTex* map, Bitmap* bitmap, TimeValue t, const HashValue& key, const int flags)
+{
+	if (!bitmap)
+		return frw::Image();
+
+	const HashValue imageKey = getImageKey(bitmap, key, flags);
+
+	if (frw::Image image = mScope.GetImage(imageKey))
+		return image;
+
+	DeferredImage& deferred = mDeferredImages[imageKey];
+
+	if (!deferred.proxy)
+	{
+		deferred.texmap = Animatable::GetHandleByAnim(map);
+		deferred.key = key;
+		deferred.flags = flags;
+		deferred.t = t;
+		deferred.width = bitmap->Width();
+		deferred.height = bitmap->Height();
+
+		// the pixel in the middle of the bitmap stands in for it
+		BMM_Color_fl pixel;
+		if (flags & MAP_FLAG_NOGAMMA)
+			bitmap->GetPixels(deferred.width / 2, deferred.height / 2, 1, &pixel);
+		else
+			bitmap->GetLinearPixels(deferred.width / 2, deferred.height / 2, 1, &pixel);
+
+		RgbFloat32 color = { pixel.r, pixel.g, pixel.b };
+		rpr_image_desc imgDesc = { 1, 1 };
+		deferred.proxy = frw::Image(mScope, { 3, RPR_COMPONENT_TYPE_FLOAT32 }, imgDesc, &color);
+	}
+
+	return deferred.proxy;
+}
+
+DeferredImageLoad MaterialParser::LoadDeferredImages(frw::Scene scene, DWORD timeBudget)
+{
+	DeferredImageLoad result;
+
+	// forget the proxies which are no longer used by any image node
+	for (auto it = mDeferredImages.begin(); it != mDeferredImages.end(); )
+	{
+		if (it->second.proxy.use_count() == 1)
+			it = mDeferredImages.erase(it);
+		else
+			++it;
+	}
+
+	if (mDeferredImages.empty() || !scene)
+		return result;
+
+	const DWORD start = GetTickCount();
+
+	std::unordered_map<void*, size_t> proxies;
+	for (const auto& it : mDeferredImages)
+		proxies[it.second.proxy.Handle()] = it.first;
+
+	// image nodes of the material graphs attached to the scene which use a proxy
+	std::unordered_map<size_t, std::vector<frw::Object>> users;
+	scene.VisitReferences([&](const frw::Object& owner, const frw::Object& target)
+	{
+		auto it = proxies.find(target.Handle());
+		if (it != proxies.end())
+			users[it->second].push_back(owner);
+	});
+
+	struct Pending
+	{
+		size_t key;
+		size_t users;
+		size_t pixels;
+	};
+
+	std::vector<Pending> pending;
+	for (const auto& it : users)
+	{
+		const DeferredImage& deferred = mDeferredImages[it.first];
+		pending.push_back({ it.first, it.second.size(), size_t(deferred.width) * deferred.height });
+	}
+
+	std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b)
+	{
+		if (a.users != b.users)
+			return a.users > b.users;
+		return a.pixels < b.pixels;
+	});
+
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		if (i > 0 && timeBudget > 0 && GetTickCount() - start >= timeBudget)
+		{
+			result.waiting = pending.size() - i;
+			break;
+		}
+
+		DeferredImage& deferred = mDeferredImages[pending[i].key];
+
+		frw::Image image;
+		Texmap* texmap = dynamic_cast<Texmap*>(Animatable::GetAnimByHandle(deferred.texmap));
+		if (texmap)
+		{
+			if (auto map = dynamic_cast<BitmapTex*>(texmap->GetInterface(BITMAPTEX_INTERFACE)))
+				image = createImage(map->GetBitmap(deferred.t), deferred.key, deferred.flags, map->GetMapName());
+		}
+
+		if (!image)
+			continue;
+
+		for (auto& node : users[pending[i].key])
+		{
+			rpr_int res = rprMaterialNodeSetInputImageDataByKey(node.Handle(), RPR_MATERIAL_INPUT_DATA, image.Handle());
+			FCHECK(res);
+			node.ReplaceReference(deferred.proxy, image);
+		}
+
+		deferred.loaded = true;
+		result.loaded++;
+	}
+
+	for (const auto& it : mDeferredImages)
+	{
+		if (!it.second.loaded && !users.count(it.first))
+			result.skipped++;
+	}
+
+	mDeferredImageStats.loaded += result.loaded;
+	mDeferredImageStats.waiting = result.waiting;
+	mDeferredImageStats.skipped = result.skipped;
+
+	return result;
+}
+
+void MaterialParser::ReportDeferredImages()
+{
+	const DeferredImageLoad& stats = mDeferredImageStats;
+	if (stats.loaded > 0 || stats.waiting > 0)
+	{
+		wchar_t buf[256 + 1];
+		wsprintf(buf, L"MaterialParser: %d deferred textures loaded, %d waiting, %d skipped (not used by attached shapes)",
+			int(stats.loaded), int(stats.waiting), int(stats.skipped));
+		debugPrint(buf);
+	}
+
+	mDeferredImageStats = DeferredImageLoad();
+}
+
 HashValue MaterialParser::getBitmapHash(Bitmap *bm)
 {
 	HashValue hash;
@@ -320,112 +553,145 @@ HashValue MaterialParser::getBitmapHash(Bitmap *bm)
 	return hash;
 }
 
-HashValue MaterialParser::getMaterialHash(MtlBase *mat, bool bReloadMaterial /*= true*/)
+const HashValue* MaterialHashMemo::Find(Animatable* anim, TimeValue t, DWORD syncTimestamp, bool bReloadMaterial,
+	bool& usesTimestamp) const
 {
-	std::map<Animatable*, HashValue> hash_visited;
+	auto it = mNodes.find(anim);
+	if (it == mNodes.end())
+		return nullptr;
 
-	return GetHashValue(mat, mT, hash_visited, syncTimestamp, bReloadMaterial);
+	const Node& node = it->second;
+	const Entry& entry = node.entries[bReloadMaterial ? 1 : 0];
+
+	if (!entry.valid || entry.t != t || (entry.usesTimestamp && entry.syncTimestamp != syncTimestamp))
+		return nullptr;
+
+	if (node.handle != Animatable::GetHandleByAnim(anim))
+		return nullptr;
+
+	usesTimestamp = entry.usesTimestamp;
+	return &entry.hash;
 }
 
-HashValue MaterialParser::GetHashValue(Animatable* mat, TimeValue mT, std::map<Animatable*, HashValue> &hash_visited, DWORD syncTimestamp, bool bReloadMaterial /*= true*/)
+void MaterialHashMemo::Store(Animatable* anim, TimeValue t, DWORD syncTimestamp, bool bReloadMaterial, bool usesTimestamp,
+	const HashValue& hash, std::vector<Animatable*>&& children)
 {
-	HashValue hash;
+	Node& node = mNodes[anim];
 
-	if (!mat)
-		return hash;
+	const AnimHandle handle = Animatable::GetHandleByAnim(anim);
+	if (node.handle != handle)
+	{
+		// a different animatable used to live at this address
+		node.entries[0] = Entry();
+		node.entries[1] = Entry();
+		node.handle = handle;
+	}
 
-	std::map<Animatable*, HashValue>::iterator hh = hash_visited.find(mat);
-	if (hh != hash_visited.end())
-		return hh->second;
+	Entry& entry = node.entries[bReloadMaterial ? 1 : 0];
+	entry.valid = true;
+	entry.usesTimestamp = usesTimestamp;
+	entry.t = t;
+	entry.syncTimestamp = syncTimestamp;
+	entry.hash = hash;
 
-	MSTR className;
-	mat->GetClassName(className);
+	node.children = std::move(children);
+	for (Animatable* child : node.children)
+		mNodes[child].parents.insert(anim);
+}
 
-	int npb = mat->NumParamBlocks();
-	hash << mat << npb;
+void MaterialHashMemo::Invalidate(Animatable* anim)
+{
+	if (!mNodes.count(anim))
+		return;
 
-	// some materials has no param block(Tiles)
-	// so we mix current time to it to always invalidate
-	// used common syncTimestamp so that for one Synchronize call 
-	// hash would be still the same
-	if (!npb)
-		hash << syncTimestamp;
+	// Collect the animatables below the invalidated one...
+	std::unordered_set<Animatable*> dropped;
+	std::vector<Animatable*> pending(1, anim);
+	while (!pending.empty())
+	{
+		Animatable* current = pending.back();
+		pending.pop_back();
 
-	// bReloadMaterial must modify hash it shouldn'mT depend on syncTimestamp
-	if (bReloadMaterial)
-		hash << syncTimestamp;
+		auto it = mNodes.find(current);
+		if (it == mNodes.end() || !dropped.insert(current).second)
+			continue;
 
-	for (int j = 0; j < npb; j++)
+		pending.insert(pending.end(), it->second.children.begin(), it->second.children.end());
+	}
+
+	// ...and the ones hashed from any of them
+	pending.assign(dropped.begin(), dropped.end());
+	while (!pending.empty())
 	{
-		if (auto pb = mat->GetParamBlock(j))
+		Animatable* current = pending.back();
+		pending.pop_back();
+
+		for (Animatable* parent : mNodes[current].parents)
 		{
-			auto pbd = pb->GetDesc();
-			hash << pb << pbd->count;
+			if (dropped.insert(parent).second)
+				pending.push_back(parent);
+		}
+	}
 
-			for (USHORT i = 0; i < pbd->count; i++)
-			{
-				ParamID id = pbd->IndextoID(i);
-				ParamDef &pdef = pbd->GetParamDef(id);
-				hash << id << pdef.type;
+	// Remove the nodes, keeping the parent links of the animatables still stored consistent
+	for (Animatable* current : dropped)
+	{
+		for (Animatable* child : mNodes[current].children)
+		{
+			if (!dropped.count(child))
+				mNodes[child].parents.erase(current);
+		}
+	}
 
-				float v = 0;
-				if (pb->GetValue(id, mT, v, FOREVER))
+	for (Animatable* current : dropped)
+		mNodes.erase(current);
+}
+
+HashValue MaterialParser::getMaterialHash(MtlBase *mat, bool bReloadMaterial /*= true*/)
+{
+	return GetHashValue(mat, mT, mHashMemo, syncTimestamp, bReloadMaterial);
+}
+
+namespace
+{
+	// Hashes a parameter by trying to read it as each of the types param blocks hold. Only used for parameter types the switch
+	// in HashParamBlock doesn't handle.
+	void HashParamByProbing(HashValue& hash, IParamBlock2* pb, ParamID id, TimeValue mT, int tabIndex)
+	{
+		float v = 0;
+		if (pb->GetValue(id, mT, v, FOREVER, tabIndex))
+			hash << v;
+		else
+		{
+			int v = 0;
+			if (pb->GetValue(id, mT, v, FOREVER, tabIndex))
+				hash << v;
+			else
+			{
+				const MCHAR * v = 0;
+				if (pb->GetValue(id, mT, v, FOREVER, tabIndex))
 					hash << v;
 				else
 				{
-					int v = 0;
-					if (pb->GetValue(id, mT, v, FOREVER))
+					Point3 v;
+
+					if (pb->GetValue(id, mT, v, FOREVER, tabIndex))
 						hash << v;
 					else
 					{
-						const MCHAR * v = 0;
-						if (pb->GetValue(id, mT, v, FOREVER))
+						Point4 v;
+
+						if (pb->GetValue(id, mT, v, FOREVER, tabIndex))
 							hash << v;
 						else
 						{
-							ReferenceTarget* v = 0;
-							if (pb->GetValue(id, mT, v, FOREVER))
-							{
-								hash << GetHashValue(v, mT, hash_visited, syncTimestamp, bReloadMaterial);
-							}
+							Matrix3 v;
+
+							if (pb->GetValue(id, mT, v, FOREVER, tabIndex))
+								hash << v;
 							else
 							{
-								Point3 v;
-
-								if (pb->GetValue(id, mT, v, FOREVER))
-									hash << v;
-								else
-								{
-									Point4 v;
-
-									if (pb->GetValue(id, mT, v, FOREVER))
-										hash << v;
-									else
-									{
-										PBBitmap* v = 0;
-
-										if (pb->GetValue(id, mT, v, FOREVER))
-											hash << v;
-										else
-										{
-											Matrix3 v;
-
-											if (pb->GetValue(id, mT, v, FOREVER))
-												hash << v;
-											else
-											{
-												Color v;
-
-												if (pb->GetValue(id, mT, v, FOREVER))
-													hash << v;
-												else
-												{
-													// DebugPrint("Unknown param type\n");
-												}
-											}
-										}
-									}
-								}
+								// DebugPrint("Unknown param type\n");
 							}
 						}
 					}
@@ -433,7 +699,161 @@ HashValue MaterialParser::GetHashValue(Animatable* mat, TimeValue mT, std::map<A
 			}
 		}
 	}
+}
+
+void MaterialParser::HashParamBlock(HashValue& hash, IParamBlock2* pb, TimeValue mT, MaterialHashMemo& hashMemo, DWORD syncTimestamp,
+	bool bReloadMaterial, bool& usesTimestamp, std::vector<Animatable*>& children)
+{
+	auto pbd = pb->GetDesc();
+	hash << pb << pbd->count;
+
+	for (USHORT i = 0; i < pbd->count; i++)
+	{
+		ParamID id = pbd->IndextoID(i);
+		ParamDef &pdef = pbd->GetParamDef(id);
+		hash << id << pdef.type;
+
+		const int count = is_tab(pdef.type) ? pb->Count(id) : 1;
+		if (is_tab(pdef.type))
+			hash << count;
+
+		for (int tabIndex = 0; tabIndex < count; tabIndex++)
+		{
+			switch (base_type(pdef.type))
+			{
+			case TYPE_FLOAT:
+			case TYPE_ANGLE:
+			case TYPE_PCNT_FRAC:
+			case TYPE_WORLD:
+			case TYPE_COLOR_CHANNEL:
+			{
+				float v = 0;
+				pb->GetValue(id, mT, v, FOREVER, tabIndex);
+				hash << v;
+			}
+			break;
+
+			case TYPE_INT:
+			case TYPE_BOOL:
+			case TYPE_TIMEVALUE:
+			case TYPE_RADIOBTN_INDEX:
+			case TYPE_INDEX:
+			{
+				int v = 0;
+				pb->GetValue(id, mT, v, FOREVER, tabIndex);
+				hash << v;
+			}
+			break;
+
+			case TYPE_STRING:
+			case TYPE_FILENAME:
+			{
+				const MCHAR * v = 0;
+				if (pb->GetValue(id, mT, v, FOREVER, tabIndex) && v)
+					hash << v;
+			}
+			break;
+
+			case TYPE_MTL:
+			case TYPE_TEXMAP:
+			case TYPE_INODE:
+			case TYPE_REFTARG:
+			case TYPE_PBLOCK2:
+			{
+				ReferenceTarget* v = 0;
+				pb->GetValue(id, mT, v, FOREVER, tabIndex);
+				hash << ComputeHashValue(v, mT, hashMemo, syncTimestamp, bReloadMaterial, usesTimestamp);
+				if (v)
+					children.push_back(v);
+			}
+			break;
+
+			case TYPE_POINT3:
+			case TYPE_RGBA:
+			case TYPE_HSV:
+			{
+				Point3 v;
+				pb->GetValue(id, mT, v, FOREVER, tabIndex);
+				hash << v;
+			}
+			break;
+
+			case TYPE_POINT4:
+			case TYPE_FRGBA:
+			{
+				Point4 v;
+				pb->GetValue(id, mT, v, FOREVER, tabIndex);
+				hash << v;
+			}
+			break;
+
+			case TYPE_BITMAP:
+			{
+				PBBitmap* v = 0;
+				pb->GetValue(id, mT, v, FOREVER, tabIndex);
+				hash << v;
+			}
+			break;
+
+			case TYPE_MATRIX3:
+			{
+				Matrix3 v;
+				pb->GetValue(id, mT, v, FOREVER, tabIndex);
+				hash << v;
+			}
+			break;
+
+			default:
+				HashParamByProbing(hash, pb, id, mT, tabIndex);
+			}
+		}
+	}
+}
+
+HashValue MaterialParser::ComputeHashValue(Animatable* mat, TimeValue mT, MaterialHashMemo& hashMemo, DWORD syncTimestamp,
+	bool bReloadMaterial, bool& usesTimestamp)
+{
+	HashValue hash;
+
+	if (!mat)
+		return hash;
+
+	bool storedUsesTimestamp = false;
+	if (const HashValue* stored = hashMemo.Find(mat, mT, syncTimestamp, bReloadMaterial, storedUsesTimestamp))
+	{
+		usesTimestamp |= storedUsesTimestamp;
+		return *stored;
+	}
+
+	// whether this hash depends on the sync timestamp, directly or through its children
+	bool matUsesTimestamp = false;
+	std::vector<Animatable*> children;
+
+	int npb = mat->NumParamBlocks();
+	hash << mat << npb;
+
+	// some materials has no param block(Tiles)
+	// so we mix current time to it to always invalidate
+	// used common syncTimestamp so that for one Synchronize call 
+	// hash would be still the same
+	if (!npb)
+	{
+		hash << syncTimestamp;
+		matUsesTimestamp = true;
+	}
 
+	// bReloadMaterial must modify hash it shouldn'mT depend on syncTimestamp
+	if (bReloadMaterial)
+	{
+		hash << syncTimestamp;
+		matUsesTimestamp = true;
+	}
+
+	for (int j = 0; j < npb; j++)
+	{
+		if (auto pb = mat->GetParamBlock(j))
+			HashParamBlock(hash, pb, mT, hashMemo, syncTimestamp, bReloadMaterial, matUsesTimestamp, children);
+	}
 
 	if (UVGen* uvGen = dynamic_cast<UVGen*>(mat))
 	{
@@ -466,7 +886,10 @@ HashValue MaterialParser::GetHashValue(Animatable* mat, TimeValue mT, std::map<A
 				hash << sub << texmap->SubTexmapOn(i);
 
 				if (auto subMat = dynamic_cast<MtlBase*>(sub))
-					hash << GetHashValue(subMat, mT, hash_visited, syncTimestamp, bReloadMaterial);
+				{
+					hash << ComputeHashValue(subMat, mT, hashMemo, syncTimestamp, bReloadMaterial, matUsesTimestamp);
+					children.push_back(subMat);
+				}
 			}
 		}
 	}
@@ -475,15 +898,23 @@ HashValue MaterialParser::GetHashValue(Animatable* mat, TimeValue mT, std::map<A
 	{
 		if (auto sub = mat->SubAnim(i))
 		{
-			hash << GetHashValue(sub, mT, hash_visited, syncTimestamp, bReloadMaterial);
+			hash << ComputeHashValue(sub, mT, hashMemo, syncTimestamp, bReloadMaterial, matUsesTimestamp);
+			children.push_back(sub);
 		}
 	}
 
-	hash_visited.insert(std::make_pair(mat, hash));
+	hashMemo.Store(mat, mT, syncTimestamp, bReloadMaterial, matUsesTimestamp, hash, std::move(children));
 
+	usesTimestamp |= matUsesTimestamp;
 	return hash;
 }
 
+HashValue MaterialParser::GetHashValue(Animatable* mat, TimeValue mT, MaterialHashMemo &hashMemo, DWORD syncTimestamp, bool bReloadMaterial /*= true*/)
+{
+	bool usesTimestamp = false;
+	return ComputeHashValue(mat, mT, hashMemo, syncTimestamp, bReloadMaterial, usesTimestamp);
+}
+
 
 Texmap* MaterialParser::findDisplacementMap(MtlBase* mat)
 {
@@ -572,8 +1003,7 @@ frw::Value MaterialParser::createMap(Texmap* texmap, const int flags)
 	if (!texmap)
 		return frw::Value();
 
-	std::map<Animatable*, HashValue> hash_visited;
-	auto key = GetHashValue(texmap, mT, hash_visited, syncTimestamp, true) << flags;
+	auto key = GetHashValue(texmap, mT, mHashMemo, syncTimestamp, true) << flags;
 
 	auto result = mScope.GetValue(key);
 
@@ -2978,7 +3408,11 @@ frw::Value MaterialParser::createTextureMap(Texmap *texmap, int flags)
 
 	if (auto map = dynamic_cast<BitmapTex*>(texmap->GetInterface(BITMAPTEX_INTERFACE)))
 	{
-		if (auto image = createImage(map->GetBitmap(timeVal), HashValue() << texmap << getMaterialHash(texmap, true), flags, map->GetMapName()))
+		Bitmap* bitmap = map->GetBitmap(timeVal);
+		HashValue key = HashValue() << texmap << getMaterialHash(texmap, true);
+
+		frw::Image image = mDeferImages ? createDeferredImage(map, bitmap, timeVal, key, flags) : createImage(bitmap, key, flags, map->GetMapName());
+		if (image)
 		{
 			frw::ImageNode node(materialSystem);
 			node.SetMap(image);
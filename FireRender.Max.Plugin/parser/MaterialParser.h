@@ -33,6 +33,8 @@ limitations under the License.
 #include <map>
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 FIRERENDER_NAMESPACE_BEGIN
 
@@ -46,6 +48,84 @@ enum
 	MAP_FLAG_BUMPMAP =		(1 << 4)
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Hash values computed by MaterialParser::GetHashValue, kept for the lifetime of the parser so that each texmap or material
+// is hashed once, however many materials reach it and however many syncs follow. Entries are keyed by the animatable and
+// remember what they were computed for (time, reload flag, and the sync timestamp when it was mixed in). The graph of the
+// hashed animatables is recorded, so that invalidating an animatable also drops everything below it (the change reported
+// for it may come from any of them) and everything whose hash includes any of those.
+//
+
+class MaterialHashMemo
+{
+	struct Entry
+	{
+		bool valid = false;
+		bool usesTimestamp = false; // the hash mixes in the sync timestamp, so it's only valid for that sync
+		TimeValue t = 0;
+		DWORD syncTimestamp = 0;
+		HashValue hash;
+	};
+
+	struct Node
+	{
+		AnimHandle handle = 0; // detects animatables deleted and replaced by new ones at the same address
+		Entry entries[2]; // indexed by the reload flag
+		std::vector<Animatable*> children;
+		std::unordered_set<Animatable*> parents;
+	};
+
+	std::unordered_map<Animatable*, Node> mNodes;
+
+	MaterialHashMemo(const MaterialHashMemo&) = delete;
+	MaterialHashMemo& operator=(const MaterialHashMemo&) = delete;
+
+public:
+	MaterialHashMemo() = default;
+
+	/// Returns the stored hash of the animatable, or nullptr if it has to be computed. usesTimestamp receives whether the
+	/// stored hash depends on the sync timestamp.
+	const HashValue* Find(Animatable* anim, TimeValue t, DWORD syncTimestamp, bool bReloadMaterial, bool& usesTimestamp) const;
+
+	/// Stores the hash of the animatable, computed from the hashes of given children
+	void Store(Animatable* anim, TimeValue t, DWORD syncTimestamp, bool bReloadMaterial, bool usesTimestamp, const HashValue& hash,
+		std::vector<Animatable*>&& children);
+
+	/// Drops the hashes of the animatable, of all animatables below it, and of all animatables which were hashed from any of them
+	void Invalidate(Animatable* anim);
+
+	void Clear()
+	{
+		mNodes.clear();
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Bitmap texture whose conversion and upload were deferred (see MaterialParser::SetDeferImages). Image nodes reference a 1x1
+// proxy image in its place until a shape using them is attached to the scene; MaterialParser::LoadDeferredImages then loads
+// the bitmap and points the nodes at the real image.
+//
+
+struct DeferredImage
+{
+	AnimHandle texmap = 0; // BitmapTex the image is read from, looked up by its handle in case it was deleted meanwhile
+	HashValue key; // key of the texmap, as passed to createImage
+	int flags = 0;
+	TimeValue t = 0; // time the bitmap was taken at
+	unsigned int width = 0;
+	unsigned int height = 0;
+	bool loaded = false; // loaded at least once; the proxy may still be used by graphs which are not attached
+	frw::Image proxy;
+};
+
+// Outcome of MaterialParser::LoadDeferredImages
+struct DeferredImageLoad
+{
+	size_t loaded = 0; // images loaded by this call
+	size_t waiting = 0; // images used by attached shapes, left for the next call because the time budget ran out
+	size_t skipped = 0; // images never loaded so far, as no attached shape uses them
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // MaterialParser converts 3ds Max texmaps and materials to RPR shaders/maps
 //
@@ -60,6 +140,10 @@ protected:
 	frw::Scope mScope; // associated context mScope
 	TimeValue mT = 0; // current time
 	IParamBlock2 *mPblock = 0; // renderer's parameter block
+	MaterialHashMemo mHashMemo; // hashes of the texmaps and materials, see getMaterialHash
+	bool mDeferImages = false; // see SetDeferImages
+	std::unordered_map<size_t, DeferredImage> mDeferredImages; // keyed by the image key
+	DeferredImageLoad mDeferredImageStats; // accumulated by LoadDeferredImages until ReportDeferredImages
 
 public:
 	frw::MaterialSystem materialSystem;
@@ -75,13 +159,19 @@ public:
 		bool mNormalDirectlyPlugged = false;
 	} shaderData;
 
-	static HashValue GetHashValue(Animatable *mat, TimeValue mT, std::map<Animatable*, HashValue> &hash_visited, DWORD syncTimestamp, bool bReloadMaterial = false);
+	static HashValue GetHashValue(Animatable *mat, TimeValue mT, MaterialHashMemo &hashMemo, DWORD syncTimestamp, bool bReloadMaterial = false);
 
 	// Traverses a mtlbase (base class for both texmaps and materials) paramblock and computes an unique hash value for it
 	HashValue getMaterialHash(MtlBase *mat, bool bReloadMaterial = false);
 
 	HashValue getBitmapHash(Bitmap *bm);
 
+	// Forgets the hash of a texmap or material reported changed, see MaterialHashMemo
+	inline void InvalidateHash(Animatable* anim)
+	{
+		mHashMemo.Invalidate(anim);
+	}
+
 	DWORD syncTimestamp;
 
 	inline void SetTimeValue(const TimeValue &tt)
@@ -93,8 +183,32 @@ public:
 	{
 		mPblock = pb;
 	}
+
+	// In deferred image mode, bitmap textures are not converted and uploaded while materials are parsed, only once a shape
+	// using them is attached to the scene (see DeferredImage and LoadDeferredImages)
+	inline void SetDeferImages(bool defer)
+	{
+		mDeferImages = defer;
+	}
+
+	// Loads the deferred images used by the shapes attached to the scene, most used first (then smallest first), and points
+	// their image nodes at them. With a time budget (in milliseconds, 0 for unlimited), loading stops once it runs out; at
+	// least one image is loaded per call.
+	DeferredImageLoad LoadDeferredImages(frw::Scene scene, DWORD timeBudget = 0);
+
+	// Prints the deferred images loaded by the LoadDeferredImages calls since the last report, once per synchronization
+	void ReportDeferredImages();
 	
 protected:
+	// Hashes an animatable for GetHashValue; usesTimestamp is set if the hash depends on syncTimestamp
+	static HashValue ComputeHashValue(Animatable* mat, TimeValue mT, MaterialHashMemo& hashMemo, DWORD syncTimestamp,
+		bool bReloadMaterial, bool& usesTimestamp);
+
+	// Hashes the values of all parameters of the block, reading each with the type of its definition. Referenced animatables
+	// are hashed recursively and added to children.
+	static void HashParamBlock(HashValue& hash, IParamBlock2* pb, TimeValue mT, MaterialHashMemo& hashMemo, DWORD syncTimestamp,
+		bool bReloadMaterial, bool& usesTimestamp, std::vector<Animatable*>& children);
+
 	// Finds a leaf material given an input material (which may be a hierarchy of multi-materials. Returns the input material
 	// itself if a leaf material
 	// material - material for which we want to find the leaf. Can be NULL
@@ -206,6 +320,12 @@ public:
 
 	frw::Image createImage(Bitmap* bm, const HashValue &key, const int flags, const std::wstring& name = L"");
 
+	// Returns the proxy of a bitmap texture in deferred image mode, or its image if it is already loaded
+	frw::Image createDeferredImage(BitmapTex* map, Bitmap* bm, TimeValue t, const HashValue& key, const int flags);
+
+	// Key of the image created from a bitmap, see createImage
+	HashValue getImageKey(Bitmap* bm, const HashValue& key, const int flags);
+
 
 	// Creates a RPR volume shader from a given MAX material, eventually considering the node it is assigned to
 	// mtl - MAX material to convert. Can be NULL
@@ -0,0 +1,537 @@
+/**********************************************************************
+Copyright 2020 Advanced Micro Devices, Inc
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+    http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+********************************************************************/
+
+#include "MeshSplitter.h"
+#include "GeometryCache.h"
+#include "CoronaDeclarations.h"
+#include "ScopeManager.h"
+#include "FRSettingsFileHandler.h"
+#include <MeshNormalSpec.h>
+#include <unordered_map>
+
+FIRERENDER_NAMESPACE_BEGIN;
+
+namespace
+{
+	/// Bit pattern of an attribute value, so that only bit-identical values get welded
+	struct AttributeKey
+	{
+		uint32_t x, y, z;
+
+		inline bool operator==(const AttributeKey& other) const
+		{
+			return x == other.x && y == other.y && z == other.z;
+		}
+	};
+
+	struct AttributeKeyHash
+	{
+		inline size_t operator()(const AttributeKey& key) const
+		{
+			size_t h = key.x;
+			h = (h * 0x9E3779B1u) ^ key.y;
+			h = (h * 0x9E3779B1u) ^ key.z;
+			return h;
+		}
+	};
+
+	inline AttributeKey MakeAttributeKey(const Point3& value)
+	{
+		static_assert(sizeof(AttributeKey) == sizeof(Point3), "unexpected Point3 layout");
+		AttributeKey key;
+		memcpy(&key, &value, sizeof(key));
+		return key;
+	}
+
+	/// Gives every material range of the index stream its own welded copy of the attributes it references, and rewrites the
+	/// indices to be relative to that copy
+	void CompactAttribute(std::vector<Point3>& attributes, std::vector<rpr_int>& indices, const std::vector<size_t>& offsets,
+		int numSubmtls, std::vector<size_t>& attrOffsets)
+	{
+		std::vector<Point3> compacted;
+		std::vector<rpr_int> remap(attributes.size(), -1);
+		std::vector<rpr_int> touched;
+		std::unordered_map<AttributeKey, rpr_int, AttributeKeyHash> welded;
+
+		attrOffsets.assign(numSubmtls + 1, 0);
+
+		for (int m = 0; m < numSubmtls; ++m)
+		{
+			const size_t first = compacted.size();
+
+			for (size_t i = offsets[m]; i < offsets[m + 1]; ++i)
+			{
+				const rpr_int index = indices[i];
+				FASSERT(index >= 0 && size_t(index) < attributes.size());
+
+				rpr_int& mapped = remap[index];
+				if (mapped < 0)
+				{
+					auto res = welded.insert(std::make_pair(MakeAttributeKey(attributes[index]), rpr_int(compacted.size() - first)));
+					if (res.second)
+						compacted.push_back(attributes[index]);
+					mapped = res.first->second;
+					touched.push_back(index);
+				}
+				indices[i] = mapped;
+			}
+
+			attrOffsets[m + 1] = compacted.size();
+
+			// the next material starts with an empty mapping
+			for (auto index : touched)
+				remap[index] = -1;
+			touched.clear();
+			welded.clear();
+		}
+
+		compacted.shrink_to_fit();
+		attributes.swap(compacted);
+	}
+}
+
+SplitMeshView SplitMesh::GetView() const
+{
+	SplitMeshView view;
+	view.numSubmtls = numSubmtls;
+	view.numChannels = numChannels;
+	view.verts = verts;
+	view.normals = normals;
+	view.vertIndices = vertIndices;
+	view.normalIndices = normalIndices;
+	view.offsets = offsets;
+	view.vertOffsets = vertOffsets;
+	view.normalOffsets = normalOffsets;
+	for (int i = 0; i < MaxChannels; ++i)
+	{
+		view.texcoords[i] = texcoords[i];
+		view.texcoordIndices[i] = texcoordIndices[i];
+		view.texcoordOffsets[i] = texcoordOffsets[i];
+	}
+	return view;
+}
+
+size_t SplitMeshView::GetAttributeBytes() const
+{
+	size_t res = 0;
+	for (int i = 0; i < numSubmtls; ++i)
+	{
+		if (GetFaceCount(i) == 0)
+			continue;
+
+		size_t count = 0;
+		GetAttributes(verts, vertOffsets, i, count);
+		res += count;
+		GetAttributes(normals, normalOffsets, i, count);
+		res += count;
+		for (int j = 0; j < numChannels; ++j)
+		{
+			GetAttributes(texcoords[j], texcoordOffsets[j], i, count);
+			res += count;
+		}
+	}
+	return res * sizeof(Point3);
+}
+
+bool IsSplitMeshChannelUsable(const Mesh& mesh, int channel)
+{
+	// maps[0] is vertex color, texture coordinate layer i comes from map channel i + 1
+	const int mapChannel = channel + 1;
+	if (mapChannel >= mesh.getNumMaps() || !mesh.mapSupport(mapChannel))
+		return false;
+
+	const MeshMap& map = mesh.maps[mapChannel];
+	return map.vnum > 0 && map.tv != nullptr && map.tf != nullptr && map.fnum == mesh.getNumFaces();
+}
+
+int GetSplitMeshChannelCount(const Mesh& mesh)
+{
+	// Layers are positional (texmaps look up layer "map channel - 1"), so a missing channel below a used one is still
+	// counted, and left empty
+	int numChannels = 0;
+	for (int i = 0; i < SplitMesh::MaxChannels; ++i)
+	{
+		if (IsSplitMeshChannelUsable(mesh, i))
+			numChannels = i + 1;
+	}
+	return numChannels;
+}
+
+void SplitMeshByMaterial(Mesh& mesh, MeshNormalSpec& normals, int numSubmtls, float masterScale, bool flipFaces, SplitMesh& out)
+{
+	FASSERT(numSubmtls > 0);
+
+	const int numChannels = GetSplitMeshChannelCount(mesh);
+
+	out.numSubmtls = numSubmtls;
+	out.numChannels = numChannels;
+
+	// Copy all vertices, normals, and texture coordinates from 3ds Max to our buffers
+	const int numVerts = mesh.getNumVerts();
+	out.verts.resize(numVerts);
+	for (int i = 0; i < numVerts; ++i)
+		out.verts[i] = mesh.verts[i] * masterScale;
+
+	const int numNormals = normals.GetNumNormals();
+	out.normals.resize(numNormals);
+	for (int i = 0; i < numNormals; ++i)
+		out.normals[i] = normals.Normal(i).Normalize();
+
+	// Each layer gets a single buffer sized to its own map channel, shared by the index streams of all materials
+	bool usableChannels[SplitMesh::MaxChannels] = {};
+	for (int i = 0; i < numChannels; i++)
+	{
+		usableChannels[i] = IsSplitMeshChannelUsable(mesh, i);
+		if (!usableChannels[i])
+			continue;
+
+		MeshMap& mapChannel = mesh.maps[i + 1]; // maps[0] is vertex color, leave it
+
+		auto& t = out.texcoords[i];
+		t.resize(mapChannel.vnum);
+		for (int j = 0; j < mapChannel.vnum; ++j)
+		{
+			UVVert tv = mapChannel.tv[j];
+			if (flipFaces)
+				tv.x = 1.f - tv.x;
+			t[j] = tv;
+		}
+	}
+
+	// First pass: histogram of material IDs, turned into offsets of each material's range in the index buffers
+	const int faceCount = mesh.getNumFaces();
+	const size_t numIndices = ComputeMaterialBins(faceCount, numSubmtls,
+		[&mesh](int i) { return int(mesh.faces[i].getMatID()); }, out.offsets);
+
+	out.vertIndices.resize(numIndices);
+	out.normalIndices.resize(numIndices);
+	for (int k = 0; k < numChannels; ++k)
+	{
+		if (usableChannels[k])
+			out.texcoordIndices[k].resize(numIndices);
+	}
+
+	// Second pass: scatter each triangle into its material's range
+	std::vector<size_t> cursor(out.offsets.begin(), out.offsets.end() - 1);
+
+	for (int i = 0; i < faceCount; ++i)
+	{
+		Face& face = mesh.faces[i];
+		size_t& pos = cursor[face.getMatID() % numSubmtls];
+
+		for (int j = 0; j < 3; ++j, ++pos)
+		{
+#ifdef SWITCH_AXES
+			int index = 0; // we swap 2 indices because we change parity via TM switch
+			if (j == 1) {
+				index = 2;
+			}
+			else if (j == 2) {
+				index = 1;
+			}
+#else
+			const int index = j;
+#endif
+
+			out.vertIndices[pos] = face.getVert(index);
+			out.normalIndices[pos] = normals.GetNormalIndex(i, index);
+
+			for (int k = 0; k < numChannels; ++k)
+			{
+				if (usableChannels[k])
+					out.texcoordIndices[k][pos] = mesh.maps[k + 1].tf[i].t[index]; // maps[0] is vertex color, leave it
+			}
+		}
+	}
+}
+
+void CompactSplitMesh(SplitMesh& mesh)
+{
+	if (mesh.IsCompacted())
+		return;
+
+	CompactAttribute(mesh.verts, mesh.vertIndices, mesh.offsets, mesh.numSubmtls, mesh.vertOffsets);
+	CompactAttribute(mesh.normals, mesh.normalIndices, mesh.offsets, mesh.numSubmtls, mesh.normalOffsets);
+
+	for (int j = 0; j < mesh.numChannels; ++j)
+	{
+		if (!mesh.texcoords[j].empty())
+			CompactAttribute(mesh.texcoords[j], mesh.texcoordIndices[j], mesh.offsets, mesh.numSubmtls, mesh.texcoordOffsets[j]);
+	}
+}
+
+void CreateShapesFromSplitMesh(frw::Context& context, const SplitMeshView& mesh, std::vector<frw::Shape>& result)
+{
+	// Create a dummy array holding numbers of vertices for each face (which is always "3" in our case)
+	std::vector<rpr_int> vertNums(mesh.GetMaxFaceCount(), 3);
+
+	// A layer without data below a used one (map channel 1 missing while channel 2 is present) must not reach RPR as a null
+	// buffer, so all its corners are mapped to a single zero coordinate instead
+	const Point3 zeroTexcoord(0.f, 0.f, 0.f);
+	std::vector<rpr_int> zeroTexcoordIndices;
+	for (int j = 0; j < mesh.numChannels; ++j)
+	{
+		if (mesh.texcoords[j].empty())
+			zeroTexcoordIndices.assign(mesh.GetMaxFaceCount() * 3, 0);
+	}
+
+	for (int i = 0; i < mesh.numSubmtls; ++i)
+	{
+		const size_t currMeshFaces = mesh.GetFaceCount(i);
+
+		if (currMeshFaces == 0)
+		{
+			// we still need to push something so the array of materials created elsewhere matches the array of shapes
+			result.push_back(frw::Shape());
+			continue;
+		}
+
+		const size_t first = mesh.offsets[i];
+
+		size_t texcoordsNum[SplitMeshView::MaxChannels] = { 0, 0 };
+		rpr_int texcoordStride[SplitMeshView::MaxChannels] = { 0, 0 };
+		rpr_int texcoordIdxStride[SplitMeshView::MaxChannels] = { 0, 0 };
+
+		const rpr_float* texcoords[SplitMeshView::MaxChannels] = { nullptr, nullptr };
+		const rpr_int* texcoordIndices[SplitMeshView::MaxChannels] = { nullptr, nullptr };
+
+		for (int j = 0; j < mesh.numChannels; ++j)
+		{
+			texcoords[j] = reinterpret_cast<const rpr_float*>(
+				SplitMeshView::GetAttributes(mesh.texcoords[j], mesh.texcoordOffsets[j], i, texcoordsNum[j]));
+			texcoordStride[j] = sizeof(Point3);
+			texcoordIdxStride[j] = sizeof(rpr_int);
+
+			if (texcoords[j])
+			{
+				texcoordIndices[j] = &mesh.texcoordIndices[j][first];
+			}
+			else
+			{
+				texcoords[j] = &zeroTexcoord.x;
+				texcoordsNum[j] = 1;
+				texcoordIndices[j] = zeroTexcoordIndices.data();
+			}
+		}
+
+		size_t numVerts = 0;
+		size_t numNormals = 0;
+		auto verts = reinterpret_cast<const rpr_float*>(SplitMeshView::GetAttributes(mesh.verts, mesh.vertOffsets, i, numVerts));
+		auto normals = reinterpret_cast<const rpr_float*>(SplitMeshView::GetAttributes(mesh.normals, mesh.normalOffsets, i, numNormals));
+
+		auto shape = context.CreateMeshEx(
+			verts, numVerts, sizeof(Point3),
+			normals, numNormals, sizeof(Point3),
+			nullptr, 0, 0,
+			mesh.numChannels, texcoords, texcoordsNum, texcoordStride,
+			&mesh.vertIndices[first], sizeof(rpr_int),
+			&mesh.normalIndices[first], sizeof(rpr_int),
+			texcoordIndices, texcoordIdxStride,
+			vertNums.data(),
+			currMeshFaces);
+
+		result.push_back(shape);
+	}
+}
+
+bool EvaluatedMesh::Evaluate(INode* inode, Object* evaluatedObject, TimeValue t, View& view, bool& directlyVisible)
+{
+	Release();
+
+	// First, we try to obtain render mesh from the object
+	if (auto geomObject = dynamic_cast<GeomObject*>(evaluatedObject))
+	{
+		// expensive!
+		mMesh = geomObject->GetRenderMesh(t, inode, view, mNeedsDelete);
+	}
+
+	directlyVisible = inode->GetPrimaryVisibility() != FALSE;
+	if (evaluatedObject->ClassID() == Corona::LIGHT_CID)
+	{
+		if (ScopeManagerMax::CoronaOK)
+		{
+			// Corona lights require some special processing - we will get its mesh via function publishing interface.
+			// But when we have it, we can parse the mesh as any other geometry object, because we also handle their the lights 
+			// material specially in MaterialParser.
+			directlyVisible &= GetFromPb<bool>(evaluatedObject->GetParamBlockByID(0), Corona::L_DIRECTLY_VISIBLE);
+			BaseInterface* bi = evaluatedObject->GetInterface(Corona::IFIREMAX_LIGHT_INTERFACE);
+			Corona::IFireMaxLightInterface* lightInterface = dynamic_cast<Corona::IFireMaxLightInterface*>(bi);
+			if (lightInterface)
+				lightInterface->fmGetRenderMesh(t, mMesh, mNeedsDelete);
+			else
+				MessageBox(GetCOREInterface()->GetMAXHWnd(), _T("Too old Corona version."), _T("Radeon ProRender warning"), MB_OK);
+		}
+	}
+
+	if (!mMesh)  //nothing to do here
+		return false;
+
+	// Handle normals: in case we need to delete the mesh, we are free to modify it, so we just do by calling SpecifyNormals()
+	if (mNeedsDelete)
+	{
+		mMesh->SpecifyNormals();
+		mNormals = mMesh->GetSpecifiedNormals();
+	}
+	else
+	{
+		// Otherwise we will try to get the normals without modifying the mesh. We try it...
+		mNormals = mMesh->GetSpecifiedNormals();
+		if (mNormals == NULL || mNormals->GetNumNormals() == 0)
+		{
+			// ... and if it fails, we will have to copy the mesh, modify it by calling SpecifyNormals(), and get the normals 
+			// from the mesh copy
+			mMeshCopy.reset(new Mesh(*mMesh));
+			mMeshCopy->SpecifyNormals();
+			mNormals = mMeshCopy->GetSpecifiedNormals();
+		}
+	}
+	FASSERT(mNormals);
+	mNormals->CheckNormals();
+
+	return true;
+}
+
+void EvaluatedMesh::Release()
+{
+	if (mMesh && mNeedsDelete)
+		mMesh->DeleteThis();
+
+	mMesh = nullptr;
+	mNormals = nullptr;
+	mNeedsDelete = FALSE;
+	mMeshCopy.reset();
+}
+
+void MeshTranslationStats::Report(const wchar_t* what) const
+{
+	wchar_t buf[1024 + 1] = {};
+	wsprintf(buf, L"%s: %d meshes, %d faces; evaluate %d ms, split %d ms, create %d ms; attributes %d KB -> %d KB; "
+		L"geometry cache %d hits, %d misses", what,
+		int(meshes), int(faces), int(evaluate.GetElapsed()), int(split.GetElapsed()), int(create.GetElapsed()),
+		int(bytesBefore / 1024), int(bytesAfter / 1024), int(cacheHits), int(cacheMisses));
+	debugPrint(buf);
+}
+
+MeshTranslationOptions GetMeshTranslationOptions()
+{
+	MeshTranslationOptions options;
+	options.compact = FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::MeshCompaction) == "1";
+
+	if (FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::GeometryCache) == "1")
+		options.cacheFolder = GetGeometryCacheFolder();
+
+	return options;
+}
+
+void TrimGeometryCacheToSettings()
+{
+	if (FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::GeometryCache) != "1")
+		return;
+
+	const std::wstring folder = GetGeometryCacheFolder();
+	if (folder.empty())
+		return;
+
+	// size limit in megabytes; files stored by this render are accounted for by the next one
+	const int cacheSize = std::atoi(FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::GeometryCacheSize).c_str());
+	TrimGeometryCache(folder, cacheSize > 0 ? uint64_t(cacheSize) << 20 : DefaultGeometryCacheBytes);
+}
+
+void TranslateMeshes(frw::Context& context, float masterScale, TimeValue t, View& view, std::vector<MeshTranslationJob>& jobs,
+	MeshTranslationStats& stats, const MeshTranslationOptions& options)
+{
+	const bool useCache = !options.cacheFolder.empty();
+	const int numJobs = int_cast(jobs.size());
+
+	// Stage 1: the 3ds Max SDK is not thread safe, so render meshes are evaluated here on the main thread. The evaluated
+	// objects are cached by their nodes, so the meshes stay valid while the following stages run.
+	stats.evaluate.Start();
+	for (auto& job : jobs)
+	{
+		if (!job.shapes.empty() || !job.object)
+			continue;
+
+		if (job.evaluated.Evaluate(job.node, job.object, t, view, job.directlyVisible))
+			job.meshFaces = job.evaluated.GetMesh().getNumFaces();
+	}
+	stats.evaluate.Stop();
+
+	// Stage 2: hashing, flattening and material binning only touch plain memory (and the cache files), so they run in parallel
+	stats.split.Start();
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < numJobs; ++i)
+	{
+		auto& job = jobs[i];
+		if (!job.evaluated.IsValid())
+			continue;
+
+		GeometryCacheKey key;
+		if (useCache)
+		{
+			key = ComputeGeometryCacheKey(job.evaluated.GetMesh(), job.evaluated.GetNormals(), job.numSubmtls, masterScale,
+				job.flipFaces, options.compact);
+
+			// a hit maps the stored buffers, which are then passed to RPR without being copied
+			if (job.cached.Open(options.cacheFolder, key, job.view))
+			{
+				job.bytesBefore = job.bytesAfter = job.view.GetAttributeBytes();
+				continue;
+			}
+		}
+
+		SplitMeshByMaterial(job.evaluated.GetMesh(), job.evaluated.GetNormals(), job.numSubmtls, masterScale, job.flipFaces, job.split);
+
+		job.bytesBefore = job.split.GetView().GetAttributeBytes();
+		if (options.compact)
+			CompactSplitMesh(job.split);
+
+		job.view = job.split.GetView();
+		job.bytesAfter = job.view.GetAttributeBytes();
+
+		if (useCache)
+			StoreGeometryCacheFile(options.cacheFolder, key, job.view);
+	}
+	stats.split.Stop();
+
+	// Stage 3: finished buffers are submitted to RPR in the original order
+	stats.create.Start();
+	for (auto& job : jobs)
+	{
+		if (!job.evaluated.IsValid())
+			continue;
+
+		CreateShapesFromSplitMesh(context, job.view, job.shapes);
+
+		if (!job.directlyVisible)
+		{
+			for (auto& shape : job.shapes)
+				shape.SetVisibility(false);
+		}
+
+		stats.meshes++;
+		stats.faces += job.meshFaces;
+		stats.bytesBefore += job.bytesBefore;
+		stats.bytesAfter += job.bytesAfter;
+
+		if (useCache)
+			(job.cached.IsOpen() ? stats.cacheHits : stats.cacheMisses)++;
+
+		job.view = SplitMeshView();
+		job.cached.Close();
+		job.split = SplitMesh();
+		job.evaluated.Release();
+	}
+	stats.create.Stop();
+}
+
+FIRERENDER_NAMESPACE_END;
@@ -0,0 +1,300 @@
+/**********************************************************************
+Copyright 2020 Advanced Micro Devices, Inc
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+    http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+********************************************************************/
+
+#pragma once
+
+#include "frWrap.h"
+#include "Common.h"
+#include "utils/Utils.h"
+#include "GeometryCache.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+class MeshNormalSpec;
+
+FIRERENDER_NAMESPACE_BEGIN;
+
+/// Non-owning view of a contiguous array, so buffers owned by a SplitMesh and buffers mapped from a file are read the same way
+template<class T>
+struct ArrayView
+{
+	const T* ptr = nullptr;
+	size_t count = 0;
+
+	ArrayView() = default;
+
+	ArrayView(const T* p, size_t n)
+		: ptr(p), count(n)
+	{
+	}
+
+	ArrayView(const std::vector<T>& v)
+		: ptr(v.data()), count(v.size())
+	{
+	}
+
+	inline const T* data() const { return ptr; }
+	inline size_t size() const { return count; }
+	inline bool empty() const { return count == 0; }
+	inline const T& operator[](size_t i) const { return ptr[i]; }
+};
+
+/// Read-only view of the buffers of a split mesh (see SplitMesh for the layout). This is what shape creation consumes.
+struct SplitMeshView
+{
+	static const int MaxChannels = 2;
+
+	int numSubmtls = 0;
+	int numChannels = 0;
+
+	ArrayView<Point3> verts;
+	ArrayView<Point3> normals;
+	ArrayView<Point3> texcoords[MaxChannels];
+
+	ArrayView<rpr_int> vertIndices;
+	ArrayView<rpr_int> normalIndices;
+	ArrayView<rpr_int> texcoordIndices[MaxChannels];
+
+	ArrayView<size_t> offsets;
+
+	ArrayView<size_t> vertOffsets;
+	ArrayView<size_t> normalOffsets;
+	ArrayView<size_t> texcoordOffsets[MaxChannels];
+
+	/// Returns the range of attributes referenced by the shape of given material ID
+	template<class T>
+	static inline const T* GetAttributes(const ArrayView<T>& attributes, const ArrayView<size_t>& attrOffsets, int mtlId, size_t& count)
+	{
+		if (attributes.empty())
+		{
+			count = 0;
+			return nullptr;
+		}
+		if (attrOffsets.empty())
+		{
+			count = attributes.size();
+			return attributes.data();
+		}
+		count = attrOffsets[mtlId + 1] - attrOffsets[mtlId];
+		return attributes.data() + attrOffsets[mtlId];
+	}
+
+	/// Size in bytes of the vertex attributes passed to RPR for all shapes of this mesh
+	size_t GetAttributeBytes() const;
+
+	inline size_t GetFaceCount(int mtlId) const
+	{
+		return (offsets[mtlId + 1] - offsets[mtlId]) / 3;
+	}
+
+	inline size_t GetMaxFaceCount() const
+	{
+		size_t res = 0;
+		for (int i = 0; i < numSubmtls; ++i)
+			res = std::max(res, GetFaceCount(i));
+		return res;
+	}
+};
+
+/// Geometry of a single 3ds Max mesh flattened into RPR-friendly buffers. Triangles are grouped by their material ID: all
+/// index streams are single flat arrays, and the triangles of material ID i occupy indices [offsets[i], offsets[i+1]) in each
+/// of them. This keeps the memory footprint O(faces) regardless of how many sub-materials the node uses.
+struct SplitMesh
+{
+	/// Maximum number of texture coordinate layers RPR accepts in a single shape
+	static const int MaxChannels = SplitMeshView::MaxChannels;
+
+	int numSubmtls = 0;
+	int numChannels = 0;
+
+	std::vector<Point3> verts;
+	std::vector<Point3> normals;
+	std::vector<Point3> texcoords[MaxChannels];
+
+	std::vector<rpr_int> vertIndices;
+	std::vector<rpr_int> normalIndices;
+	std::vector<rpr_int> texcoordIndices[MaxChannels];
+
+	/// numSubmtls + 1 entries, offsets (in indices, not triangles) of each material ID into the index streams
+	std::vector<size_t> offsets;
+
+	/// Filled by CompactSplitMesh: numSubmtls + 1 entries, offsets of each material ID's own range in the attribute arrays.
+	/// When empty, all materials share the full attribute arrays.
+	std::vector<size_t> vertOffsets;
+	std::vector<size_t> normalOffsets;
+	std::vector<size_t> texcoordOffsets[MaxChannels];
+
+	inline bool IsCompacted() const
+	{
+		return !vertOffsets.empty();
+	}
+
+	SplitMeshView GetView() const;
+};
+
+/// Returns true if the map channel backing texture coordinate layer "channel" (map channel channel + 1) has data
+bool IsSplitMeshChannelUsable(const Mesh& mesh, int channel);
+
+/// Number of texture coordinate layers SplitMeshByMaterial extracts from the mesh, up to SplitMesh::MaxChannels. Layers
+/// without data below the highest usable one are kept empty, and given a single zero coordinate when shapes are created.
+int GetSplitMeshChannelCount(const Mesh& mesh);
+
+/// Computes the layout of per-material triangle bins with a counting sort: first pass builds a histogram of the (wrapped)
+/// material IDs, then an exclusive prefix sum turns it into index offsets. Returns the total number of indices.
+/// \param matIds material ID of every face, accessed through the getter so any face layout can be used
+template<class MatIdGetter>
+size_t ComputeMaterialBins(int faceCount, int numSubmtls, MatIdGetter matIds, std::vector<size_t>& offsets)
+{
+	offsets.assign(numSubmtls + 1, 0);
+	for (int i = 0; i < faceCount; ++i)
+		++offsets[matIds(i) % numSubmtls + 1];
+
+	for (int i = 0; i < numSubmtls; ++i)
+		offsets[i + 1] += offsets[i];
+
+	for (auto& offset : offsets)
+		offset *= 3;
+
+	return offsets.back();
+}
+
+/// Flattens vertices, normals and texture coordinates of the mesh and scatters its triangles into per-material-ID ranges
+/// of single index buffers (see SplitMesh). No per-material allocations are made.
+/// \param flipFaces if true, the U texture coordinate is mirrored (used for negative-parity transforms)
+void SplitMeshByMaterial(Mesh& mesh, MeshNormalSpec& normals, int numSubmtls, float masterScale, bool flipFaces, SplitMesh& out);
+
+/// Optional compaction stage: remaps each material's triangles to only the vertices, normals and texture coordinates they
+/// reference, welding bit-identical values. Shapes then no longer carry the attributes of the whole mesh.
+void CompactSplitMesh(SplitMesh& mesh);
+
+/// Creates one RPR shape per material ID of the split mesh. Material IDs without any triangles produce a null shape, so
+/// that the result always matches the array of materials created elsewhere.
+void CreateShapesFromSplitMesh(frw::Context& context, const SplitMeshView& mesh, std::vector<frw::Shape>& result);
+
+/// Render mesh of a scene node as returned by 3ds Max, together with its specified normals. Acquiring the mesh calls into
+/// the 3ds Max SDK, so Evaluate() must run on the main thread; once evaluated, the data may be read from any thread.
+class EvaluatedMesh
+{
+	Mesh* mMesh = nullptr;
+	MeshNormalSpec* mNormals = nullptr;
+	BOOL mNeedsDelete = FALSE; // If GetRenderMesh sets this to true, we will need to delete the mesh when we are done
+	std::unique_ptr<Mesh> mMeshCopy; // Used only if we need to copy the mesh when getting normals
+
+	EvaluatedMesh(const EvaluatedMesh&) = delete;
+	EvaluatedMesh& operator=(const EvaluatedMesh&) = delete;
+
+public:
+	EvaluatedMesh() = default;
+
+	~EvaluatedMesh()
+	{
+		Release();
+	}
+
+	/// Obtains the render mesh of the object and makes sure it has normals. Returns false if the object has no mesh.
+	/// \param directlyVisible receives the primary visibility of the node
+	bool Evaluate(INode* inode, Object* evaluatedObject, TimeValue t, View& view, bool& directlyVisible);
+
+	/// Frees the mesh if it was created for us
+	void Release();
+
+	inline bool IsValid() const
+	{
+		return mMesh != nullptr;
+	}
+
+	inline Mesh& GetMesh() const
+	{
+		return *mMesh;
+	}
+
+	inline MeshNormalSpec& GetNormals() const
+	{
+		return *mNormals;
+	}
+};
+
+/// A single mesh moving through the staged translation pipeline (see TranslateMeshes)
+struct MeshTranslationJob
+{
+	// input
+	INode* node = nullptr;
+	Object* object = nullptr;
+	int numSubmtls = 0;
+	bool flipFaces = false;
+
+	// output; jobs which already have shapes (e.g. found in a cache) are passed through untouched
+	std::vector<frw::Shape> shapes;
+	bool directlyVisible = true;
+	size_t meshFaces = 0;
+
+	// intermediate state, released as soon as the shapes are created
+	EvaluatedMesh evaluated;
+	SplitMesh split;
+	GeometryCacheFile cached; // open if the buffers were found in the geometry cache
+	SplitMeshView view; // buffers the shapes are created from, either in split or in cached
+	size_t bytesBefore = 0;
+	size_t bytesAfter = 0;
+};
+
+/// Time spent in each stage of the mesh translation pipeline
+struct MeshTranslationStats
+{
+	AccumulationTimer evaluate;
+	AccumulationTimer split;
+	AccumulationTimer create;
+	size_t meshes = 0;
+	size_t faces = 0;
+
+	/// Vertex attribute bytes passed to RPR, before and after compaction
+	size_t bytesBefore = 0;
+	size_t bytesAfter = 0;
+
+	/// Meshes loaded from and missing in the geometry cache
+	size_t cacheHits = 0;
+	size_t cacheMisses = 0;
+
+	/// Prints the timings to the debug output
+	void Report(const wchar_t* what) const;
+};
+
+/// Settings of the mesh translation pipeline. They are read on the main thread, before the worker threads start.
+struct MeshTranslationOptions
+{
+	/// Compact meshes (see CompactSplitMesh)
+	bool compact = false;
+
+	/// Folder of the persistent geometry cache; empty if the cache is disabled
+	std::wstring cacheFolder;
+};
+
+/// Reads the pipeline settings from the plugin settings file
+MeshTranslationOptions GetMeshTranslationOptions();
+
+/// Deletes the least recently used files of the geometry cache until it fits the GeometryCacheSize setting. This scans the
+/// whole cache folder, so it is called once per production render or ActiveShade session rather than per translation.
+void TrimGeometryCacheToSettings();
+
+/// Number of meshes which are evaluated before being handed over to worker threads. Bounds the number of render meshes
+/// kept alive at the same time.
+const int MeshTranslationBatchSize = 64;
+
+/// Translates a batch of meshes in three stages: 3ds Max evaluation on the calling (main) thread, flattening and material
+/// binning on OpenMP worker threads, and RPR shape creation on the calling thread again, in the order of the jobs.
+/// When the geometry cache is enabled, the worker threads look the meshes up by their content first and skip the flattening
+/// for meshes found there, while newly flattened meshes are written to the cache.
+void TranslateMeshes(frw::Context& context, float masterScale, TimeValue t, View& view, std::vector<MeshTranslationJob>& jobs,
+	MeshTranslationStats& stats, const MeshTranslationOptions& options);
+
+FIRERENDER_NAMESPACE_END;
@@ -14,12 +14,14 @@ limitations under the License.
 #pragma once
 
 #include "SceneParser.h"
+#include "MeshSplitter.h"
 #include "RenderParameters.h"
 #include "ParamBlock.h"
 #include "CamManager.h"
 #include "ScopeManager.h"
 #include "utils/Utils.h"
 #include "SceneCallbacks.h"
+#include "FRSettingsFileHandler.h"
 #include "CoronaDeclarations.h"
 #include "FireRenderStandardMtl.h"
 #include "FireRenderDisplacementMtl.h"
@@ -41,7 +43,9 @@ limitations under the License.
 
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <chrono>
+#include <cmath>
 
 #define USE_INSTANCES_ONLY false
 #define DEFAULT_LIGHT_ID 0x100000000
@@ -223,6 +227,7 @@ ParsedView SceneParser::ParseView()
 				float shutterOpenDuration = physicalCamera->GetShutterDurationInFrames(params.t, Interval());
 				output.motionBlurScale = shutterOpenDuration;
 				output.cameraExposure = shutterOpenDuration;
+				output.shutterOffset = physicalCamera->GetShutterOffsetInFrames(params.t, Interval());
 			}
 		}
 #endif
@@ -408,269 +413,19 @@ void SceneParser::traverseNode(INode* input, const bool processXRef, const Rende
 			auto tm = input->GetObjTMAfterWSM(parameters.t);
 			tm.SetTrans(tm.GetTrans() * masterScale);
 			output.push_back(ParsedNode(id, input, tm));
-			
-			Matrix3 ntmMotion = input->GetObjTMAfterWSM(parameters.t+1);
-			ntmMotion.SetTrans(ntmMotion.GetTrans() * masterScale);
-			output.back().tmMotion = ntmMotion;
-
-		}
-	}
-}
-
-
-bool createMesh(std::vector<frw::Shape>& result, bool& directlyVisible,
-	frw::Context& context,
-	float masterScale,
-	TimeValue timeValue, View& view,
-	INode* inode, Object* evaluatedObject, const int numSubmtls, size_t& meshFaces, bool flipFaces)
-{
-	Mesh* mesh = NULL;
-	BOOL needsDelete = FALSE; // If GetRenderMesh sets this to true, we will need to delete the mesh when we are done
-	Mesh dummyMeshCopy; // Used only if we need to copy the mesh when getting normals
-
-	// First, we try to obtain render mesh from the object
-
-	if (auto geomObject = dynamic_cast<GeomObject*>(evaluatedObject))
-	{
-		// expensive!
-		mesh = geomObject->GetRenderMesh(timeValue, inode, view, needsDelete);
-	}
-
-	directlyVisible = inode->GetPrimaryVisibility() != FALSE;
-	if (evaluatedObject->ClassID() == Corona::LIGHT_CID) {
-		if (ScopeManagerMax::CoronaOK)
-		{
-		// Corona lights require some special processing - we will get its mesh via function publishing interface.
-		// But when we have it, we can parse the mesh as any other geometry object, because we also handle their the lights 
-		// material specially in MaterialParser.
-		directlyVisible &= GetFromPb<bool>(evaluatedObject->GetParamBlockByID(0), Corona::L_DIRECTLY_VISIBLE);
-		BaseInterface* bi = evaluatedObject->GetInterface(Corona::IFIREMAX_LIGHT_INTERFACE);
-		Corona::IFireMaxLightInterface* lightInterface = dynamic_cast<Corona::IFireMaxLightInterface*>(bi);
-		if (lightInterface) {
-			lightInterface->fmGetRenderMesh(timeValue, mesh, needsDelete);
-		}
-		else {
-			MessageBox(GetCOREInterface()->GetMAXHWnd(), _T("Too old Corona version."), _T("Radeon ProRender warning"), MB_OK);
-		}
-		}
-	}
-
-	if (!mesh)  //nothing to do here
-		return false;
-
-	meshFaces = mesh->getNumFaces();
-	
-	// Next we try to get normals associated with the mesh
-	MeshNormalSpec* normals = nullptr;
-
-	// Handle normals: in case we need to delete the mesh, we are free to modify it, so we just do by calling SpecifyNormals()
-	if (needsDelete) {
-		mesh->SpecifyNormals();
-		normals = mesh->GetSpecifiedNormals();
-	}
-	else {
-		// Otherwise we will try to get the normals without modifying the mesh. We try it...
-		normals = mesh->GetSpecifiedNormals();
-		if (normals == NULL || normals->GetNumNormals() == 0) {
-			// ... and if it fails, we will have to copy the mesh, modify it by calling SpecifyNormals(), and get the normals 
-			// from the mesh copy
-			dummyMeshCopy = *mesh;
-			dummyMeshCopy.SpecifyNormals();
-			normals = dummyMeshCopy.GetSpecifiedNormals();
 		}
 	}
-	FASSERT(normals);
-	normals->CheckNormals();
-
-	// Copy all vertices, normals, and texture coordinates from 3ds Max to our buffers
-
-	Stack<Point3> v, n;				// all vertices, normals of the mesh
-	Stack<Stack<int>> vi, ni;		// materialID[vertex/normals[]]
-
-	Stack<Stack<Point3>> t;			// mapChannel[all texture coords of the mesh]
-	Stack<Stack<Stack<int>>> ti;	// mapChannel[materialID[texcoords[]]]
-
-	// Swap comment to enable SECONDARY UV CHANNEL
-	int numChannels = mesh->tVerts == NULL ? 0 : 1;
-
-	vi.resize(numSubmtls);
-	ni.resize(numSubmtls);
-	ti.resize(numChannels);
-	t.resize(numChannels);
-
-	for (int i = 0; i < numChannels; ++i)
-	{
-		ti[i].resize(numSubmtls);
-	}
-
-	v.resize(mesh->getNumVerts());
-	for (int i = 0; i < mesh->getNumVerts(); ++i)
-	{
-		v[i] = mesh->verts[i] * masterScale;
-	}
-
-	n.resize(normals->GetNumNormals());
-	for (int i = 0; i < normals->GetNumNormals(); ++i)
-	{
-		Point3 normal = normals->Normal(i);
-		n[i] = normal.Normalize();
-	}
-
-	const bool textured = mesh->tVerts != NULL;
-	for (int i = 0; i < numChannels; i++)
-	{
-		MeshMap& mapChannel = mesh->maps[i + 1]; // maps[0] is vertex color, leave it
-
-		if (textured) {
-			t[i].resize(mapChannel.vnum);
-
-			for (int j = 0; j < mapChannel.vnum; ++j) {
-				UVVert tv = mapChannel.tv[j];
-				if (flipFaces)
-					tv.x = 1.f - tv.x;
-				t[i][j] = tv;
-			}
-		}
-	}
-
-	// Now create triangle index arrays. We push each triangle into appropriate "bin" based on its material ID
-	int faceCount = mesh->getNumFaces();
-	if (faceCount != 0)
-	{
-		for (int i = 0; i < numSubmtls; ++i)
-		{
-			vi[i].reserve(faceCount * 3);
-			ni[i].reserve(faceCount * 3);
-
-			for (int j = 0; j < numChannels; ++j)
-			{
-				ti[j][i].reserve(faceCount * 3 * 3);
-			}
-		}
-	}
-
-    for (int i = 0; i < mesh->getNumFaces(); ++i) {
-        Face& face = mesh->faces[i];
-        const int mtlId = face.getMatID() % numSubmtls;
-        for (int j = 0; j < 3; ++j) {
-#ifdef SWITCH_AXES
-            int index = 0; // we swap 2 indices because we change parity via TM switch
-            if (j == 1) {
-                index = 2;
-            } else if (j == 2) {
-                index = 1;
-            }
-#else
-            const int index = j;
-#endif
-
-            vi[mtlId].push(face.getVert(index));
-            ni[mtlId].push(normals->GetNormalIndex(i, index));
-
-			for (int k = 0; k < numChannels; ++k)
-			{
-				MeshMap& mapChannel = mesh->maps[k + 1]; // maps[0] is vertex color, leave it
-				
-				if (textured) {
-					ti[k][mtlId].push(mapChannel.tf[i].t[index]);
-				}
-			}
-		}
-    }
-
-    // Create a dummy array holding numbers of vertices for each face (which is always "3" in our case)
-    int maxFaceCount = 0;
-    for (auto& i : vi) {
-        maxFaceCount = std::max(maxFaceCount, i.size() / 3);
-    }
-    Stack<int> vertNums;
-    vertNums.resize(maxFaceCount);
-    for (auto& i : vertNums) {
-        i = 3;
-    }
-
-    // Finally, create RPR rpr_shape objects.
-
-    for (int i = 0; i < numSubmtls; ++i)
-	{
-        if (vi[i].size() == 0)
-		{
-            // we still need to push something so the array of materials created elsewhere matches the array of shapes
-			result.push_back(frw::Shape());
-        }
-		else
-		{
-			auto currMeshFaces = vi[i].size() / 3;
-			
-			size_t texcoordsNum[2] = {0, 0};
-			rpr_int texcoordStride[2] = {0, 0};
-			rpr_int texcoordIdxStride[2] = {0, 0};
-
-			const rpr_float* texcoords[2] = {nullptr, nullptr};
-			const rpr_int* texcoordIndices[2] = {nullptr, nullptr};
-
-			if (mesh->numTVerts > 0)
-			{
-				for (int j = 0; j < numChannels; ++j)
-				{
-					const bool bPaddingVertices = true;
-
-					// Padding texture vertices
-					if (bPaddingVertices)
-					{
-						t[j].resize(mesh->numTVerts);
-						texcoordsNum[j] = mesh->numTVerts;
-					}
-					else
-					{
-						texcoordsNum[j] = mesh->maps[j + 1].vnum;
-					}
-
-					texcoords[j] = t[j][0];
-					texcoordIndices[j] = &ti[j][i][0];
-					texcoordStride[j] = sizeof(Point3);
-					texcoordIdxStride[j] = sizeof(rpr_int);
-				}
-			}
-
-			auto shape = context.CreateMeshEx(
-				v[0], v.size(), sizeof(v[0]),
-				n[0], n.size(), sizeof(n[0]),
-				nullptr, 0, 0,
-				numChannels, texcoords, texcoordsNum, texcoordStride,
-				&vi[i][0], sizeof(vi[i][0]),
-				&ni[i][0], sizeof(ni[i][0]),
-				texcoordIndices, texcoordIdxStride,
-				&vertNums[0],
-				currMeshFaces);
-
-			result.push_back(shape);
-        }
-    }
-
-	if (needsDelete) {
-		mesh->DeleteThis();
-	}
-
-	return true;
 }
 
 
-/// Parses a single mesh object. Outputs a list of shapes because the mesh can have multiple material IDs, which RPR cannot 
-/// handle in single shape
+/// Builds the key under which shapes of a mesh are stored in the scope shape set cache
 /// \param inode Scene node where the mesh was encountered
 /// \param evaluatedObject result of calling EvalWorldState on inode
 /// \param numSubmtls Number of submaterials that the node material holds. If it is more than 1 (it uses multi-material) and the 
 ///                   mesh has multiple material IDs, we will have to create multiple shapes.
-std::vector<frw::Shape> SceneParser::parseMesh(INode* inode, Object* evaluatedObject, const int numSubmtls, size_t& meshFaces, bool flipFaces)
+HashValue SceneParser::GetMeshKey(INode* inode, Object* evaluatedObject, const int numSubmtls, bool flipFaces)
 {
-	meshFaces = 0;
-	std::vector<frw::Shape> result;
-	if (!evaluatedObject)
-		return result;
-
-	auto context = scope.GetContext();
-    FASSERT(evaluatedObject != NULL && inode != NULL);
+	FASSERT(evaluatedObject != NULL && inode != NULL);
 
 	HashValue key;
 
@@ -680,11 +435,10 @@ std::vector<frw::Shape> SceneParser::parseMesh(INode* inode, Object* evaluatedOb
 	evaluatedObject->GetDeformBBox(params.t, bbox);
 	key << bbox;
 
-		// hopefully we can get this info
+	// hopefully we can get this info
 	int numFaces = 0, numVerts = 0;
 	if (evaluatedObject->PolygonCount(params.t, numFaces, numVerts))
 	{
-		meshFaces = numFaces;
 		key << numFaces << numVerts;
 	}
 	else
@@ -692,23 +446,7 @@ std::vector<frw::Shape> SceneParser::parseMesh(INode* inode, Object* evaluatedOb
 		DebugPrint(L"no face count\n");
 	}
 
-	result = scope.GetShapeSet(key);
-	if (!result.empty())
-		return result;
-
-	bool directlyVisible ;
-	if(!createMesh(result, directlyVisible,
-		context, masterScale,
-		params.t, const_cast<FireRenderView&>(params.view), inode, evaluatedObject, numSubmtls, meshFaces, flipFaces))
-		return std::vector<frw::Shape>();
-
-	for(auto& shape: result){
-		if (!directlyVisible)
-			shape.SetVisibility(false);
-	}
-
-	scope.SetShapeSet(key, result);
-    return result;
+	return key;
 }
 
 ParsedNode::ParsedNode(size_t id, INode* node, const Matrix3& tm): node(node), id(id), tm(tm)
@@ -841,44 +579,142 @@ void applyMotion(frw::Shape& shape, Motion motion){
 		shape.SetAngularMotion(1.0f, 0.0f, 0.0f, 0.0f);
 }
 
-Motion getMotion(const ParsedView& view, const ParsedNode& parsedNode){
-	//motion blur
-	float dtInverse = SecToTicks(1.0f);
-	//compute camera-space transforms for current frame and next one
-	//taking into account camera motion too
-	//then compute delta rotation and translatio9n in CAMERA space
-	//so that linear and angular motion set for each object will be
-	//relative to camera motion(e.g. still objects for moving camera 
-	//would be motion-blurred)
-	Matrix3 toView = InverseHighPrecision(view.tm);
-	Matrix3 toViewAndBack = view.tm*toView;
-	Matrix3 tmCamSpace = parsedNode.tm*toView;
-	Quat rotationCamSpace(tmCamSpace);
-
-	Matrix3 toViewMotion = InverseHighPrecision(view.tmMotion);
-	Matrix3 tmCamSpaceMotion = parsedNode.tmMotion*toViewMotion;
-	Quat rotationCamSpaceMotion(tmCamSpaceMotion);
-
-	//extract motion in cameraspace
-	Point3 axisDeltaCamSpace;
-	float angleDeltaCamSpace = QangAxis(rotationCamSpace, rotationCamSpaceMotion, axisDeltaCamSpace);
-	Point3 velocityCamSpace = (tmCamSpaceMotion.GetTrans()-tmCamSpace.GetTrans());
-
-	//transform these back to worls space, where FR expects it 
-	Point3 velocity = view.tm.VectorTransform(velocityCamSpace)*dtInverse;
-	float momentumAngle = angleDeltaCamSpace*dtInverse;
-	Point3 momentumAxis = view.tm.VectorTransform(axisDeltaCamSpace);
-
-	float motionBlurScale = view.motionBlurScale;
-	momentumAngle *= motionBlurScale*0.01f;
-	velocity *= motionBlurScale*0.01f;
-
-	Motion result;
-	result.velocity = velocity;
-	result.momentumAngle = momentumAngle;
-	result.momentumAxis = momentumAxis;
+namespace
+{
+	// Upper bound of MotionBlurSamples
+	const int MaxMotionSamples = 64;
 
-	return result;
+	// Bound of the shutter interval, in frames. The camera exposure spinner accepts any float, and larger values would
+	// overflow TimeValue when converted to ticks.
+	const float MaxShutterFrames = 4.f;
+
+	float ClampShutterFrames(float frames, float lower)
+	{
+		if (std::isnan(frames))
+			return 0.f;
+		return std::min(std::max(frames, lower), MaxShutterFrames);
+	}
+
+	int GetMotionSampleCount()
+	{
+		const int samples = std::atoi(FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::MotionBlurSamples).c_str());
+		return std::min(std::max(samples, 2), MaxMotionSamples);
+	}
+}
+
+int ParsedMotion::Find(size_t id) const
+{
+	auto it = std::lower_bound(ids.begin(), ids.end(), id);
+	if (it == ids.end() || *it != id)
+		return -1;
+	return int(it - ids.begin());
+}
+
+void SceneParser::ComputeMotion(const std::map<AnimHandle, ParsedNode>& nodes, ParsedMotion& motion)
+{
+	const int numSamples = GetMotionSampleCount();
+
+	// Both paths start sampling when the shutter opens. Two samples measure the velocity over a single tick, more samples
+	// are spread until the shutter closes.
+	const TimeValue shutterOpen = params.t + TimeValue(ClampShutterFrames(view.shutterOffset, -MaxShutterFrames) * GetTicksPerFrame());
+	const TimeValue shutterTicks = TimeValue(ClampShutterFrames(view.cameraExposure, 0.f) * GetTicksPerFrame());
+	const TimeValue span = numSamples > 2 ? std::max(shutterTicks, TimeValue(numSamples - 1)) : 1;
+
+	std::vector<TimeValue> times(numSamples);
+	for (int k = 0; k < numSamples; ++k)
+		times[k] = shutterOpen + (span * k) / (numSamples - 1);
+
+	//compute camera-space transforms for all samples, taking into account camera motion too,
+	//so that linear and angular motion set for each object will be relative to camera motion
+	//(e.g. still objects for moving camera would be motion-blurred)
+	std::vector<Matrix3> toView(numSamples);
+	for (int k = 0; k < numSamples; ++k)
+	{
+		Matrix3 camTransform = view.tm;
+		if (params.viewNode)
+		{
+			camTransform = params.viewNode->GetObjTMAfterWSM(times[k]);
+			camTransform.SetTrans(camTransform.GetTrans() * masterScale);
+		}
+		toView[k] = InverseHighPrecision(camTransform);
+	}
+
+	// Each distinct node is sampled once. Samples are stored relative to the current transform, so that scattered copies of
+	// a node, which have their own transforms, follow the motion of the node.
+	std::unordered_map<INode*, int> sampledNodes;
+	std::vector<Matrix3> relativeSamples;
+	std::vector<int> sampleOffsets;
+	std::vector<const Matrix3*> transforms;
+
+	motion = ParsedMotion();
+	motion.ids.reserve(nodes.size());
+	sampleOffsets.reserve(nodes.size());
+	transforms.reserve(nodes.size());
+
+	for (auto& it : nodes)
+	{
+		const ParsedNode& parsedNode = it.second;
+
+		auto sampled = sampledNodes.emplace(parsedNode.node, int_cast(relativeSamples.size()));
+		if (sampled.second)
+		{
+			Matrix3 current = parsedNode.node->GetObjTMAfterWSM(times[0]);
+			current.SetTrans(current.GetTrans() * masterScale);
+			const Matrix3 toCurrent = InverseHighPrecision(current);
+
+			for (int k = 0; k < numSamples; ++k)
+			{
+				Matrix3 tm = parsedNode.node->GetObjTMAfterWSM(times[k]);
+				tm.SetTrans(tm.GetTrans() * masterScale);
+				relativeSamples.push_back(tm * toCurrent);
+			}
+		}
+
+		motion.ids.push_back(it.first);
+		sampleOffsets.push_back(sampled.first->second);
+		transforms.push_back(&parsedNode.tm);
+	}
+
+	const int count = int_cast(motion.ids.size());
+	motion.velocities.resize(count);
+	motion.axes.resize(count);
+	motion.angles.resize(count);
+
+	const float dtInverse = float(SecToTicks(1.0f)) / float(span);
+	const float motionBlurScale = view.motionBlurScale * 0.01f;
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; ++i)
+	{
+		const Matrix3* relative = &relativeSamples[sampleOffsets[i]];
+
+		Matrix3 tmCamSpaceFirst = (relative[0] * *transforms[i]) * toView[0];
+		Matrix3 tmCamSpaceLast = tmCamSpaceFirst;
+		Quat rotationCamSpace(tmCamSpaceFirst);
+
+		//extract motion in cameraspace: the rotation is accumulated sample by sample, so that it may exceed half a turn
+		Point3 rotationDelta(0.f, 0.f, 0.f);
+		for (int k = 1; k < numSamples; ++k)
+		{
+			tmCamSpaceLast = (relative[k] * *transforms[i]) * toView[k];
+			Quat rotationCamSpaceMotion(tmCamSpaceLast);
+
+			Point3 axisDeltaCamSpace;
+			float angleDeltaCamSpace = QangAxis(rotationCamSpace, rotationCamSpaceMotion, axisDeltaCamSpace);
+			rotationDelta += axisDeltaCamSpace * angleDeltaCamSpace;
+
+			rotationCamSpace = rotationCamSpaceMotion;
+		}
+
+		const float angleDeltaCamSpace = Length(rotationDelta);
+		const Point3 axisDeltaCamSpace = angleDeltaCamSpace > 0.f ? rotationDelta / angleDeltaCamSpace : Point3(0.f, 0.f, 0.f);
+		const Point3 velocityCamSpace = tmCamSpaceLast.GetTrans() - tmCamSpaceFirst.GetTrans();
+
+		//transform these back to world space, where FR expects it 
+		motion.velocities[i] = view.tm.VectorTransform(velocityCamSpace) * dtInverse * motionBlurScale;
+		motion.angles[i] = angleDeltaCamSpace * dtInverse * motionBlurScale;
+		motion.axes[i] = view.tm.VectorTransform(axisDeltaCamSpace);
+	}
 }
 
 void SetNameFromNode(INode* node, frw::Object& obj){
@@ -896,9 +732,22 @@ void SceneParser::AddParsedNodes(const ParsedNodes& parsedNodes)
 
     std::map<AnimHandle, ParsedNodes> instances;
 
+	// Scatter systems report the same geometry node once per scattered copy, only with a different transform. Such nodes are
+	// evaluated only the first time they are seen.
+	std::unordered_map<INode*, AnimHandle> geometryNodes;
+
 	for (auto& actual : parsedNodes) 
 	{
         FASSERT(actual.node);
+
+		auto known = geometryNodes.find(actual.node);
+		if (known != geometryNodes.end())
+		{
+			if (GetDeterminant(actual.tm) != 0.f)
+				instances[known->second].push_back(actual);
+			continue;
+		}
+
         Object* objRef = actual.node->GetObjectRef();
         if (!objRef || !actual.node->Renderable()) {
             continue;
@@ -913,17 +762,9 @@ void SceneParser::AddParsedNodes(const ParsedNodes& parsedNodes)
         const ObjectState& state = actual.node->EvalWorldState(params.t);
         const SClass_ID sClassId = state.obj->SuperClassID();
         const Class_ID classId = state.obj->ClassID();
-		
-		Matrix3 ntm = actual.node->GetObjTMAfterWSM(params.t);
-		ntm.SetTrans(ntm.GetTrans() * masterScale);
-		// incapsulate matrix retrieval with masterScale multiply?
-		Matrix3 ntmMotion = actual.node->GetObjTMAfterWSM(params.t+1);
-		ntmMotion.SetTrans(ntmMotion.GetTrans() * masterScale);
 
         const auto& tm = actual.tm;
 
-		Matrix3 tmMotion = ntmMotion;
-
 		if (!actual.node->GetVisibility(params.t))
 		{
 			// ignore invisible here (don't add it)
@@ -957,12 +798,17 @@ void SceneParser::AddParsedNodes(const ParsedNodes& parsedNodes)
 		}
 		else if (classId == Corona::LIGHT_CID || sClassId == GEOMOBJECT_CLASS_ID || state.obj->CanConvertToType(triObjectClassID) != FALSE)
 		{
-            if (!state.obj->IsRenderable() || GetDeterminant(tm) == 0.f) {
-                continue; // ignore zero-scale/degenerated TM objects (which will have determinant 0)
+            if (!state.obj->IsRenderable()) {
+                continue;
             }
             auto handle = Animatable::GetHandleByAnim(state.obj);
 
-			const_cast<FireRender::ParsedNode*>(&actual)->tmMotion = tmMotion;
+			geometryNodes.emplace(actual.node, handle);
+
+            if (GetDeterminant(tm) == 0.f) {
+                continue; // ignore zero-scale/degenerated TM objects (which will have determinant 0)
+            }
+
             instances[handle].push_back(actual);
         }
     }
@@ -971,223 +817,309 @@ void SceneParser::AddParsedNodes(const ParsedNodes& parsedNodes)
 	wchar_t tempStr[1024];
 	int i = 1;
 
-    // Finally, we process the geometry
-    for (auto& instance : instances)  // iterate over groups of all different objects. All nodes withing each group will be instanced
-	{
-		wsprintf(tempStr, L"Synchronizing: Rebuilding Object %d of %d (%s)", i++, numInstances, (instance.second.begin())->node->GetName());
-		if (params.progress)
-			params.progress->SetTitle(tempStr);
+	auto context = scope.GetContext();
+	MeshTranslationStats stats;
+	const MeshTranslationOptions options = GetMeshTranslationOptions();
 
-		const auto& nodes = instance.second;
-		
-        // determine the maximal number of sub-materials
+	std::vector<const ParsedNodes*> groups;
+	groups.reserve(instances.size());
+	for (auto& instance : instances)
+		groups.push_back(&instance.second);
 
-        int numMtls = 0; 
-        for (auto& parsedNode : nodes) 
-            numMtls = std::max(numMtls, int_cast(parsedNode.GetAllMaterials(params.t).size()) );
+	// Finally, we process the geometry. Groups of all different objects are translated in batches: meshes are evaluated here,
+	// flattened on worker threads, and the resulting shapes are attached in order. All nodes within each group will be instanced
+	for (size_t batchStart = 0; batchStart < groups.size(); batchStart += MeshTranslationBatchSize)
+	{
+		const size_t batchSize = std::min(groups.size() - batchStart, size_t(MeshTranslationBatchSize));
+		std::vector<MeshTranslationJob> jobs(batchSize);
+		std::vector<HashValue> keys(batchSize);
 
-        // Evaluate the mesh of first node in the group
+		for (size_t j = 0; j < batchSize; ++j)
+		{
+			const auto& nodes = *groups[batchStart + j];
+			auto& job = jobs[j];
 
-        auto firstNode = &*nodes.begin();
-        const ObjectState& state = firstNode->node->EvalWorldState(params.t);
-		size_t currMeshFaces = 0;
-		BOOL parity = firstNode->tm.Parity();
+			// determine the maximal number of sub-materials
+			int numMtls = 0;
+			for (auto& parsedNode : nodes)
+				numMtls = std::max(numMtls, int_cast(parsedNode.GetAllMaterials(params.t).size()));
 
-        auto originalShapes = parseMesh(firstNode->node, state.obj, numMtls, currMeshFaces, !!parity);
-		if (originalShapes.size() == 0)
-			continue; // evaluating the object yielded no faces - e.g. the object was empty
+			// Evaluate the mesh of first node in the group
+			auto firstNode = &*nodes.begin();
+			const ObjectState& state = firstNode->node->EvalWorldState(params.t);
 
-		if (USE_INSTANCES_ONLY)
-		{
-			for (auto it = originalShapes.begin(); it != originalShapes.end(); ++it)
+			job.node = firstNode->node;
+			job.object = state.obj;
+			job.numSubmtls = numMtls;
+			job.flipFaces = !!firstNode->tm.Parity();
+
+			if (job.object)
 			{
-				scene.Attach(*it);
-				(*it).SetVisibility(false);
+				keys[j] = GetMeshKey(job.node, job.object, numMtls, job.flipFaces);
+				job.shapes = scope.GetShapeSet(keys[j]);
 			}
 		}
 
-		FASSERT(originalShapes.size() == numMtls);
+		TranslateMeshes(context, masterScale, params.t, const_cast<FireRenderView&>(params.view), jobs, stats, options);
+
+		for (size_t j = 0; j < batchSize; ++j)
+		{
+			const auto& nodes = *groups[batchStart + j];
+			auto& job = jobs[j];
+
+			wsprintf(tempStr, L"Synchronizing: Rebuilding Object %d of %d (%s)", i++, numInstances, nodes.begin()->node->GetName());
+			if (params.progress)
+				params.progress->SetTitle(tempStr);
+
+			if (job.shapes.empty())
+				continue; // evaluating the object yielded no faces - e.g. the object was empty
+
+			scope.SetShapeSet(keys[j], job.shapes);
+			AddInstances(nodes, job.shapes, job.numSubmtls);
+		}
+	}
+
+	stats.Report(L"AddParsedNodes");
+}
+
+struct SceneParser::PrototypeState
+{
+	/// State of the shape of a single material ID
+	struct Shape
+	{
+		Mtl* mtl = nullptr;
+
+		bool castsShadows = true;
+		bool shadowCatcher = false;
+
+		// displacement set up by UberV3 material
+		bool uberDisplacement = false;
+		RprDisplacementParams uberDisplacementParams;
+		frw::Camera camera;
+		frw::FrameBuffer frameBuffer;
+
+		// displacement map
+		frw::Value displImageNode;
+		float minHeight = 0.f;
+		float maxHeight = 0.f;
+		float subdivision = 0.f;
+		float creaseWeight = 0.f;
+		int boundary = RPR_SUBDIV_BOUNDARY_INTERFOP_TYPE_EDGE_AND_CORNER;
+		bool notAccurate = false;
+
+		frw::Shader volumeShader;
+		frw::Shader shader;
+	};
+
+	std::vector<Shape> shapes; // one per mtl ID
+	std::string name;
+};
+
+void SceneParser::ResolvePrototypeState(const ParsedNode& parsedNode, const std::vector<frw::Shape>& originalShapes, 
+	PrototypeState& state)
+{
+	const size_t numMtls = originalShapes.size();
+	const auto& nodeMtls = parsedNode.GetAllMaterials(params.t);
+
+	std::wstring name = parsedNode.node->GetName();
+	state.name = std::string(name.begin(), name.end());
+	state.shapes.resize(numMtls);
+
+	for (size_t i = 0; i < numMtls; ++i)
+	{
+		if (!originalShapes[i])
+			continue;
+
+		auto& ss = state.shapes[i];
+		Mtl* currentMtl = nodeMtls[std::min(i, nodeMtls.size() - 1)];
+		ss.mtl = currentMtl;
 
-        for (auto& parsedNode : nodes) 
-		{ // iterate over all instances inside the group
-            std::vector<frw::Shape> shapes;
-            // For the first instance we directly reuse the parsed shapes, for subsequent ones we use instances
-            if (USE_INSTANCES_ONLY || &parsedNode != firstNode)
+		// Handling of some special flags for Corona Material is necessary here at geometry level
+		if (currentMtl == DISABLED_MATERIAL)
+		{
+		}
+		else if (currentMtl && currentMtl->ClassID() == Corona::MTL_CID) 
+		{
+			if (ScopeManagerMax::CoronaOK)
 			{
-                for (int i = 0; i < numMtls; ++i) 
+				IParamBlock2* pb = currentMtl->GetParamBlock(0);
+				const bool useCaustics = GetFromPb<bool>(pb, Corona::MTLP_USE_CAUSTICS, this->params.t);
+				const float lRefract = GetFromPb<float>(pb, Corona::MTLP_LEVEL_REFRACT, this->params.t);
+				const float lOpacity = GetFromPb<float>(pb, Corona::MTLP_LEVEL_OPACITY, this->params.t);
+
+				//~mc hide for now as we have a flag for shadows and caustics
+				if ((lRefract > 0.f || lOpacity < 1.f) && !useCaustics)
 				{
-                    if (originalShapes[i]) 
-					{
-						auto shape = originalShapes[i].CreateInstance(scope);
-						shapes.push_back(shape);
-                    } 
-					else 
-					{
-						shapes.push_back(frw::Shape());
-                    }
-                }
-            } 
-			else 
+					ss.castsShadows = false;
+				}
+			}
+		}
+		else if (currentMtl && currentMtl->ClassID() == FIRERENDER_MATERIALMTL_CID) 
+		{
+			IParamBlock2* pb = currentMtl->GetParamBlock(0);
+			ss.castsShadows = bool_cast( GetFromPb<BOOL>(pb, FRMaterialMtl_CAUSTICS, this->params.t) );
+			ss.shadowCatcher = bool_cast( GetFromPb<BOOL>(pb, FRMaterialMtl_SHADOWCATCHER, this->params.t) );
+		}
+		else if (currentMtl && currentMtl->ClassID() == FIRERENDER_UBERMTL_CID)
+		{
+			IParamBlock2* pb = currentMtl->GetParamBlock(0);
+			ss.castsShadows = bool_cast( GetFromPb<BOOL>(pb, FRUBERMTL_FRUBERCAUSTICS, this->params.t) );
+			ss.shadowCatcher = bool_cast( GetFromPb<BOOL>(pb, FRUBERMTL_FRUBERSHADOWCATCHER, this->params.t) );
+		}
+		else if (currentMtl && currentMtl->ClassID() == FIRERENDER_UBERMTLV3_CID)
+		{
+			FireRenderUberMtlv3* mtl = dynamic_cast<FireRenderUberMtlv3*>(currentMtl);
+			mtl->GetDisplacement(ss.uberDisplacement, ss.uberDisplacementParams);
+
+			if (ss.uberDisplacement && ss.uberDisplacementParams.subdivType == Adaptive)
 			{
-                shapes = originalShapes;
-            }
+				ss.camera = scope.GetScene().GetCamera();
+				ss.frameBuffer = scope.GetFrameBuffer(RPR_AOV_COLOR);
+			}
+		}
+		else if (currentMtl && currentMtl->ClassID() == Corona::SHADOW_CATCHER_MTL_CID)
+		{
+			if (ScopeManagerMax::CoronaOK)
+				ss.shadowCatcher = true;
+		}
+		else if (currentMtl && currentMtl->ClassID() == FIRERENDER_SCMTL_CID) // Shadow Catcher Material
+		{
+			ss.shadowCatcher = true;
+		}
 
+		if (currentMtl != DISABLED_MATERIAL)
+		{
+			ss.displImageNode = FRMTLCLASSNAME(DisplacementMtl)::translateDisplacement(this->params.t, mtlParser, currentMtl,
+				ss.minHeight, ss.maxHeight, ss.subdivision, ss.creaseWeight, ss.boundary, ss.notAccurate);
 
-			//motion blur
-			Motion motion = getMotion(view, parsedNode);
+			ss.volumeShader = mtlParser.findVolumeMaterial(currentMtl);
+		}
 
-            const auto& nodeMtls = parsedNode.GetAllMaterials(params.t);
-            FASSERT(numMtls == shapes.size());
+		if (currentMtl == DISABLED_MATERIAL)
+		{
+			ss.shader = frw::DiffuseShader(mtlParser.materialSystem);
+			ss.shader.SetValue(RPR_MATERIAL_INPUT_COLOR, frw::Value(0.f));
+		}
+		else
+		{
+			ss.shader = mtlParser.createShader(currentMtl, parsedNode.node, parsedNode.invalidationTimestamp != 0);
 
-            // now go over all mtl IDs, set transforms and materials for shapes and handle special cases
-			for (size_t i = 0; i < numMtls; ++i)
-			{
-				if (auto shape = shapes[i])
-				{
-					shape.SetTransform(parsedNode.tm);
-					shape.SetUserData(parsedNode.id);
+#if PROFILING > 0
+			if (ss.shader)
+				profilingData.shadersNum++;
+#endif
+		}
+	}
+}
 
-					Mtl* currentMtl = nodeMtls[std::min(i, nodeMtls.size() - 1)];
+void SceneParser::AddInstances(const ParsedNodes& nodes, const std::vector<frw::Shape>& originalShapes, int numMtls)
+{
+	auto firstNode = &*nodes.begin();
 
-					float minHeight = 0.f;
-					float maxHeight = 0.0f;
-					float subdivision = 0.f;
-					float creaseWeight = 0.f;
-					int boundary = RPR_SUBDIV_BOUNDARY_INTERFOP_TYPE_EDGE_AND_CORNER;
-                
-					bool shadowCatcher = false;
-					bool castsShadows = true;
-					
-					// Handling of some special flags for Corona Material is necessary here at geometry level
-					if (currentMtl == DISABLED_MATERIAL)
-					{
-					}
-					else if (currentMtl && currentMtl->ClassID() == Corona::MTL_CID) 
-					{
-						if (ScopeManagerMax::CoronaOK)
-						{
-							IParamBlock2* pb = currentMtl->GetParamBlock(0);
-							const bool useCaustics = GetFromPb<bool>(pb, Corona::MTLP_USE_CAUSTICS, this->params.t);
-							const float lRefract = GetFromPb<float>(pb, Corona::MTLP_LEVEL_REFRACT, this->params.t);
-							const float lOpacity = GetFromPb<float>(pb, Corona::MTLP_LEVEL_OPACITY, this->params.t);
-
-							//~mc hide for now as we have a flag for shadows and caustics
-							if ((lRefract > 0.f || lOpacity < 1.f) && !useCaustics)
-							{
-								castsShadows = false;
-							}
-					}
-					}
-					else if (currentMtl && currentMtl->ClassID() == FIRERENDER_MATERIALMTL_CID) 
-					{
-						IParamBlock2* pb = currentMtl->GetParamBlock(0);
-						castsShadows = bool_cast( GetFromPb<BOOL>(pb, FRMaterialMtl_CAUSTICS, this->params.t) );
-						shadowCatcher = bool_cast( GetFromPb<BOOL>(pb, FRMaterialMtl_SHADOWCATCHER, this->params.t) );
-					}
-					else if (currentMtl && currentMtl->ClassID() == FIRERENDER_UBERMTL_CID)
-					{
-						IParamBlock2* pb = currentMtl->GetParamBlock(0);
-						castsShadows = bool_cast( GetFromPb<BOOL>(pb, FRUBERMTL_FRUBERCAUSTICS, this->params.t) );
-						shadowCatcher = bool_cast( GetFromPb<BOOL>(pb, FRUBERMTL_FRUBERSHADOWCATCHER, this->params.t) );
-					}
-					else if (currentMtl && currentMtl->ClassID() == FIRERENDER_UBERMTLV3_CID)
-					{
-						FireRenderUberMtlv3* mtl = dynamic_cast<FireRenderUberMtlv3*>(currentMtl);
-						bool isEnabled = false;
-						RprDisplacementParams displacementParams;
-						
-						mtl->GetDisplacement(isEnabled, displacementParams);
+	if (USE_INSTANCES_ONLY)
+	{
+		for (auto shape : originalShapes)
+		{
+			scene.Attach(shape);
+			shape.SetVisibility(false);
+		}
+	}
 
-						if (isEnabled)
-						{
-							rpr_int res = rprShapeSetDisplacementScale(shape.Handle(), displacementParams.min, displacementParams.max);
-							FCHECK(res);
-
-							if (displacementParams.subdivType == Adaptive)
-							{
-								frw::Context ctx = scope.GetContext();
-								frw::Scene scn = scope.GetScene();
-								frw::Camera cam = scn.GetCamera();
-								frw::FrameBuffer fbuf = scope.GetFrameBuffer(RPR_AOV_COLOR);
-								shape.SetAdaptiveSubdivisionFactor(displacementParams.adaptiveSubDivFactor, cam.Handle(), fbuf.Handle());
-							}
-							else
-							{
-								shape.SetSubdivisionFactor(displacementParams.factor);
-							}
-							shape.SetSubdivisionCreaseWeight(displacementParams.creaseWeight);
-							shape.SetSubdivisionBoundaryInterop(displacementParams.boundaryInteropType);
-						}
-					}
-					else if (currentMtl && currentMtl->ClassID() == Corona::SHADOW_CATCHER_MTL_CID)
-					{
-						if (ScopeManagerMax::CoronaOK)
-							shadowCatcher = true;
-					}
-					else if (currentMtl && currentMtl->ClassID() == FIRERENDER_SCMTL_CID) // Shadow Catcher Material
-					{
-						shadowCatcher = true;
-					}
+	FASSERT(originalShapes.size() == numMtls);
 
-					frw::Value displImageNode;
-					bool notAccurate = false;
+	// Scatter systems report the same node once per scattered copy. Everything which doesn't depend on the transform is 
+	// resolved only once per node, the copies then differ only by their transforms.
+	std::unordered_map<INode*, PrototypeState> prototypes;
 
-					if (currentMtl != DISABLED_MATERIAL)
-					{
-						displImageNode = FRMTLCLASSNAME(DisplacementMtl)::translateDisplacement(this->params.t, mtlParser, currentMtl,
-							minHeight, maxHeight, subdivision, creaseWeight, boundary, notAccurate);
-					}
+	std::vector<const ParsedNode*> instances;
+	instances.reserve(nodes.size());
+	for (auto& parsedNode : nodes)
+		instances.push_back(&parsedNode);
 
-					if (displImageNode && shape.IsUVCoordinatesSet())
-					{
-						if (notAccurate)
-						{
-							hasDirectDisplacements = true;
-						}
+	const int numInstances = int_cast(instances.size());
 
-						shape.SetDisplacement(displImageNode, minHeight, maxHeight);
-						shape.SetSubdivisionFactor(subdivision);
-						shape.SetSubdivisionCreaseWeight(creaseWeight);
-						shape.SetSubdivisionBoundaryInterop(boundary);
-					}
-					else
-					{
-						shape.RemoveDisplacement();
-					}
+	std::vector<frw::Shape> shapes(numMtls);
 
-					shape.SetShadowFlag(castsShadows);
-					shape.SetShadowCatcherFlag(shadowCatcher);
+	for (int j = 0; j < numInstances; ++j)
+	{ // iterate over all instances inside the group
+		const ParsedNode& parsedNode = *instances[j];
 
-					frw::Shader volumeShader;
+		auto prototype = prototypes.find(parsedNode.node);
+		if (prototype == prototypes.end())
+		{
+			prototype = prototypes.emplace(parsedNode.node, PrototypeState()).first;
+			ResolvePrototypeState(parsedNode, originalShapes, prototype->second);
+		}
+		const PrototypeState& state = prototype->second;
 
-					if (currentMtl != DISABLED_MATERIAL)
-						volumeShader = mtlParser.findVolumeMaterial(currentMtl);
+		// For the first instance we directly reuse the parsed shapes, for subsequent ones we use instances
+		for (int i = 0; i < numMtls; ++i)
+		{
+			if (originalShapes[i] && (USE_INSTANCES_ONLY || &parsedNode != firstNode))
+				shapes[i] = originalShapes[i].CreateInstance(scope);
+			else
+				shapes[i] = originalShapes[i];
+		}
 
-					if (volumeShader)
-						shape.SetVolumeShader(volumeShader);
+		// now go over all mtl IDs, set transforms and materials for shapes and handle special cases
+		for (size_t i = 0; i < numMtls; ++i)
+		{
+			auto shape = shapes[i];
+			if (!shape)
+				continue;
 
-					if (currentMtl == DISABLED_MATERIAL)
-					{
-						auto diffuse = frw::DiffuseShader(mtlParser.materialSystem);
-						diffuse.SetValue(RPR_MATERIAL_INPUT_COLOR, frw::Value(0.f));
-						shape.SetShader(diffuse);
-					}
-					else if (auto shader = mtlParser.createShader(currentMtl, parsedNode.node, parsedNode.invalidationTimestamp != 0))
-					{
-						shape.SetShader(shader);
+			const auto& ss = state.shapes[i];
 
-#if PROFILING > 0
-						profilingData.shadersNum++;
-#endif
-					}
+			shape.SetTransform(parsedNode.tm);
+			shape.SetUserData(parsedNode.id);
 
-					SetNameFromNode(parsedNode.node, shape);
+			if (ss.uberDisplacement)
+			{
+				const RprDisplacementParams& displacementParams = ss.uberDisplacementParams;
 
-					scene.Attach(shape);
+				rpr_int res = rprShapeSetDisplacementScale(shape.Handle(), displacementParams.min, displacementParams.max);
+				FCHECK(res);
+
+				if (displacementParams.subdivType == Adaptive)
+					shape.SetAdaptiveSubdivisionFactor(displacementParams.adaptiveSubDivFactor, ss.camera.Handle(), ss.frameBuffer.Handle());
+				else
+					shape.SetSubdivisionFactor(displacementParams.factor);
+
+				shape.SetSubdivisionCreaseWeight(displacementParams.creaseWeight);
+				shape.SetSubdivisionBoundaryInterop(displacementParams.boundaryInteropType);
+			}
+
+			if (ss.displImageNode && shape.IsUVCoordinatesSet())
+			{
+				if (ss.notAccurate)
+				{
+					hasDirectDisplacements = true;
 				}
+
+				shape.SetDisplacement(ss.displImageNode, ss.minHeight, ss.maxHeight);
+				shape.SetSubdivisionFactor(ss.subdivision);
+				shape.SetSubdivisionCreaseWeight(ss.creaseWeight);
+				shape.SetSubdivisionBoundaryInterop(ss.boundary);
 			}
-        }
-    }
+			else
+			{
+				shape.RemoveDisplacement();
+			}
+
+			shape.SetShadowFlag(ss.castsShadows);
+			shape.SetShadowCatcherFlag(ss.shadowCatcher);
+
+			if (ss.volumeShader)
+				shape.SetVolumeShader(ss.volumeShader);
+
+			if (ss.shader)
+				shape.SetShader(ss.shader);
+
+			shape.SetName(state.name.c_str());
+
+			scene.Attach(shape);
+		}
+	}
 }
 
 HashValue SceneParser::GetMaxSceneHash()
@@ -1216,16 +1148,16 @@ HashValue SceneParser::GetMaxSceneHash()
 	
 	HashValue hash;
 
-	std::map<Animatable*, HashValue> hash_visited;
+	MaterialHashMemo hashMemo;
 	DWORD syncTimestamp = 0;
-	hash << mtlParser.GetHashValue(environmentMap, params.t, hash_visited, syncTimestamp);
-	hash << mtlParser.GetHashValue(bgIblMap, params.t, hash_visited, syncTimestamp);
-	hash << mtlParser.GetHashValue(bgIblReflections, params.t, hash_visited, syncTimestamp);
-	hash << mtlParser.GetHashValue(bgIblRefractions, params.t, hash_visited, syncTimestamp);
-	hash << mtlParser.GetHashValue(bgIblBackplate, params.t, hash_visited, syncTimestamp);
-	hash << mtlParser.GetHashValue(bgSkyReflections, params.t, hash_visited, syncTimestamp);
-	hash << mtlParser.GetHashValue(bgSkyRefractions, params.t, hash_visited, syncTimestamp);
-	hash << mtlParser.GetHashValue(bgSkyBackplate, params.t, hash_visited, syncTimestamp);
+	hash << mtlParser.GetHashValue(environmentMap, params.t, hashMemo, syncTimestamp);
+	hash << mtlParser.GetHashValue(bgIblMap, params.t, hashMemo, syncTimestamp);
+	hash << mtlParser.GetHashValue(bgIblReflections, params.t, hashMemo, syncTimestamp);
+	hash << mtlParser.GetHashValue(bgIblRefractions, params.t, hashMemo, syncTimestamp);
+	hash << mtlParser.GetHashValue(bgIblBackplate, params.t, hashMemo, syncTimestamp);
+	hash << mtlParser.GetHashValue(bgSkyReflections, params.t, hashMemo, syncTimestamp);
+	hash << mtlParser.GetHashValue(bgSkyRefractions, params.t, hashMemo, syncTimestamp);
+	hash << mtlParser.GetHashValue(bgSkyBackplate, params.t, hashMemo, syncTimestamp);
 	
 	state.bgColor = GetCOREInterface()->GetBackGround(this->params.t, Interval());
 	// environment changes
@@ -1412,13 +1344,22 @@ bool SceneParser::Synchronize(bool forceUpdate)
 		
 	AddParsedNodes(toAdd);
 		
+	ParsedMotion motion;
+	if (view.useMotionBlur)
+		ComputeMotion(newMap, motion);
+
 	for (auto shape : scene.GetShapes())
 	{
 		if (auto id = shape.GetUserData())
 		{
-			if(view.useMotionBlur && newMap.count(id))
+			int index = motion.Find(id);
+			if (index >= 0)
 			{
-				applyMotion(shape, getMotion(view, newMap[id])); // update motion
+				Motion nodeMotion;
+				nodeMotion.velocity = motion.velocities[index];
+				nodeMotion.momentumAngle = motion.angles[index];
+				nodeMotion.momentumAxis = motion.axes[index];
+				applyMotion(shape, nodeMotion); // update motion
 			}
 			else
 			{
@@ -1433,6 +1374,10 @@ bool SceneParser::Synchronize(bool forceUpdate)
 
 	useFRGround();
 
+	// all shapes are attached now, so the deferred textures they use can be loaded
+	mtlParser.LoadDeferredImages(scene);
+	mtlParser.ReportDeferredImages();
+
 	// switch on or off default lights?
 	const auto& lights = scene.GetLights();
 	bool hasDefaultLights = false;
@@ -1479,7 +1424,7 @@ bool SceneParser::Synchronize(bool forceUpdate)
 	auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(profilingData.mSyncEnd - profilingData.mSyncStart).count();
 
 	std::wstring sceneName(GetCOREInterface()->GetCurFilePath());
-	uint32_t crc = GetMaxSceneHash();
+	uint64_t crc = GetMaxSceneHash();
 
 	if ( sceneName.empty() )
 	{
@@ -1487,7 +1432,7 @@ bool SceneParser::Synchronize(bool forceUpdate)
 	}
 
 	std::string sceneNameStr = "Scene name : " + ws2s(sceneName);
-	std::string crcStr = "CRC : " + std::to_string(crc);
+	std::string crcStr = "Hash : " + std::to_string(crc);
 
 	debugPrint("-------- Profiling Data --------");
 	debugPrint(sceneNameStr);
@@ -19,6 +19,7 @@ limitations under the License.
 #include "MaterialParser.h"
 #include <vector>
 #include <string>
+#include <map>
 #include <FrScope.h>
 
 FIRERENDER_NAMESPACE_BEGIN;
@@ -75,6 +76,9 @@ struct ParsedView {
 	float cameraExposure;
 	float motionBlurScale;
 
+	/// Shutter opening relative to the render time, in frames. The shutter stays open for cameraExposure frames.
+	float shutterOffset;
+
 	std::string cameraNodeName;
 
 	bool isSame(const ParsedView& other, bool *needResetScenePtr) const {
@@ -82,12 +86,13 @@ struct ParsedView {
 			sensorWidth == other.sensorWidth && fSTop == other.fSTop && perspectiveFov == other.perspectiveFov &&
 			projection == other.projection && focusDistance == other.focusDistance && tm == other.tm &&
 			projectionOverride == other.projectionOverride &&
-			useMotionBlur == other.useMotionBlur && cameraExposure == other.cameraExposure && motionBlurScale== other.motionBlurScale
+			useMotionBlur == other.useMotionBlur && cameraExposure == other.cameraExposure && motionBlurScale== other.motionBlurScale &&
+			shutterOffset == other.shutterOffset
 			;
 		bool needResetScene = false;
 		if(!result){
 			needResetScene  = (useMotionBlur!=other.useMotionBlur) ||
-				(useMotionBlur && (motionBlurScale != other.motionBlurScale));
+				(useMotionBlur && (motionBlurScale != other.motionBlurScale || shutterOffset != other.shutterOffset));
 		}
 		if(needResetScenePtr)
 			*needResetScenePtr = needResetScene;
@@ -118,7 +123,6 @@ public:
 	DWORD invalidationTimestamp = 0;
 
 	Matrix3 tm;
-	Matrix3 tmMotion;
 
 	ParsedNode() { tm.IdentityMatrix();	}
 
@@ -127,6 +131,19 @@ public:
 	std::vector<Mtl*> GetAllMaterials(const TimeValue &t) const;
 };
 
+/// Motion of parsed nodes over the shutter interval, relative to the camera. Each array holds one entry per node, ordered by
+/// ascending node id.
+struct ParsedMotion
+{
+	std::vector<size_t> ids;
+	std::vector<Point3> velocities;
+	std::vector<Point3> axes;
+	std::vector<float> angles;
+
+	/// Returns the index of the node in the arrays, or -1 if there is no such node
+	int Find(size_t id) const;
+};
+
 class ParsedMap
 {
 public:
@@ -310,7 +327,18 @@ protected:
 	/// \param evaluatedObject result of calling EvalWorldState on node
 	void parseCoronaSun(const ParsedNode& parsedNode, Object* object);
 
-	std::vector<frw::Shape> parseMesh(INode* inode, Object* evaluatedObject, const int numSubmtls, size_t& meshFaces, bool flipFaces);
+	HashValue GetMeshKey(INode* inode, Object* evaluatedObject, const int numSubmtls, bool flipFaces);
+
+	/// Sets up transforms, materials and special flags of all instances of a group sharing the same translated mesh, and 
+	/// attaches them to the scene
+	void AddInstances(const ParsedNodes& nodes, const std::vector<frw::Shape>& originalShapes, int numMtls);
+
+	/// Materials, displacement, volume and special flags of the shapes of a single scene node (defined in SceneParser.cpp)
+	struct PrototypeState;
+
+	/// Resolves everything about the shapes of the node which doesn't depend on the instance transform. This is done once per 
+	/// node, so that all scattered copies of the node share the result.
+	void ResolvePrototypeState(const ParsedNode& parsedNode, const std::vector<frw::Shape>& originalShapes, PrototypeState& state);
 	// track nodes so we can later destroy them
 
 	void traverseNode(INode* input, const bool processXRef, const RenderParameters& parameters, ParsedNodes& output);
@@ -332,6 +360,12 @@ public:
 	/// Parses all scene objects and outputs them in provided scene
 	void AddParsedNodes(const ParsedNodes& parsedNodes);
 
+	/// Samples the transforms of all nodes and of the camera over the shutter interval and converts them to linear and 
+	/// angular velocities. The number of samples is set by MotionBlurSamples in the settings file: two samples (the default)
+	/// measure the velocity when the shutter opens, more samples are spread until it closes. 3ds Max is queried once per sample
+	/// and distinct node, the conversion runs in parallel.
+	void ComputeMotion(const std::map<AnimHandle, ParsedNode>& nodes, ParsedMotion& motion);
+
 	HashValue GetMaxSceneHash();
 
 	bool NeedsUpdate();
@@ -24,8 +24,10 @@ limitations under the License.
 #include "plugin/BgManager.h"
 #include "plugin/CamManager.h"
 #include "plugin/ScopeManager.h"
+#include "plugin/FRSettingsFileHandler.h"
 
 #include "SceneCallbacks.h"
+#include "MeshSplitter.h"
 
 FIRERENDER_NAMESPACE_BEGIN;
 
@@ -237,10 +239,6 @@ void Synchronizer::MakeInitialReferences(ReferenceTarget* ref)
 				auto tm = input->GetObjTMAfterWSM(parameters.t);
 				tm.SetTrans(tm.GetTrans() * masterScale);
 				output.push_back(ParsedNode(id, input, tm));
-
-				Matrix3 ntmMotion = input->GetObjTMAfterWSM(parameters.t + 1);
-				ntmMotion.SetTrans(ntmMotion.GetTrans() * masterScale);
-				output.back().tmMotion = ntmMotion;
 #endif
 				#ifndef USE_NODEEVENTSYSTEM
 				AddReference(node);
@@ -499,7 +497,9 @@ RefResult Synchronizer::NotifyRefChanged(const Interval& iv, RefTargetHandle hTa
 	else if (mtlbase)
 	{
 		// a material's property was changed
-		// action: rebuild material and re-assign to its users
+		// action: forget its hash, rebuild material and re-assign to its users
+		mtlParser.InvalidateHash(mtlbase);
+
 		if (auto mat = dynamic_cast<Mtl*>(mtlbase))
 			InsertMatCommand(mat);
 	}
@@ -671,9 +671,9 @@ void Synchronizer::RemoveReference(RefTargetHandle hTarg)
 //
 // THIS SECTION DEALS WITH COMMAND QUEUEING (LINING UP CHANGES FOR EXECUTION)
 //
-// Commands are stored in separate queues (actually hashed structures) each
-// belonging to one of the main categories (rebuild object, assign material,
-// show/hide, modify trasform matrix, delete).
+// Commands are merged per node (and per material) into a single dirty mask,
+// stored in a flat array indexed by a hash map (see SQueue). Redundant
+// commands are dropped as they are inserted.
 // These commands are accumulate over a brief period of time to avoid clogging
 // the system with continuous expensive updates, and finally executed.
 //
@@ -683,18 +683,177 @@ void Synchronizer::RemoveReference(RefTargetHandle hTarg)
 // assign xform
 // show/hide
 // delete objects
+// rebuild materials
+// tone mapper, environment and alpha changes
+
+bool SQueue::MergeCommand(uint32_t& dirty, int code)
+{
+	switch (code)
+	{
+	case SQUEUE_OBJ_REBUILD:
+		// no need to assign materials or modify transforms: when the node is rebuilt, its current materials and xform are used
+		dirty &= ~(Bit(SQUEUE_OBJ_ASSIGNMAT) | Bit(SQUEUE_OBJ_XFORM));
+		break;
+
+	case SQUEUE_OBJ_ASSIGNMAT:
+	case SQUEUE_OBJ_XFORM:
+		if (dirty & Bit(SQUEUE_OBJ_REBUILD))
+			return false;
+		break;
+
+	case SQUEUE_OBJ_DELETE:
+		dirty = 0;
+		break;
+
+	case SQUEUE_OBJ_SHOW:
+		dirty &= ~Bit(SQUEUE_OBJ_HIDE);
+		break;
+
+	case SQUEUE_OBJ_HIDE:
+		dirty &= ~Bit(SQUEUE_OBJ_SHOW);
+		break;
+
+	case SQUEUE_RPRTONEMAP_START:
+		dirty &= ~Bit(SQUEUE_RPRTONEMAP_STOP);
+		break;
+
+	case SQUEUE_RPRTONEMAP_STOP:
+		// try turning it on and off again
+		// SQUEUE_RPRTONEMAP_START also performs an update like SQUEUE_RPRTONEMAP_MODIFY
+		dirty &= ~Bit(SQUEUE_RPRTONEMAP_START);
+		break;
+
+	case SQUEUE_BG_RPR_START:
+		dirty &= ~Bit(SQUEUE_BG_RPR_STOP);
+		break;
+
+	case SQUEUE_BG_RPR_STOP:
+		dirty &= ~Bit(SQUEUE_BG_RPR_START);
+		break;
+
+	case SQUEUE_ALPHA_ENABLE:
+		dirty &= ~Bit(SQUEUE_ALPHA_DISABLE);
+		break;
+
+	case SQUEUE_ALPHA_DISABLE:
+		dirty &= ~Bit(SQUEUE_ALPHA_ENABLE);
+		break;
+	}
+
+	const bool added = (dirty & Bit(code)) == 0;
+	dirty |= Bit(code);
+	return added;
+}
+
+void SQueue::AddNodeCommands(std::vector<SQueueItem>& commands, int code, NodeFilter filter) const
+{
+	for (const auto& entry : mNodes)
+	{
+		if ((entry.dirty & Bit(code)) == 0)
+			continue;
+
+		const bool rebuilt = (entry.dirty & Bit(SQUEUE_OBJ_REBUILD)) != 0;
+		if ((filter == NODES_REBUILT && !rebuilt) || (filter == NODES_NOT_REBUILT && rebuilt))
+			continue;
+
+		commands.push_back(SQueueItem(code, entry.target));
+	}
+}
+
+void SQueue::AddMaterialCommands(std::vector<SQueueItem>& commands) const
+{
+	for (const auto& entry : mMtls)
+	{
+		if (entry.dirty & Bit(SQUEUE_MAT_REBUILD))
+			commands.push_back(SQueueItem(SQUEUE_MAT_REBUILD, entry.target));
+	}
+}
+
+void SQueue::AddActionCommands(std::vector<SQueueItem>& commands) const
+{
+	for (int code = SQUEUE_RPRTONEMAP_START; code <= SQUEUE_ALPHA_DISABLE; ++code)
+	{
+		if (mActions & Bit(code))
+			commands.push_back(SQueueItem(code));
+	}
+}
+
+void SQueue::GetCommands(std::vector<SQueueItem>& commands, bool cheapestFirst)
+{
+	const size_t first = commands.size();
+
+	if (cheapestFirst)
+	{
+		// transforms and visibility of existing shapes, then the rest by increasing cost; commands of nodes which are
+		// going to be rebuilt must still follow the rebuild
+		AddNodeCommands(commands, SQUEUE_OBJ_XFORM, NODES_ALL);
+		AddNodeCommands(commands, SQUEUE_OBJ_SHOW, NODES_NOT_REBUILT);
+		AddNodeCommands(commands, SQUEUE_OBJ_HIDE, NODES_NOT_REBUILT);
+		AddNodeCommands(commands, SQUEUE_OBJ_DELETE, NODES_NOT_REBUILT);
+		AddActionCommands(commands);
+		AddNodeCommands(commands, SQUEUE_OBJ_ASSIGNMAT, NODES_ALL);
+		AddMaterialCommands(commands);
+		AddNodeCommands(commands, SQUEUE_OBJ_REBUILD, NODES_ALL);
+		AddNodeCommands(commands, SQUEUE_OBJ_SHOW, NODES_REBUILT);
+		AddNodeCommands(commands, SQUEUE_OBJ_HIDE, NODES_REBUILT);
+		AddNodeCommands(commands, SQUEUE_OBJ_DELETE, NODES_REBUILT);
+	}
+	else
+	{
+		AddNodeCommands(commands, SQUEUE_OBJ_REBUILD, NODES_ALL);
+		AddNodeCommands(commands, SQUEUE_OBJ_ASSIGNMAT, NODES_ALL);
+		AddNodeCommands(commands, SQUEUE_OBJ_XFORM, NODES_ALL);
+		AddNodeCommands(commands, SQUEUE_OBJ_SHOW, NODES_ALL);
+		AddNodeCommands(commands, SQUEUE_OBJ_HIDE, NODES_ALL);
+		AddNodeCommands(commands, SQUEUE_OBJ_DELETE, NODES_ALL);
+		AddMaterialCommands(commands);
+		AddActionCommands(commands);
+	}
+
+	mStats.peakDepth = std::max(mStats.peakDepth, commands.size() - first);
+}
+
+void SQueue::Defer(const std::vector<SQueueItem>& commands, DWORD latency)
+{
+	const bool wasEmpty = IsEmpty();
+
+	for (const auto& command : commands)
+	{
+		if (command.Node())
+			MergeInto(command.Code(), command.Node(), mNodes, mNodeIndex);
+		else if (command.Mat())
+			MergeInto(command.Code(), command.Mat(), mMtls, mMtlIndex);
+		else
+			MergeCommand(mActions, command.Code());
+	}
+
+	// deferred commands are not new: they keep the time of their original batch
+	if (wasEmpty || GetTickCount() - mFirstInsertTime < latency)
+		mFirstInsertTime = GetTickCount() - latency;
+}
+
+void SQueue::clear()
+{
+	if (!IsEmpty())
+	{
+		const DWORD latency = GetLatency();
+		mStats.batches++;
+		mStats.totalLatency += latency;
+		mStats.peakLatency = std::max(mStats.peakLatency, latency);
+	}
+
+	// the arrays keep their capacity, so a steady stream of edits doesn't reallocate
+	mNodes.clear();
+	mNodeIndex.clear();
+	mMtls.clear();
+	mMtlIndex.clear();
+	mActions = 0;
+}
 
 void Synchronizer::InsertRebuildCommand(INode *pNode)
 {
 	if (pNode)
 	{
-		// no need to assign materials: when the node is rebuilt, its current materials
-		// will be used anywway
-		mQueue.Remove(SQUEUE_OBJ_ASSIGNMAT, pNode);
-		
-		// no need to modify transforms either: when the node is rebuilt, its xform is reset
-		mQueue.Remove(SQUEUE_OBJ_XFORM, pNode);
-
 		mQueue.Insert(SQUEUE_OBJ_REBUILD, pNode);
 
 		// rebuild is an expensive operation. when we receive a reequest, we reset the
@@ -716,11 +875,6 @@ void Synchronizer::InsertDeleteCommand(INode *pNode)
 {
 	if (pNode)
 	{
-		mQueue.Remove(SQUEUE_OBJ_REBUILD, pNode);
-		mQueue.Remove(SQUEUE_OBJ_ASSIGNMAT, pNode);
-		mQueue.Remove(SQUEUE_OBJ_SHOW, pNode);
-		mQueue.Remove(SQUEUE_OBJ_HIDE, pNode);
-		mQueue.Remove(SQUEUE_OBJ_XFORM, pNode);
 		mQueue.Insert(SQUEUE_OBJ_DELETE, pNode);
 	}
 }
@@ -729,7 +883,6 @@ void Synchronizer::InsertShowCommand(INode *pNode)
 {
 	if (pNode)
 	{
-		mQueue.Remove(SQUEUE_OBJ_HIDE, pNode);
 		mQueue.Insert(SQUEUE_OBJ_SHOW, pNode);
 	}
 }
@@ -738,7 +891,6 @@ void Synchronizer::InsertHideCommand(INode *pNode)
 {
 	if (pNode)
 	{
-		mQueue.Remove(SQUEUE_OBJ_SHOW, pNode);
 		mQueue.Insert(SQUEUE_OBJ_HIDE, pNode);
 	}
 }
@@ -771,7 +923,6 @@ void Synchronizer::InsertModifyRPREnvironmentCommand()
 
 void Synchronizer::InsertStopRPREnvironmentCommand()
 {
-	mQueue.Remove(SQUEUE_BG_RPR_START);
 	mQueue.Insert(SQUEUE_BG_RPR_STOP);
 }
 
@@ -787,21 +938,16 @@ void Synchronizer::InsertModifyRPRToneMapper()
 
 void Synchronizer::InsertStopRPRToneMapper()
 {
-	// try turning it on and off again
-	// SQUEUE_RPRTONEMAP_START also performs an update like SQUEUE_RPRTONEMAP_MODIFY
-	mQueue.Remove(SQUEUE_RPRTONEMAP_START);
 	mQueue.Insert(SQUEUE_RPRTONEMAP_STOP);
 }
 
 void Synchronizer::InsertEnableAlphaChannelCommand()
 {
-	mQueue.Remove(SQUEUE_ALPHA_DISABLE);
 	mQueue.Insert(SQUEUE_ALPHA_ENABLE);
 }
 
 void Synchronizer::InsertDisableAlphaChannelCommand()
 {
-	mQueue.Remove(SQUEUE_ALPHA_ENABLE);
 	mQueue.Insert(SQUEUE_ALPHA_DISABLE);
 }
 
@@ -820,6 +966,14 @@ void Synchronizer::Start()
 	// Is called only once (during first run)
 	callbacks.beforeParsing(mBridge->t());
 
+	const int syncTimeBudget = std::atoi(FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::SyncTimeBudget).c_str());
+	mSyncTimeBudget = DWORD(std::max(syncTimeBudget, 0));
+
+	mtlParser.SetDeferImages(std::atoi(FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::DeferredTextures).c_str()) != 0);
+
+	// once per session, the geometry rebuilds of the session only look files up
+	TrimGeometryCacheToSettings();
+
 	mUITimerId = SetTimer(GetCOREInterface()->GetMAXHWnd(), UINT_PTR(this), CUI_TIMER_PERIOD, UITimerProc);
 }
 
@@ -833,11 +987,33 @@ void Synchronizer::Stop()
 			mUITimerId = 0;
 		}
 		mRunning = false;
+
+		ReportStats();
 	}
 
 	callbacks.afterParsing(); // this should be done only on the end of rendering! (according to Max SDK)
 }
 
+// Prints the command queue counters accumulated over the whole session, so the timer ticks themselves stay quiet
+void Synchronizer::ReportStats()
+{
+	const auto& queueStats = mQueue.GetStats();
+	if (queueStats.batches == 0)
+		return;
+
+	wchar_t statsStr[1024 + 1] = {};
+	wsprintf(statsStr, L"Synchronizer: %d batches, %d of %d commands merged, peak depth %d; latency %d ms average, %d ms peak",
+		int(queueStats.batches), int(queueStats.commandsMerged), int(queueStats.commandsInserted), int(queueStats.peakDepth),
+		int(queueStats.totalLatency / queueStats.batches), int(queueStats.peakLatency));
+	debugPrint(statsStr);
+
+	if (mTransformsUpdated > 0)
+	{
+		wsprintf(statsStr, L"Synchronizer: %d transforms updated in %d ms", int(mTransformsUpdated), int(mTransformTimer.GetElapsed()));
+		debugPrint(statsStr);
+	}
+}
+
 namespace
 {
 	void traverseMaterialCallback(SceneCallbacks &callbacks, Mtl* material)
@@ -853,6 +1029,9 @@ namespace
 // This function is executed in main thread, and it's called with a frequency of CUI_TIMER_PERIOD milliseconds.
 // It checks for the presence of stuff in the change queues, and synchronizes RPR accordingly. It also checks
 // for other scene changes (ie background and settings)
+// If a time budget is set (SyncTimeBudget in the settings file), each call only executes commands until the budget
+// runs out, cheapest first, and leaves the rest in the queue for the next call. The render thread is unlocked between
+// the calls.
 //
 VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UINT_PTR idEvent, _In_ DWORD dwTime)
 {
@@ -860,9 +1039,10 @@ VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UIN
 	{
 	private:
 		Synchronizer *mSynch;
+		UINT mPeriod;
 	public:
 		AutoTimerReset(Synchronizer *pSynch)
-			: mSynch(pSynch)
+			: mSynch(pSynch), mPeriod(CUI_TIMER_PERIOD)
 		{
 			if (mSynch->mUITimerId)
 			{
@@ -872,7 +1052,12 @@ VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UIN
 		}
 		~AutoTimerReset()
 		{
-			mSynch->mUITimerId = SetTimer(GetCOREInterface()->GetMAXHWnd(), UINT_PTR(mSynch), CUI_TIMER_PERIOD, Synchronizer::UITimerProc);
+			mSynch->mUITimerId = SetTimer(GetCOREInterface()->GetMAXHWnd(), UINT_PTR(mSynch), mPeriod, Synchronizer::UITimerProc);
+		}
+
+		void SetPeriod(UINT period)
+		{
+			mPeriod = period;
 		}
 	};
 
@@ -914,6 +1099,7 @@ VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UIN
 		GetISceneEventManager()->TriggerMessages(synch->mNodeEventCallbackKey);
 
 	AutoTimerReset TimerReset(synch);
+	SyncBudget budget(synch->mSyncTimeBudget);
 				
 	synch->mMasterScale = float(GetMasterScale(UNITS_METERS));
 
@@ -964,11 +1150,59 @@ VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UIN
 			synch->mBridge->GetProgressCB()->SetTitle(_T("Synchronizing..."));
 
 		if (!renderChanges.empty())
+		{
+			synch->InvalidateTransformTargets();
 			synch->UpdateRenderSettings(renderChanges);
+		}
+
+		// with a time budget, cheap commands go first, so they get through while large rebuilds stream in
+		std::vector<SQueueItem> commands;
+		synch->mQueue.GetCommands(commands, budget.IsLimited());
+
+		std::vector<INode*> deferredNodes; // nodes whose rebuild didn't fit into this slice
+
+		// rebuild commands only collect geometry; it is rebuilt in batches before any other command is processed
+		// (progress is reported by RebuildGeometry)
+		auto rebuildCollectedGeometry = [&]()
+		{
+			if (instances.empty())
+				return;
+
+			for (auto& ii : instances)
+			{
+				for (auto jj : ii.second)
+				{
+					synch->callbacks.addItem(jj); // traverses the node tree, adds nodes to callbacks and calls update on materials
+					if (jj->GetMtl())
+						traverseMaterialCallback(synch->callbacks, jj->GetMtl()); // traverses the tree a little bit differently (but calls addItem() still)
+				}
+			}
+			synch->RebuildGeometry(instances, budget, deferredNodes);
+			instances.clear();
+		};
 
-		// process object rebuild commands first
-		for (auto ii = synch->mQueue.begin(); ii != synch->mQueue.end(); ii++)
+		size_t processed = 0;
+		for (; processed < commands.size(); processed++)
 		{
+			auto ii = commands.begin() + processed;
+
+			if (ii->Code() != SQUEUE_OBJ_REBUILD)
+			{
+				rebuildCollectedGeometry();
+
+				// remaining commands may refer to the nodes which were not rebuilt yet
+				if (!deferredNodes.empty())
+					break;
+			}
+
+			// at least one command is executed per slice, so that the queue always makes progress
+			if (processed > 0 && budget.IsExceeded())
+				break;
+
+			// anything but transform and visibility changes may add or remove render objects
+			if (ii->Code() != SQUEUE_OBJ_XFORM && ii->Code() != SQUEUE_OBJ_SHOW && ii->Code() != SQUEUE_OBJ_HIDE)
+				synch->InvalidateTransformTargets();
+
 			switch (ii->Code())
 			{
 			case SQUEUE_OBJ_REBUILD:
@@ -1056,34 +1290,7 @@ VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UIN
 				}
 			}
 			break;
-			}
-		}
 
-		// object rebuilding: progress report
-		{
-			int numInstances = int_cast(instances.size());
-			wchar_t tempStr[1024];
-			int i = 1;
-			for (auto ii : instances)
-			{
-				for (auto jj : ii.second)
-				{
-					synch->callbacks.addItem(jj); // traverses the node tree, adds nodes to callbacks and calls update on materials
-					if (jj->GetMtl())
-						traverseMaterialCallback(synch->callbacks, jj->GetMtl()); // traverses the tree a little bit differently (but calls addItem() still)
-				}
-				wsprintf(tempStr, L"Synchronizing: Rebuilding Object %d of %d (%s)", i++, numInstances, (*ii.second.begin())->GetName());
-				if (synch->mBridge->GetProgressCB())
-					synch->mBridge->GetProgressCB()->SetTitle(tempStr);
-				synch->RebuildGeometry(ii.second);
-			}
-		}
-
-		// process remaining commands
-		for (auto ii = synch->mQueue.begin(); ii != synch->mQueue.end(); ii++)
-		{
-			switch (ii->Code())
-			{
 			case SQUEUE_OBJ_DELETE:
 			{
 				if (synch->mBridge->GetProgressCB())
@@ -1156,53 +1363,18 @@ VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UIN
 				if (synch->mBridge->GetProgressCB())
 					synch->mBridge->GetProgressCB()->SetTitle(_T("Synchronizing: Updating XForm"));
 
-				auto node = ii->Node();
+				// commands are grouped by code, so all transform changes are updated together
+				std::vector<INode*> nodes;
+				size_t last = processed;
+				for (; last < commands.size() && commands[last].Code() == SQUEUE_OBJ_XFORM; last++)
+					nodes.push_back(commands[last].Node());
 
-				auto ss = synch->mShapes.find(node);
-				if (ss != synch->mShapes.end())
-				{
-					auto tm = node->GetObjTMAfterWSM(synch->mBridge->t());
-					tm.SetTrans(tm.GetTrans() * synch->mMasterScale);
-					for (auto si : ss->second)
-						si->Get().SetTransform(tm);
-				}
-				else
-				{
-					auto sl = synch->mLightShapes.find(node);
-					if (sl != synch->mLightShapes.end())
-					{
-						auto tm = node->GetObjTMAfterWSM(synch->mBridge->t());
-						tm.SetTrans(tm.GetTrans() * synch->mMasterScale);
-						sl->second->Get().SetTransform(tm);
-					}
-					else
-					{
-						auto ll = synch->mLights.find(node);
-						if (ll != synch->mLights.end())
-						{
-							auto tm = node->GetObjTMAfterWSM(synch->mBridge->t());
-							tm.SetTrans(tm.GetTrans() * synch->mMasterScale);
-							ll->second->Get().SetTransform(tm);
-						}
-						else
-						{
-							auto pp = synch->mPortals.find(node);
-							if (pp != synch->mPortals.end())
-							{
-								auto tm = node->GetObjTMAfterWSM(synch->mBridge->t());
-								tm.SetTrans(tm.GetTrans() * synch->mMasterScale);
-								pp->second.SetTransform(tm);
-							}
-							else
-							{
-								// This code needs to be checked. Do not remove.
-								//if (ii == synch->mRPREnvironment)
-								//synch->UpdateRPREnvironment();
-								//synch->UpdateEnvXForm(ii);
-							}
-						}
-					}
-				}
+				synch->mTransformTimer.Start();
+				synch->UpdateTransforms(nodes);
+				synch->mTransformTimer.Stop();
+				synch->mTransformsUpdated += nodes.size();
+
+				processed = last - 1;
 			}
 			break;
 
@@ -1273,8 +1445,23 @@ VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UIN
 			}
 		}
 
+		rebuildCollectedGeometry();
+
+		const DWORD latency = synch->mQueue.GetLatency();
 		synch->mQueue.clear();
 
+		// carry over the commands which didn't fit into the time budget, and give the render thread some time before the
+		// next slice
+		if (processed < commands.size() || !deferredNodes.empty())
+		{
+			std::vector<SQueueItem> remaining(commands.begin() + processed, commands.end());
+			for (auto node : deferredNodes)
+				remaining.push_back(SQueueItem(SQUEUE_OBJ_REBUILD, node));
+
+			synch->mQueue.Defer(remaining, latency);
+			TimerReset.SetPeriod(std::max<UINT>(CUI_TIMER_PERIOD, budget.GetLimit()));
+		}
+
 		synch->mFirstRun = false;
 		
 		// we may have collected a few nodes that need rebuilding
@@ -1309,6 +1496,25 @@ VOID CALLBACK Synchronizer::UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UIN
 			synch->mBridge->GetProgressCB()->SetTitle(_T(""));
 	}
 
+	// load the deferred textures used by the attached shapes with what is left of the time budget, the rest is loaded by
+	// the next ticks
+	if (ClearEvent)
+		synch->mDeferredImagesWaiting = true;
+
+	const DWORD remaining = budget.GetRemaining();
+	if (synch->mDeferredImagesWaiting && (!budget.IsLimited() || remaining > 0))
+	{
+		DeferredImageLoad load = synch->mtlParser.LoadDeferredImages(synch->mScope.GetScene(), remaining);
+		synch->mDeferredImagesWaiting = load.waiting > 0;
+
+		// report once all the textures of this change are loaded, not for each tick
+		if (!synch->mDeferredImagesWaiting)
+			synch->mtlParser.ReportDeferredImages();
+
+		if (load.loaded > 0)
+			synch->mBridge->ClearFB();
+	}
+
 	RenderThreadLock.Unlock();
 
 	synch->CustomCPUSideSynch();
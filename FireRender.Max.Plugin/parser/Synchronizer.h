@@ -25,6 +25,7 @@ limitations under the License.
 #include <vector>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <queue>
 #include <memory>
 #include <FrScope.h>
@@ -290,147 +291,200 @@ public:
 	}
 };
 
-typedef std::list<SQueueItem> SQueueItemList;
-typedef std::list<SQueueItem>::iterator SQueueItemIt;
-typedef std::list<SQueueItem>::const_iterator Const_SQueueItemIt;
+//////////////////////////////////////////////////////////////////////////////
+// Commands are merged per node and per material into a single dirty mask
+// (one bit per command code) held in a flat array, indexed by a hash map.
+// Redundant commands are dropped on insertion:
+// - a rebuild includes material assignment and transform
+// - a delete cancels everything else pending for the node
+// - show/hide, tone mapper start/stop, environment start/stop and alpha
+//   enable/disable cancel their counterpart (the latest one wins)
+// GetCommands returns the pending commands in execution order.
+//
 
 class SQueue
 {
+public:
+	/// Counters describing how the queue is used, accumulated since the synchronizer started
+	struct Stats
+	{
+		size_t commandsInserted = 0; // calls to Insert
+		size_t commandsMerged = 0; // calls to Insert which didn't add a new command
+		size_t batches = 0; // number of times the queue was emptied
+		size_t peakDepth = 0; // largest number of commands returned by GetCommands
+		DWORD totalLatency = 0; // time the oldest command of each batch waited, summed over all batches
+		DWORD peakLatency = 0; // longest time a command waited
+	};
+
 private:
-	SQueueItemList mList;
-	std::map<INode*, std::map<int, SQueueItemIt>> mNodeItems;
-	std::map<Mtl*, std::map<int, SQueueItemIt>> mMtlItems;
-	std::map<int, SQueueItemIt> mActionItems;
+	template<class T>
+	struct Entry
+	{
+		T* target;
+		uint32_t dirty;
+	};
 
-	int mClearEvent;
-	int mTonemapEvent;
+	std::vector<Entry<INode>> mNodes;
+	std::unordered_map<INode*, size_t> mNodeIndex;
 
-public:
-	SQueue()
-	: mClearEvent(0)
-	, mTonemapEvent(0)
+	std::vector<Entry<Mtl>> mMtls;
+	std::unordered_map<Mtl*, size_t> mMtlIndex;
+
+	uint32_t mActions; // codes of pending commands which have no target
+
+	DWORD mFirstInsertTime; // time the oldest pending command was inserted at
+	Stats mStats;
+
+	static inline uint32_t Bit(int code)
 	{
+		return 1u << code;
 	}
 
-	~SQueue()
+	// Applies the merge rules to the dirty mask of a target; returns false if the command was already covered by the mask
+	static bool MergeCommand(uint32_t& dirty, int code);
+
+	enum NodeFilter
 	{
-	}
+		NODES_ALL,
+		NODES_REBUILT, // only nodes with a pending rebuild
+		NODES_NOT_REBUILT // only nodes without a pending rebuild
+	};
+
+	void AddNodeCommands(std::vector<SQueueItem>& commands, int code, NodeFilter filter) const;
+	void AddMaterialCommands(std::vector<SQueueItem>& commands) const;
+	void AddActionCommands(std::vector<SQueueItem>& commands) const;
 
-	inline void Remove(int code)
+	template<class T>
+	inline bool MergeInto(int code, T* target, std::vector<Entry<T>>& entries, std::unordered_map<T*, size_t>& index)
 	{
-		auto ii = mActionItems.find(code);
-		if (ii != mActionItems.end())
+		auto res = index.insert(std::make_pair(target, entries.size()));
+		if (res.second)
 		{
-			mList.erase(ii->second);
-			mActionItems.erase(ii);
-			if (code == SQUEUE_RPRTONEMAP_MODIFY || code == SQUEUE_RPRTONEMAP_START || code == SQUEUE_RPRTONEMAP_STOP)
-				mTonemapEvent--;
-			else
-				mClearEvent--;
+			Entry<T> entry = { target, 0 };
+			entries.push_back(entry);
 		}
+
+		return MergeCommand(entries[res.first->second].dirty, code);
 	}
 
-	inline void Remove(int code, INode *node)
+	inline void OnInserted(bool wasEmpty, bool added)
 	{
-		auto ii = mNodeItems.find(node);
-		if (ii != mNodeItems.end())
-		{
-			auto cc = ii->second.find(code);
-			if (cc != ii->second.end())
-			{
-				mList.erase(cc->second);
-				ii->second.erase(cc);
-				if (ii->second.empty())
-					mNodeItems.erase(ii);
-				mClearEvent--;
-			}
-		}
+		if (wasEmpty)
+			mFirstInsertTime = GetTickCount();
+
+		mStats.commandsInserted++;
+		if (!added)
+			mStats.commandsMerged++;
 	}
 
-	inline void Remove(int code, Mtl *mtl)
+public:
+	SQueue()
+	: mActions(0)
+	, mFirstInsertTime(0)
 	{
-		auto ii = mMtlItems.find(mtl);
-		if (ii != mMtlItems.end())
-		{
-			auto cc = ii->second.find(code);
-			if (cc != ii->second.end())
-			{
-				mList.erase(cc->second);
-				ii->second.erase(cc);
-				if (ii->second.empty())
-					mMtlItems.erase(ii);
-				mClearEvent--;
-			}
-		}
 	}
 
 	inline void Insert(int code)
 	{
-		Remove(code);
-		SQueueItem item(code);
-		mList.push_front(item);
-		
-		SQueueItemIt it= mList.begin();
-		mActionItems.insert(std::make_pair(code, it));
-
-		if (code == SQUEUE_RPRTONEMAP_MODIFY || code == SQUEUE_RPRTONEMAP_START || code == SQUEUE_RPRTONEMAP_STOP)
-			mTonemapEvent++;
-		else
-			mClearEvent++;
+		const bool wasEmpty = IsEmpty();
+		OnInserted(wasEmpty, MergeCommand(mActions, code));
 	}
 
 	inline void Insert(int code, INode *node)
 	{
-		Remove(code, node);
-		SQueueItem item(code, node);
-		mList.push_front(item);
-
-		SQueueItemIt it = mList.begin();
-		mNodeItems[node].insert(std::make_pair(code, it));
-		
-		mClearEvent++;
+		const bool wasEmpty = IsEmpty();
+		OnInserted(wasEmpty, MergeInto(code, node, mNodes, mNodeIndex));
 	}
 
 	inline void Insert(int code, Mtl *mtl)
 	{
-		Remove(code, mtl);
-		SQueueItem item(code, mtl);
-		mList.push_front(item);
-
-		SQueueItemIt it = mList.begin();
-		mMtlItems[mtl].insert(std::make_pair(code, it));
-		
-		mClearEvent++;
+		const bool wasEmpty = IsEmpty();
+		OnInserted(wasEmpty, MergeInto(code, mtl, mMtls, mMtlIndex));
 	}
-	
-	Const_SQueueItemIt begin() const
+
+	/// Appends the pending commands to the array, in the order they should be executed: node commands grouped by code
+	/// (rebuild, assign material, transform, show/hide, delete), then materials, then the remaining actions.
+	/// \param cheapestFirst if true, commands are sorted by increasing cost instead: transforms, visibility, actions,
+	///        materials, and geometry rebuilds last
+	void GetCommands(std::vector<SQueueItem>& commands, bool cheapestFirst = false);
+
+	/// Empties the queue and records the latency of the batch which is being removed
+	void clear();
+
+	/// Puts back commands taken by GetCommands which were not executed, e.g. because the time budget of the synchronization
+	/// slice ran out. They are merged with commands inserted meanwhile and keep their original latency.
+	void Defer(const std::vector<SQueueItem>& commands, DWORD latency);
+
+	inline bool IsEmpty() const
 	{
-		return mList.begin();
+		return mNodes.empty() && mMtls.empty() && mActions == 0;
 	}
 
-	Const_SQueueItemIt end() const
+	/// Time since the oldest pending command was inserted, in milliseconds
+	inline DWORD GetLatency() const
 	{
-		return mList.end();
+		return IsEmpty() ? 0 : GetTickCount() - mFirstInsertTime;
 	}
 
-	void clear()
+	inline const Stats& GetStats() const
 	{
-		mList.clear();
-		mActionItems.clear();
-		mNodeItems.clear();
-		mMtlItems.clear();
-		mClearEvent = 0;
-		mTonemapEvent = 0;
+		return mStats;
 	}
 
 	inline bool ClearEvent() const
 	{
-		return mClearEvent > 0;
+		const uint32_t tonemapBits = Bit(SQUEUE_RPRTONEMAP_START) | Bit(SQUEUE_RPRTONEMAP_MODIFY) | Bit(SQUEUE_RPRTONEMAP_STOP);
+		return !mNodes.empty() || !mMtls.empty() || (mActions & ~tonemapBits) != 0;
 	}
 
 	inline bool TonemapEvent() const
 	{
-		return mTonemapEvent > 0;
+		const uint32_t tonemapBits = Bit(SQUEUE_RPRTONEMAP_START) | Bit(SQUEUE_RPRTONEMAP_MODIFY) | Bit(SQUEUE_RPRTONEMAP_STOP);
+		return (mActions & tonemapBits) != 0;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Time budget of a single synchronization slice (one UITimerProc tick).
+// Work which doesn't fit is carried over to the next tick, so the render
+// thread keeps refining the image while a large change streams in.
+// A limit of 0 means the whole queue is processed at once.
+//
+
+class SyncBudget
+{
+private:
+	DWORD mStart;
+	DWORD mLimit;
+
+public:
+	SyncBudget(DWORD limit)
+		: mStart(GetTickCount())
+		, mLimit(limit)
+	{
+	}
+
+	inline bool IsLimited() const
+	{
+		return mLimit > 0;
+	}
+
+	inline DWORD GetLimit() const
+	{
+		return mLimit;
+	}
+
+	inline bool IsExceeded() const
+	{
+		return IsLimited() && GetTickCount() - mStart >= mLimit;
+	}
+
+	// Milliseconds left, 0 if the budget is unlimited or exceeded
+	inline DWORD GetRemaining() const
+	{
+		if (!IsLimited() || IsExceeded())
+			return 0;
+		return mLimit - (GetTickCount() - mStart);
 	}
 };
 
@@ -642,6 +696,18 @@ protected:
 	std::map<INode *, SLightPtr> mLights;
 	std::vector<SLightPtr> mDefaultLights; // stores current default lights
 	std::map<INode *, frw::Shape> mPortals;
+
+	// reverse index from a node to all of its render objects (shapes, light shapes, lights and portals), so transforms of
+	// many nodes can be updated in a single pass. Built on demand from the maps above, and dropped whenever a command
+	// that may add or remove render objects is executed.
+	struct TransformTargets
+	{
+		std::vector<frw::Shape> shapes;
+		std::vector<frw::Light> lights;
+	};
+	std::unordered_map<INode *, TransformTargets> mTransformTargets;
+	bool mTransformTargetsValid = false;
+
 	std::map<Mtl *, std::set<SShapePtr>> mMaterialUsers;
 	std::map<Mtl *, std::vector<Mtl*>> mMultiMats; // tracks changes in multi-mat structures
 	std::set<Mtl *> mEmissives; // tracks emissives being used in scene
@@ -682,6 +748,10 @@ protected:
 	PartID mNotifyLastPartID; // to disambiguate xform in NotifyRefChanged
 	INode *mNotifyLastNode = 0; // to disambiguate xform in NotifyRefChanged
 	UINT_PTR mUITimerId;
+	DWORD mSyncTimeBudget = 0; // milliseconds of work per UITimerProc tick, 0 for unlimited
+	bool mDeferredImagesWaiting = false; // the scene changed, or deferred textures didn't fit into the last tick
+	size_t mTransformsUpdated = 0; // nodes moved by SQUEUE_OBJ_XFORM commands, reported by Stop()
+	AccumulationTimer mTransformTimer; // time spent in UpdateTransforms, reported by Stop()
 	
 public:
 	Synchronizer(frw::Scope scope, INode *pSceneINode, SynchronizerBridge *pBridge);
@@ -692,7 +762,7 @@ public:
 
 	inline bool IsQueueEmpty() const
 	{
-		return (mQueue.begin() == mQueue.end());
+		return mQueue.IsEmpty();
 	}
 
 protected:
@@ -742,15 +812,15 @@ protected:
 
 	static VOID CALLBACK UITimerProc(_In_ HWND hwnd, _In_ UINT uMsg, _In_ UINT_PTR idEvent, _In_ DWORD dwTime);
 	void ResetTimerProc();
+	void ReportStats();
 
 	virtual void CustomCPUSideSynch() // optional - called from UITimerProc
 	{
 	}
 
-	bool CreateMesh(std::vector<frw::Shape>& result, bool& directlyVisible, frw::Context& context, float masterScale, TimeValue timeValue, View& view, INode* inode, Object* evaluatedObject, const int numSubmtls, size_t& meshFaces, bool flipFaces);
-	std::vector<frw::Shape> parseMesh(INode* inode, Object* evaluatedObject, const int numSubmtls, size_t& meshFaces, bool flipFaces);
 	void DeleteGeometry(INode *instance);
-	void RebuildGeometry(const std::list<INode *> &instances);
+	void RebuildGeometry(const std::map<AnimHandle, std::list<INode *>> &instances, const SyncBudget &budget, std::vector<INode*> &deferred);
+	void AttachGeometry(const std::list<INode *> &nodes, const std::vector<frw::Shape> &originalShapes, int numMtls);
 	void RebuildMaxLight(INode *light, Object *obj);
 	void AddDefaultLights();
 	void RemoveDefaultLights();
@@ -758,6 +828,9 @@ protected:
 	void RemoveMaterialsFromNode(INode *node, bool *wasMulti = 0); // utility
 	bool Show(INode *node); // returns false if the node needs rebuilding
 	void Hide(INode *node);
+	void UpdateTransforms(const std::vector<INode*> &nodes);
+	void BuildTransformTargets();
+	void InvalidateTransformTargets();
 	void RebuildUsersOfMaterial(Mtl *pMat, std::vector<INode*> &nodesToRebuild); // utility
 	frw::Shader CreateShader(Mtl *pMat, INode *node, bool force = false); // utility
 	void UpdateMaterial(Mtl *pMat, std::vector<INode*> &nodesToRebuild);
@@ -12,6 +12,7 @@ limitations under the License.
 ********************************************************************/
 
 #include "Synchronizer.h"
+#include "MeshSplitter.h"
 #include "CoronaDeclarations.h"
 #include <MeshNormalSpec.h>
 #include "FireRenderMaterialMtl.h"
@@ -56,304 +57,102 @@ namespace
 };
 
 
-bool Synchronizer::CreateMesh(std::vector<frw::Shape>& result, bool& directlyVisible,
-	frw::Context& context,
-	float masterScale,
-	TimeValue timeValue, View& view,
-	INode* inode, Object* evaluatedObject, const int numSubmtls, size_t& meshFaces, bool flipFaces)
-{
-	Mesh* mesh = NULL;
-	BOOL needsDelete = FALSE; // If GetRenderMesh sets this to true, we will need to delete the mesh when we are done
-	Mesh dummyMeshCopy; // Used only if we need to copy the mesh when getting normals
-
-	// First, we try to obtain render mesh from the object
-	if (auto geomObject = dynamic_cast<GeomObject*>(evaluatedObject))
-	{
-		// expensive!
-		mesh = geomObject->GetRenderMesh(timeValue, inode, view, needsDelete);
-	}
-
-	directlyVisible = inode->GetPrimaryVisibility() != FALSE;
-	if (evaluatedObject->ClassID() == Corona::LIGHT_CID)
-	{
-		if (ScopeManagerMax::CoronaOK)
-		{
-		// Corona lights require some special processing - we will get its mesh via function publishing interface.
-		// But when we have it, we can parse the mesh as any other geometry object, because we also handle their the lights 
-		// material specially in MaterialParser.
-		directlyVisible &= GetFromPb<bool>(evaluatedObject->GetParamBlockByID(0), Corona::L_DIRECTLY_VISIBLE);
-		BaseInterface* bi = evaluatedObject->GetInterface(Corona::IFIREMAX_LIGHT_INTERFACE);
-		Corona::IFireMaxLightInterface* lightInterface = dynamic_cast<Corona::IFireMaxLightInterface*>(bi);
-		if (lightInterface)
-			lightInterface->fmGetRenderMesh(timeValue, mesh, needsDelete);
-		else
-			MessageBox(GetCOREInterface()->GetMAXHWnd(), _T("Too old Corona version."), _T("Radeon ProRender warning"), MB_OK);
-	}
-	}
+//////////////////////////////////////////////////////////////////////////////
+// Rebuilds groups of instanced geometry. Meshes are evaluated on the main
+// thread, flattened on worker threads, and the resulting shapes are attached
+// in order, group by group.
+// parameters:
+// instances - groups of nodes sharing the same evaluated object, keyed by
+//             the object's AnimHandle
+// budget    - when it runs out, the remaining batches are not translated
+// deferred  - receives the nodes of the groups which were not rebuilt
+//
 
-	if (!mesh)  //nothing to do here
-		return false;
+void Synchronizer::RebuildGeometry(const std::map<AnimHandle, std::list<INode *>> &instances, const SyncBudget &budget,
+	std::vector<INode*> &deferred)
+{
+	auto t = mBridge->t();
+	auto context = mScope.GetContext();
+	FireRenderView view;
+	MeshTranslationStats stats;
+	const MeshTranslationOptions options = GetMeshTranslationOptions();
 
-	meshFaces = mesh->getNumFaces();
+	int numInstances = int_cast(instances.size());
+	wchar_t tempStr[1024];
+	int progress = 1;
 
-	// Next we try to get normals associated with the mesh
-	MeshNormalSpec* normals = nullptr;
+	std::vector<const std::list<INode *>*> groups;
+	groups.reserve(instances.size());
+	for (auto& ii : instances)
+		groups.push_back(&ii.second);
 
-	// Handle normals: in case we need to delete the mesh, we are free to modify it, so we just do by calling SpecifyNormals()
-	if (needsDelete)
+	for (size_t batchStart = 0; batchStart < groups.size(); batchStart += MeshTranslationBatchSize)
 	{
-		mesh->SpecifyNormals();
-		normals = mesh->GetSpecifiedNormals();
-	}
-	else
-	{
-		// Otherwise we will try to get the normals without modifying the mesh. We try it...
-		normals = mesh->GetSpecifiedNormals();
-		if (normals == NULL || normals->GetNumNormals() == 0)
+		// the first batch is always translated, so that the rebuild makes progress
+		if (batchStart > 0 && budget.IsExceeded())
 		{
-			// ... and if it fails, we will have to copy the mesh, modify it by calling SpecifyNormals(), and get the normals 
-			// from the mesh copy
-			dummyMeshCopy = *mesh;
-			dummyMeshCopy.SpecifyNormals();
-			normals = dummyMeshCopy.GetSpecifiedNormals();
+			for (size_t j = batchStart; j < groups.size(); ++j)
+				deferred.insert(deferred.end(), groups[j]->begin(), groups[j]->end());
+			break;
 		}
-	}
-	FASSERT(normals);
-	normals->CheckNormals();
-
-	// Copy all vertices, normals, and texture coordinates from 3ds Max to our buffers
-	Stack<Point3> v, n;				// all vertices, normals of the mesh
-	Stack<Stack<int>> vi, ni;		// materialID[vertex/normals[]]
 
-	Stack<Stack<Point3>> t;			// mapChannel[all texture coords of the mesh]
-	Stack<Stack<Stack<int>>> ti;	// mapChannel[materialID[texcoords[]]]
-
-	// Swap comment to enable SECONDARY UV CHANNEL
-	//int numChannels = mesh->tVerts == NULL ? 0 : mesh->getNumMaps() - 1;
-	int numChannels = mesh->tVerts == NULL ? 0 : 1;
-
-	vi.resize(numSubmtls);
-	ni.resize(numSubmtls);
-	ti.resize(numChannels);
-	t.resize(numChannels);
-
-	for (int i = 0; i < numChannels; ++i)
-		ti[i].resize(numSubmtls);
-
-	v.resize(mesh->getNumVerts());
-	for (int i = 0; i < mesh->getNumVerts(); ++i)
-		v[i] = mesh->verts[i] * masterScale;
-
-	n.resize(normals->GetNumNormals());
-	for (int i = 0; i < normals->GetNumNormals(); ++i)
-		n[i] = normals->Normal(i).Normalize();
-
-	const bool textured = mesh->tVerts != NULL;
-	for (int i = 0; i < numChannels; i++)
-	{
-		MeshMap& mapChannel = mesh->maps[i + 1]; // maps[0] is vertex color, leave it
+		const size_t batchSize = std::min(groups.size() - batchStart, size_t(MeshTranslationBatchSize));
+		std::vector<MeshTranslationJob> jobs(batchSize);
 
-		if (textured)
+		for (size_t j = 0; j < batchSize; ++j)
 		{
-			t[i].resize(mapChannel.vnum);
-			for (int j = 0; j < mapChannel.vnum; ++j)
-			{
-				UVVert tv = mapChannel.tv[j];
-				if (flipFaces)
-					tv.x = 1.f - tv.x;
-				t[i][j] = tv;
-			}
-		}
-	}
-
-	// Now create triangle index arrays. We push each triangle into appropriate "bin" based on its material ID
-	int faceCount = mesh->getNumFaces();
-	if (faceCount != 0)
-	{
-		for (int i = 0; i < numSubmtls; ++i)
-		{
-			vi[i].reserve(faceCount * 3);
-			ni[i].reserve(faceCount * 3);
-			for (int j = 0; j < numChannels; ++j)
-				ti[j][i].reserve(faceCount * 3 * 3);
-		}
-	}
-
-	for (int i = 0; i < mesh->getNumFaces(); ++i)
-	{
-		Face& face = mesh->faces[i];
-		const int mtlId = face.getMatID() % numSubmtls;
-		for (int j = 0; j < 3; ++j) {
-#ifdef SWITCH_AXES
-			int index = 0; // we swap 2 indices because we change parity via TM switch
-			if (j == 1) {
-				index = 2;
-			}
-			else if (j == 2) {
-				index = 1;
-			}
-#else
-			const int index = j;
-#endif
-
-			vi[mtlId].push(face.getVert(index));
-			ni[mtlId].push(normals->GetNormalIndex(i, index));
+			const auto& nodes = *groups[batchStart + j];
+			auto& job = jobs[j];
 
-			for (int k = 0; k < numChannels; ++k)
+			int numMtls = 0;
+			for (auto& parsedNode : nodes)
 			{
-				MeshMap& mapChannel = mesh->maps[k + 1]; // maps[0] is vertex color, leave it
-				if (textured)
-					ti[k][mtlId].push(mapChannel.tf[i].t[index]);
+				RemoveMaterialsFromNode(parsedNode);
+				numMtls = std::max(numMtls, int_cast(GetAllMaterials(parsedNode, t).size()));
 			}
-		}
-	}
 
-	// Create a dummy array holding numbers of vertices for each face (which is always "3" in our case)
-	int maxFaceCount = 0;
-	for (auto& i : vi)
-		maxFaceCount = std::max(maxFaceCount, i.size() / 3);
-	Stack<int> vertNums;
-	vertNums.resize(maxFaceCount);
-	for (auto& i : vertNums)
-		i = 3;
+			// Evaluate the mesh of first node in the group
+			auto firstNode = *nodes.begin();
+			const ObjectState& state = firstNode->EvalWorldState(t);
 
-	// Finally, create RPR shape objects.
+			auto tm = firstNode->GetObjTMAfterWSM(t);
+			tm.SetTrans(tm.GetTrans() * mMasterScale);
 
-	for (int i = 0; i < numSubmtls; ++i)
-	{
-		if (vi[i].size() == 0)
-		{
-			// we still need to push something so the array of materials created elsewhere matches the array of shapes
-			result.push_back(frw::Shape());
+			job.node = firstNode;
+			job.object = state.obj;
+			job.numSubmtls = numMtls;
+			job.flipFaces = !!tm.Parity();
 		}
-		else
-		{
-			auto currMeshFaces = vi[i].size() / 3;
-
-			size_t texcoordsNum[2] = { 0, 0 };
-			rpr_int texcoordStride[2] = { 0, 0 };
-			rpr_int texcoordIdxStride[2] = { 0, 0 };
 
-			const rpr_float* texcoords[2] = { nullptr, nullptr };
-			const rpr_int* texcoordIndices[2] = { nullptr, nullptr };
+		TranslateMeshes(context, mMasterScale, t, view, jobs, stats, options);
 
-			if (mesh->numTVerts > 0)
-			{
-				for (int j = 0; j < numChannels; ++j)
-				{
-					const bool bPaddingVertices = true;
+		for (size_t j = 0; j < batchSize; ++j)
+		{
+			const auto& nodes = *groups[batchStart + j];
 
-					// Padding texture vertices
-					if (bPaddingVertices)
-					{
-						t[j].resize(mesh->numTVerts);
-						texcoordsNum[j] = mesh->numTVerts;
-					}
-					else
-					{
-						texcoordsNum[j] = mesh->maps[j + 1].vnum;
-					}
+			wsprintf(tempStr, L"Synchronizing: Rebuilding Object %d of %d (%s)", progress++, numInstances, (*nodes.begin())->GetName());
+			if (mBridge->GetProgressCB())
+				mBridge->GetProgressCB()->SetTitle(tempStr);
 
-					texcoords[j] = t[j][0];
-					texcoordIndices[j] = &ti[j][i][0];
-					texcoordStride[j] = sizeof(Point3);
-					texcoordIdxStride[j] = sizeof(rpr_int);
-				}
-			}
+			if (jobs[j].shapes.size() == 0)
+				continue; // evaluating the object yielded no faces - e.g. the object was empty
 
-			auto shape = context.CreateMeshEx(
-				v[0], v.size(), sizeof(v[0]),
-				n[0], n.size(), sizeof(n[0]),
-				nullptr, 0, 0,
-				numChannels, texcoords, texcoordsNum, texcoordStride,
-				&vi[i][0], sizeof(vi[i][0]),
-				&ni[i][0], sizeof(ni[i][0]),
-				texcoordIndices, texcoordIdxStride,
-				&vertNums[0],
-				currMeshFaces);
-
-			result.push_back(shape);
+			AttachGeometry(nodes, jobs[j].shapes, jobs[j].numSubmtls);
 		}
 	}
 
-	if (needsDelete) {
-		mesh->DeleteThis();
-	}
-
-	return true;
+	stats.Report(L"RebuildGeometry");
 }
 
 //////////////////////////////////////////////////////////////////////////////
-// Parses a single mesh object. Outputs a list of shapes because the mesh can
-// have multiple material IDs, which RPR cannot handle in single shape.
-// parameters:
-// inode - Scene node where the mesh was encountered
-// evaluatedObject - result of calling EvalWorldState on inode
-// numSubmtls - Number of submaterials that the node material holds. If it is
-//              more than 1 (it uses multi-material) and the mesh has multiple
-//              material IDs, we will have to create multiple shapes.
+// Associates the shapes of a translated mesh with all nodes of its instance
+// group, setting up transforms, materials and special flags
 //
 
-std::vector<frw::Shape> Synchronizer::parseMesh(INode* inode, Object* evaluatedObject, const int numSubmtls, size_t& meshFaces, bool flipFaces)
+void Synchronizer::AttachGeometry(const std::list<INode *> &nodes, const std::vector<frw::Shape> &originalShapes, int numMtls)
 {
-	meshFaces = 0;
-	std::vector<frw::Shape> result;
-	if (!evaluatedObject)
-		return result;
-
-	auto context = mScope.GetContext();
-	FASSERT(evaluatedObject != NULL && inode != NULL);
-
 	auto t = mBridge->t();
-		
-	// hopefully we can get this info
-	int numFaces = 0, numVerts = 0;
-	if (evaluatedObject->PolygonCount(t, numFaces, numVerts))
-		meshFaces = numFaces;
-	else
-		DebugPrint(L"no face count\n");
-
-	FireRenderView view;
-	
-	bool directlyVisible;
-	if (!CreateMesh(result, directlyVisible,
-	context, mMasterScale,
-	t, view, inode, evaluatedObject, numSubmtls, meshFaces, flipFaces))
-		return std::vector<frw::Shape>();
-
-	for (auto& shape : result)
-	{
-		if (!directlyVisible)
-			shape.SetVisibility(false);
-	}
-
-	return result;
-}
-
-void Synchronizer::RebuildGeometry(const std::list<INode *> &nodes)
-{
-	int numMtls = 0;
-
-	auto t = mBridge->t();
-
-	for (auto& parsedNode : nodes)
-	{
-		RemoveMaterialsFromNode(parsedNode);
-		numMtls = std::max(numMtls, int_cast(GetAllMaterials(parsedNode, t).size()) );
-	}
-
-	// Evaluate the mesh of first node in the group
 	auto firstNode = *nodes.begin();
-	const ObjectState& state = firstNode->EvalWorldState(t);
-	size_t currMeshFaces = 0;
-	
-	auto tm = firstNode->GetObjTMAfterWSM(mBridge->t());
-	tm.SetTrans(tm.GetTrans() * mMasterScale);
-	BOOL parity = tm.Parity();
-
-	auto originalShapes = parseMesh(firstNode, state.obj, numMtls, currMeshFaces, !!parity);
-	if (originalShapes.size() == 0)
-		return; // evaluating the object yielded no faces - e.g. the object was empty
 
 	FASSERT(originalShapes.size() == numMtls);
 
@@ -905,6 +704,69 @@ void Synchronizer::Hide(INode *node)
 	}
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Updates the transforms of a batch of nodes. Matrices are evaluated for all
+// nodes first, then pushed to all render objects of each node, found through
+// the reverse index.
+//
+
+void Synchronizer::UpdateTransforms(const std::vector<INode*> &nodes)
+{
+	if (!mTransformTargetsValid)
+		BuildTransformTargets();
+
+	auto t = mBridge->t();
+
+	for (auto node : nodes)
+	{
+		auto tt = mTransformTargets.find(node);
+		if (tt == mTransformTargets.end())
+			continue;
+
+		auto tm = node->GetObjTMAfterWSM(t);
+		tm.SetTrans(tm.GetTrans() * mMasterScale);
+
+		for (auto shape : tt->second.shapes)
+			shape.SetTransform(tm);
+		for (auto light : tt->second.lights)
+			light.SetTransform(tm);
+	}
+}
+
+void Synchronizer::BuildTransformTargets()
+{
+	mTransformTargets.clear();
+	mTransformTargets.reserve(mShapes.size() + mLightShapes.size() + mLights.size() + mPortals.size());
+
+	for (auto& ss : mShapes)
+	{
+		auto& shapes = mTransformTargets[ss.first].shapes;
+		for (auto& shape : ss.second)
+			shapes.push_back(shape->Get());
+	}
+
+	for (auto& ll : mLightShapes)
+		mTransformTargets[ll.first].shapes.push_back(ll.second->Get());
+
+	for (auto& ll : mLights)
+		mTransformTargets[ll.first].lights.push_back(ll.second->Get());
+
+	for (auto& pp : mPortals)
+		mTransformTargets[pp.first].shapes.push_back(pp.second);
+
+	mTransformTargetsValid = true;
+}
+
+void Synchronizer::InvalidateTransformTargets()
+{
+	if (mTransformTargetsValid)
+	{
+		// also releases our references to objects which may have been removed from the scene
+		mTransformTargets.clear();
+		mTransformTargetsValid = false;
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Called when a node is being deleted
 //
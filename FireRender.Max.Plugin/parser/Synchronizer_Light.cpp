@@ -1273,10 +1273,10 @@ bool Synchronizer::MAXEnvironmentNeedsUpdate()
 	BOOL bgtexuse = GetCOREInterface()->GetUseEnvironmentMap();
 	Point3 bgColor = GetCOREInterface()->GetBackGround(mBridge->t(), Interval());
 	HashValue bgHash;
-	std::map<Animatable*, HashValue> hash_visited;
+	MaterialHashMemo hashMemo;
 	DWORD syncTimestamp = 0;
 	if (bgtex && bgtexuse)
-		bgHash << mtlParser.GetHashValue(bgtex, mBridge->t(), hash_visited, syncTimestamp);
+		bgHash << mtlParser.GetHashValue(bgtex, mBridge->t(), hashMemo, syncTimestamp);
 
 	bool rebuild = mMAXEnvironmentForceRebuild;
 	mMAXEnvironmentForceRebuild = false;
@@ -1329,8 +1329,12 @@ void Synchronizer::UpdateEnvironmentImage()
 {
 	frw::Image enviroImage;
 
+	// Environment maps aren't referenced by the synchronizer, so changes to them don't reach the material hashes
 	if (mMAXEnvironmentUse && mMAXEnvironment)
+	{
+		mtlParser.InvalidateHash(mMAXEnvironment);
 		enviroImage = mtlParser.createImageFromMap(mMAXEnvironment, MAP_FLAG_WANTSHDR);
+	}
 	else
 		enviroImage = CreateColorEnvironment(mEnvironmentColor);
 
@@ -1496,6 +1500,7 @@ void Synchronizer::UpdateRPREnvironment()
 	{
 		if (bgMap)
 		{
+			mtlParser.InvalidateHash(bgMap);
 			enviroImage = mtlParser.createImageFromMap(bgMap, MAP_FLAG_WANTSHDR);
 		}
 		else
@@ -1506,11 +1511,13 @@ void Synchronizer::UpdateRPREnvironment()
 	if (bgReflMap)
 	{
 		enviroReflMap = bgReflMap;
+		mtlParser.InvalidateHash(bgReflMap);
 		enviroReflImage = mtlParser.createImageFromMap(bgReflMap, MAP_FLAG_NOFLAGS);
 	}
 	if (bgRefrMap)
 	{
 		enviroRefrMap = bgRefrMap;
+		mtlParser.InvalidateHash(bgRefrMap);
 		enviroRefrImage = mtlParser.createImageFromMap(bgRefrMap, MAP_FLAG_NOFLAGS);
 	}
 
@@ -1660,6 +1667,7 @@ void Synchronizer::UpdateRPREnvironment()
 			}
 		}
 	
+		mtlParser.InvalidateHash(map);
 		auto image = mtlParser.createImageFromMap(map, MAP_FLAG_WANTSHDR);
 	
 		if (useIBL)
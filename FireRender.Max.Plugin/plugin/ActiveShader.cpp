@@ -111,7 +111,8 @@ private:
 	CriticalSection bufSec;
 	Event eRestart;
 
-	bool DumpFrameBuffer(bool force);
+	// dirtyRect: if set, only this part of the bitmap is updated
+	bool DumpFrameBuffer(bool force, const BitmapRect* dirtyRect);
 
 	CriticalSection cameraSec;
 	Event cameraChanged;
@@ -128,8 +129,30 @@ private:
 	
 	ActiveShader *activeShader;
 
+	// idle loop: while there is nothing to render, the worker blocks on the events that may give it work instead of spinning
+	static const DWORD IdleWaitTimeout = 100; // ms, fallback for state changes which don't fire any event
+	Event wakeUp; // fired when the output bitmap or the render limits change
+	std::atomic<DWORD> cameraChangedAt = 0; // tick count of the oldest camera change not picked up by the worker yet
+	AccumulationTimer idleTimer;
+	unsigned int idleWaits = 0;
+	unsigned int cameraWakes = 0;
+	DWORD cameraWakeLatencySum = 0;
+	DWORD cameraWakeLatencyMax = 0;
+
 private:
 	void SetupCamera(const ParsedView& view, const int imageWidth, const int imageHeight, rpr_camera outCamera);
+
+	// blocks until the thread is stopped, one of the given events is signalled or IdleWaitTimeout elapses
+	void WaitIdle(const std::vector<Event*>& events);
+
+	void ReportIdleStats(DWORD wallTime);
+
+	inline void OnCameraChanged()
+	{
+		DWORD expected = 0; // zero means no pending change, hence the lowest bit is forced on
+		cameraChangedAt.compare_exchange_strong(expected, GetTickCount() | 1);
+		cameraChanged.Fire();
+	}
 	
 public:
 
@@ -197,7 +220,10 @@ public:
 		bool reset = (checkReset && (uval > timeLimit));
 		timeLimit = uval;
 		if (reset)
+		{
 			terminationReached.Reset();
+			wakeUp.Fire();
+		}
 	}
 
 	inline void SetPassLimit(int val)
@@ -208,7 +234,10 @@ public:
 		bool reset = (checkReset && (val > passLimit));
 		passLimit = val;
 		if (reset)
+		{
 			terminationReached.Reset();
+			wakeUp.Fire();
+		}
 	}
 
 	inline void SetLimitType(int type)
@@ -219,6 +248,12 @@ public:
 	inline void ResetTermination()
 	{
 		terminationReached.Reset();
+		wakeUp.Fire();
+	}
+
+	inline void OutputBitmapChanged()
+	{
+		wakeUp.Fire();
 	}
 
 	explicit ActiveShadeRenderCore(ActiveShader *pActiveShader, frw::Scope rscope, ActiveShadeBitmapWriter *pwriter,
@@ -238,7 +273,7 @@ public:
 			cameraSec.Lock();
 			curView = view;
 			cameraSec.Unlock();
-			cameraChanged.Fire();
+			OnCameraChanged();
 			return true;
 		}
 		return false;
@@ -251,7 +286,7 @@ public:
 			cameraSec.Lock();
 			curView.tm = tm;
 			cameraSec.Unlock();
-			cameraChanged.Fire();
+			OnCameraChanged();
 			return true;
 		}
 		return false;
@@ -333,7 +368,9 @@ void ActiveShadeBitmapWriter::TryBlitToWindow()
 	{
 		thread->StartBlit();
 
-		mActiveShader->mIfr->pIIRenderMgr->UpdateDisplay(); // blit
+		// sessions driven directly (e.g. by the auto-tester) have no render manager to display the bitmap
+		if (auto renderMgr = mActiveShader->mIfr->pIIRenderMgr)
+			renderMgr->UpdateDisplay(); // blit
 		
 		thread->EndBlit();
 	}
@@ -343,7 +380,7 @@ void ActiveShadeBitmapWriter::TryBlitToWindow()
 // RENDER CORE IMPLEMENTATION
 //
 
-bool ActiveShadeRenderCore::DumpFrameBuffer(bool force)
+bool ActiveShadeRenderCore::DumpFrameBuffer(bool force, const BitmapRect* dirtyRect)
 {
 	if (force)
 		bufSec.Lock();
@@ -374,10 +411,10 @@ bool ActiveShadeRenderCore::DumpFrameBuffer(bool force)
 	}
 
 	float exposure = IsReal(this->exposure) ? this->exposure : 1.f;
-	CompositeFrameBuffersToBitmap(colorData, alphaData, outputBitmap, exposure, isNormals, false);
+	CompositeFrameBuffersToBitmap(colorData, alphaData, outputBitmap, exposure, isNormals, false, dirtyRect);
 
 	if (this->useMaxTonemapper)
-		UpdateBitmapWithToneOperator(outputBitmap);
+		UpdateBitmapWithToneOperator(outputBitmap, dirtyRect);
 
 	bufSec.Unlock();
 
@@ -496,11 +533,65 @@ void ActiveShadeRenderCore::SetupCamera(const ParsedView& view, const int imageW
 	}
 }
 
+void ActiveShadeRenderCore::WaitIdle(const std::vector<Event*>& events)
+{
+	WaitMultiple waiter;
+	waiter.AddObject(mStop);
+	for (auto ev : events)
+		waiter.AddObject(*ev);
+
+	idleTimer.Start();
+	int index = waiter.Wait(IdleWaitTimeout);
+	idleTimer.Stop();
+	idleWaits++;
+
+	// waiting consumes auto-reset events: signal the one we woke on again, so that the render loop still sees it
+	if (index == 0)
+		mStop.Fire();
+	else if (index > 0 && index <= int(events.size()) && events[index - 1]->IsAutoReset())
+		events[index - 1]->Fire();
+}
+
+void ActiveShadeRenderCore::ReportIdleStats(DWORD wallTime)
+{
+	// CPU time spent by this thread, compared to the wall time it ran for
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	ULONGLONG cpuTime = 0;
+	if (GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+	{
+		ULARGE_INTEGER kernel = { kernelTime.dwLowDateTime, kernelTime.dwHighDateTime };
+		ULARGE_INTEGER user = { userTime.dwLowDateTime, userTime.dwHighDateTime };
+		cpuTime = (kernel.QuadPart + user.QuadPart) / 10000; // 100ns units to ms
+	}
+
+	ActiveShadeIdleStats& stats = activeShader->mLastIdleStats;
+	stats.wallTime = wallTime;
+	stats.cpuTime = DWORD(cpuTime);
+	stats.idleTime = idleTimer.GetElapsed();
+	stats.idleWaits = idleWaits;
+	stats.cameraWakes = cameraWakes;
+	stats.cameraWakeLatencyAvg = cameraWakes ? cameraWakeLatencySum / cameraWakes : 0;
+	stats.cameraWakeLatencyMax = cameraWakeLatencyMax;
+
+	wchar_t buf[256 + 1];
+	wsprintf(buf, L"ActiveShade: ran %u ms, cpu %u ms, idle %u ms in %u waits, camera wake latency avg %u ms max %u ms (%u changes)\n",
+		stats.wallTime, stats.cpuTime, stats.idleTime, stats.idleWaits, stats.cameraWakeLatencyAvg, stats.cameraWakeLatencyMax,
+		stats.cameraWakes);
+	debugPrint(buf);
+}
+
 void ActiveShadeRenderCore::Worker()
 {
 	ScopeFireEventOnExit exitEvent(mRenderThreadExit);
 
 	AccumulationTimer timer;
+	const DWORD startedAt = GetTickCount();
+
+	idleTimer.Reset();
+	idleWaits = 0;
+	cameraWakes = 0;
+	cameraWakeLatencySum = 0;
+	cameraWakeLatencyMax = 0;
 
 	passesDone = 0;
 	restartsDone = 0;
@@ -509,6 +600,7 @@ void ActiveShadeRenderCore::Worker()
 
 	bool useRegion = false;
 	int rxmin = 0, rxmax = 0, rymin = 0, rymax = 0;
+	bool fullBlit = true; // the whole bitmap is blitted after it is resized or the region changes, later only the region
 
 	int prevbmw = 0;
 	int prevbmh = 0;
@@ -533,11 +625,21 @@ void ActiveShadeRenderCore::Worker()
 			break;
 		}
 
+		// consumed before the state it stands for is checked below, so that a change made from now on wakes the next wait
+		wakeUp.Wait(0);
+
+		// another render (e.g. the material editor) holds the context
 		if (ActiveShader::mGlobalLocker.Wait(0))
+		{
+			WaitIdle({ &ActiveShader::mGlobalLocker.Released() });
 			continue;
+		}
 
 		if (!mShaderCacheReady.Wait(0))
+		{
+			WaitIdle({ &mShaderCacheReady });
 			continue;
+		}
 
 		outputBitmap = activeShader->GetOutputBitmap().load();
 		if (outputBitmap)
@@ -630,16 +732,29 @@ void ActiveShadeRenderCore::Worker()
 				}
 				prevbmw = w;
 				prevbmh = h;
+				fullBlit = true;
 				eRestart.Fire();
 			}
 		}
 		else
+		{
+			WaitIdle({ &wakeUp });
 			continue; // activeshade doesn't render offline
+		}
 
 		if (cameraChanged.Wait(0))
 		{
 			if (outputBitmap)
 			{
+				DWORD changedAt = cameraChangedAt.exchange(0);
+				if (changedAt)
+				{
+					DWORD latency = GetTickCount() - changedAt;
+					cameraWakeLatencySum += latency;
+					cameraWakeLatencyMax = std::max(cameraWakeLatencyMax, latency);
+					cameraWakes++;
+				}
+
 				cameraSec.Lock();
 				SetupCamera(curView, outputBitmap->Width(), outputBitmap->Height(), activeShader->camera[0].Handle());
 				cameraSec.Unlock();
@@ -659,6 +774,7 @@ void ActiveShadeRenderCore::Worker()
 			rymin = ymin;
 			rymax = ymax;
 			regionSec.Unlock();
+			fullBlit = true;
 		}
 
 		// RESTART?
@@ -673,7 +789,10 @@ void ActiveShadeRenderCore::Worker()
 		}
 
 		if (terminationReached.Wait(0))
+		{
+			WaitIdle({ &eRestart, &cameraChanged, &regionChanged, &frameBufferAlphaEnable, &frameBufferAlphaDisable, &wakeUp });
 			continue;
+		}
 
 		if (clearFramebuffer)
 		{
@@ -742,9 +861,11 @@ void ActiveShadeRenderCore::Worker()
 		// BLIT
 		if (rendered)
 		{
-			bool fbDumped = DumpFrameBuffer(false);
+			const BitmapRect regionRect(rxmin, rymin, rxmax, rymax);
+			bool fbDumped = DumpFrameBuffer(false, (useRegion && !fullBlit) ? &regionRect : nullptr);
 			if (fbDumped)
 			{
+				fullBlit = false;
 				writer->bm = outputBitmap;
 				writer->vfbUpdated.Fire();
 			}
@@ -773,6 +894,9 @@ void ActiveShadeRenderCore::Worker()
 		}
 	
 	}
+
+	ReportIdleStats(GetTickCount() - startedAt);
+
 	if (frameBufferMain)
 	{
 		scope.DestroyFrameBuffer(FramebufferTypeId_Color);
@@ -973,6 +1097,8 @@ void ActiveShader::End()
 void ActiveShader::SetOutputBitmap(Bitmap *pDestBitmap)
 {
 	mOutputBitmap = pDestBitmap;
+	if (mRenderThread)
+		mRenderThread->OutputBitmapChanged();
 }
 
 std::atomic<Bitmap*> &ActiveShader::GetOutputBitmap()
@@ -1081,6 +1207,17 @@ BOOL ActiveShader::AnyUpdatesPending()
 	return FALSE;
 }
 
+void ActiveShader::GetProgress(unsigned int& passesDone, unsigned int& restartsDone) const
+{
+	passesDone = mRenderThread ? mRenderThread->passesDone.load() : 0;
+	restartsDone = mRenderThread ? mRenderThread->restartsDone.load() : 0;
+}
+
+const ActiveShadeIdleStats& ActiveShader::GetLastIdleStats() const
+{
+	return mLastIdleStats;
+}
+
 BOOL ActiveShader::IsRendering()
 {
 	// the proper way would be to execute the commented code below
@@ -76,11 +76,24 @@ protected:
 	class ActiveShader *mActiveShader;
 };
 
+/// Counters of the render thread of an ActiveShade session, kept after the session ends
+struct ActiveShadeIdleStats
+{
+	DWORD wallTime = 0; // ms the render thread ran
+	DWORD cpuTime = 0; // ms of CPU time used by the render thread
+	DWORD idleTime = 0; // ms the render thread was blocked waiting for work
+	unsigned int idleWaits = 0;
+	unsigned int cameraWakes = 0; // camera changes picked up by the render thread
+	DWORD cameraWakeLatencyAvg = 0; // ms from a camera change to the render thread picking it up
+	DWORD cameraWakeLatencyMax = 0;
+};
+
 class ActiveShader
 {
 friend class ActiveShadeSynchronizer;
 friend class ActiveShadeSynchronizerBridge;
 friend class ActiveShadeBitmapWriter;
+friend class ActiveShadeRenderCore;
 private:
 	class ActiveShadeRenderCore *mRenderThread;
 	ScopeID mScopeId;
@@ -105,6 +118,8 @@ private:
 
 	ActiveShadeSynchronizerBridge *mBridge = 0;
 
+	ActiveShadeIdleStats mLastIdleStats; // written by the render thread when it exits
+
 public:
 	class IFireRender *mIfr;
 	std::vector<frw::Camera> camera;
@@ -155,6 +170,12 @@ public:
 	BOOL AnyUpdatesPending();
 
 	BOOL IsRendering();
+
+	/// Passes rendered since the last restart, and restarts since the session began
+	void GetProgress(unsigned int& passesDone, unsigned int& restartsDone) const;
+
+	/// Counters of the last session which ended
+	const ActiveShadeIdleStats& GetLastIdleStats() const;
 };
 
 FIRERENDER_NAMESPACE_END;
\ No newline at end of file
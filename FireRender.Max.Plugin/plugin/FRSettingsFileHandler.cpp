@@ -25,6 +25,15 @@ const std::string FRSettingsFileHandler::DevicesName = "DevicesName";
 const std::string FRSettingsFileHandler::DevicesSelected = "DevicesSelected";
 const std::string FRSettingsFileHandler::OverrideCPUThreadCount = "OverrideCPUThreadCount";
 const std::string FRSettingsFileHandler::CPUThreadCount = "CPUThreadCount";
+const std::string FRSettingsFileHandler::MeshCompaction = "MeshCompaction";
+const std::string FRSettingsFileHandler::GeometryCache = "GeometryCache";
+const std::string FRSettingsFileHandler::GeometryCacheSize = "GeometryCacheSize";
+const std::string FRSettingsFileHandler::SyncTimeBudget = "SyncTimeBudget";
+const std::string FRSettingsFileHandler::MotionBlurSamples = "MotionBlurSamples";
+const std::string FRSettingsFileHandler::TileSize = "TileSize";
+const std::string FRSettingsFileHandler::ShadowCatcherCpuComposite = "ShadowCatcherCpuComposite";
+const std::string FRSettingsFileHandler::ImageCacheBudget = "ImageCacheBudget";
+const std::string FRSettingsFileHandler::DeferredTextures = "DeferredTextures";
 
 std::string FRSettingsFileHandler::settingsFolder = "";
 
@@ -27,6 +27,15 @@ public:
 	static const std::string DevicesSelected;
 	static const std::string OverrideCPUThreadCount;
 	static const std::string CPUThreadCount;
+	static const std::string MeshCompaction;
+	static const std::string GeometryCache;
+	static const std::string GeometryCacheSize;
+	static const std::string SyncTimeBudget;
+	static const std::string MotionBlurSamples;
+	static const std::string TileSize;
+	static const std::string ShadowCatcherCpuComposite;
+	static const std::string ImageCacheBudget;
+	static const std::string DeferredTextures;
 
 	static std::string getAttributeSettingsFor(const std::string &attributeName);
 
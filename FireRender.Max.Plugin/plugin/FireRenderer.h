@@ -110,6 +110,11 @@ public:
 		return false;
 	}
 
+	ActiveShader* GetActiveShader() const
+	{
+		return mActiveShader;
+	}
+
 	IParamBlock2* GetParamBlock(int i) override;
 
 	RefResult NotifyRefChanged(const Interval &, RefTargetHandle, PartID &, RefMessage, BOOL) override
@@ -23,6 +23,8 @@ limitations under the License.
 #include "FireRenderMaterialMtl.h"
 #include "CamManager.h"
 #include "TMManager.h"
+#include "plugin/FRSettingsFileHandler.h"
+#include "parser/MeshSplitter.h"
 #include "RadeonProRender.h"
 #include "RprLoadStore.h"
 #include <wingdi.h>
@@ -34,6 +36,7 @@ limitations under the License.
 #include  <cctype>
 
 #include <mutex>
+#include <condition_variable>
 #include <ctime>
 #include <iomanip>
 
@@ -57,6 +60,150 @@ inline std::wstring makeExportFileName(const std::wstring & name, const unsigned
 	return std::wstring(wname.begin(), wname.begin() + offset) + std::wstring(_T("_")) + std::to_wstring(nFrame) + std::wstring(wname.begin() + offset, wname.end());
 }
 
+// Inputs of the shadow catcher composite taken from the shadow catcher material
+struct ShadowCatcherParams
+{
+	float color[4] = {}; // shadow color, with the opacity in alpha
+	float weight = 0.0f;
+	bool bgIsEnv = false;
+
+	ShadowCatcherParams() = default;
+
+	explicit ShadowCatcherParams(const frw::Shader& shader)
+	{
+		float a = 0.0f;
+		shader.GetShadowColor(&color[0], &color[1], &color[2], &a);
+
+		// We have "Shadow Transparency" parameter in Shadow Catcher, but not "Shadow opacity"
+		// It means we should invert this parameter
+		color[3] = 1.0f - a;
+
+		weight = shader.GetShadowWeight();
+
+		//Setting BgIsEnv to false means that we should use shadow catcher color instead of environment background
+		bgIsEnv = shader.BgIsEnv();
+	}
+};
+
+// Composite graph combining the rendered image with the shadow catcher AOV. It is built once per render; between passes only
+// the constant inputs coming from the shadow catcher material are updated, and only when they change.
+class ShadowCatcherComposite
+{
+public:
+	ShadowCatcherComposite(rpr_context context, rpr_framebuffer color, rpr_framebuffer background, rpr_framebuffer opacity,
+		rpr_framebuffer shadowCatcher) :
+		compositeBg(context, RPR_COMPOSITE_FRAMEBUFFER),
+		compositeColor(context, RPR_COMPOSITE_FRAMEBUFFER),
+		compositeOpacity(context, RPR_COMPOSITE_FRAMEBUFFER),
+		compositeBgNorm(context, RPR_COMPOSITE_NORMALIZE),
+		compositeColorNorm(context, RPR_COMPOSITE_NORMALIZE),
+		compositeOpacityNorm(context, RPR_COMPOSITE_NORMALIZE),
+		compositeLerp1(context, RPR_COMPOSITE_LERP_VALUE),
+		compositeShadowCatcher(context, RPR_COMPOSITE_FRAMEBUFFER),
+		compositeShadowColor(context, RPR_COMPOSITE_CONSTANT),
+		compositeShadowWeight(context, RPR_COMPOSITE_CONSTANT),
+		compositeShadowCatcherNorm(context, RPR_COMPOSITE_NORMALIZE),
+		compositeSCWeight(context, RPR_COMPOSITE_ARITHMETIC),
+		compositeLerp2(context, RPR_COMPOSITE_LERP_VALUE)
+	{
+		// Step 1.
+		// Combine normalized color, background and opacity AOVs using lerp
+		compositeBg.SetInputFb("framebuffer.input", background);
+		compositeColor.SetInputFb("framebuffer.input", color);
+		compositeOpacity.SetInputFb("framebuffer.input", opacity);
+
+		compositeBgNorm.SetInputC("normalize.color", compositeBg);
+		compositeColorNorm.SetInputC("normalize.color", compositeColor);
+		compositeOpacityNorm.SetInputC("normalize.color", compositeOpacity);
+
+		compositeLerp1.SetInputC("lerp.color0", compositeBgNorm);
+		compositeLerp1.SetInputC("lerp.color1", compositeColorNorm);
+		compositeLerp1.SetInputC("lerp.weight", compositeOpacityNorm);
+
+		// Step 2.
+		// Combine result from step 1, shadow color and normalized shadow catcher AOV
+		compositeShadowCatcher.SetInputFb("framebuffer.input", shadowCatcher);
+
+		compositeShadowCatcherNorm.SetInputC("normalize.color", compositeShadowCatcher);
+		rprCompositeSetInput1u(compositeShadowCatcherNorm, "normalize.aovtype", RPR_AOV_SHADOW_CATCHER);
+
+		compositeSCWeight.SetInputC("arithmetic.color0", compositeShadowCatcherNorm);
+		compositeSCWeight.SetInputC("arithmetic.color1", compositeShadowWeight);
+		compositeSCWeight.SetInputOp("arithmetic.op", RPR_MATERIAL_NODE_OP_MUL);
+
+		compositeLerp2.SetInputC("lerp.color1", compositeShadowColor);
+		compositeLerp2.SetInputC("lerp.weight", compositeSCWeight);
+	}
+
+	/// Sets the inputs of the material; inputs equal to the ones already set are left alone
+	void SetParams(const ShadowCatcherParams& params)
+	{
+		const float* color = params.color;
+
+		if (!hasParams || !std::equal(color, color + 4, current.color))
+			compositeShadowColor.SetInput4f("constant.input", color[0], color[1], color[2], color[3]);
+
+		if (!hasParams || params.weight != current.weight)
+			compositeShadowWeight.SetInput4f("constant.input", params.weight, params.weight, params.weight, params.weight);
+
+		if (!hasParams || params.bgIsEnv != current.bgIsEnv)
+			compositeLerp2.SetInputC("lerp.color0", params.bgIsEnv ? compositeLerp1 : compositeColorNorm);
+
+		current = params;
+		hasParams = true;
+	}
+
+	/// Step 3.
+	/// Computes the graph into a separate framebuffer
+	rpr_int Compute(rpr_framebuffer output)
+	{
+		FASSERT(hasParams);
+		return rprCompositeCompute(compositeLerp2, output);
+	}
+
+private:
+	RprComposite compositeBg;
+	RprComposite compositeColor;
+	RprComposite compositeOpacity;
+	RprComposite compositeBgNorm;
+	RprComposite compositeColorNorm;
+	RprComposite compositeOpacityNorm;
+	RprComposite compositeLerp1;
+	RprComposite compositeShadowCatcher;
+	RprComposite compositeShadowColor;
+	RprComposite compositeShadowWeight;
+	RprComposite compositeShadowCatcherNorm;
+	RprComposite compositeSCWeight;
+	RprComposite compositeLerp2;
+
+	ShadowCatcherParams current;
+	bool hasParams = false;
+};
+
+// Part of a compiled render stamp template. Fields which don't change during the render (hardware, scene counts, versions) are
+// expanded into Text tokens when the template is compiled, only the others are formatted again for each stamp.
+struct StampToken
+{
+	enum Type
+	{
+		Text,
+		ElapsedTime, // %pt
+		Passes, // %pp
+		Date, // %d
+	};
+
+	Type type;
+	std::wstring text; // text of the strip
+	TextStrip strip;
+	bool isRasterized = false;
+
+	explicit StampToken(Type type, const std::wstring& text = std::wstring()) :
+		type(type),
+		text(text)
+	{
+	}
+};
+
 class ProductionRenderCore : public BaseThread
 {
 public:
@@ -73,12 +220,16 @@ public:
 		std::vector<float> alphaData;
 		float timePassed;
 		int passesDone;
+		BitmapRect dirtyRect; // part of the image the render calls have updated
+		int tile = -1; // index of the tile the data holds in tiled mode, -1 otherwise
 	};
 
+	// size of the frame buffers; in tiled mode the size of a tile, not of the image
 	int width;
 	int height;
 
 	bool isShadowCatcherEnabled;
+	bool isShadowCatcherOnCpu; // composite the shadow catcher in RPRCopyFrameData instead of with the RPR composite graph
 	bool isAlphaEnabled;
 	bool isDenoiserEnabled;
 	bool isAdaptiveEnabled;
@@ -94,10 +245,21 @@ public:
 	rpr_int errorCode = RPR_SUCCESS;
 	TerminationResult result;
 
-	std::unique_ptr<FrameDataBuffer> pLastFrameData;
+	// Ring of three frame data buffers, reused for the whole render so that no pixel data is allocated per pass. The render
+	// thread fills the write buffer and swaps it with the ready one; the helper thread swaps the ready buffer with its read
+	// buffer. Only the indices are exchanged, under frameDataBuffersLock.
+	FrameDataBuffer frameDataRing[3];
+	int frameDataWrite = 0;
+	int frameDataReady = 1;
+	int frameDataRead = 2;
+	bool isFrameDataReady = false; // the ready buffer holds a frame not taken by the helper thread yet
 
 	std::atomic<int> lastFrameDataWritedCount;
 
+	// frame buffer readback
+	std::atomic<int> refreshInterval; // minimal milliseconds between two readbacks, the last pass is always read back
+	std::atomic<int> framesReadBack;
+
 	std::atomic<bool> isNormals;
 	std::atomic<bool> isToneOperatorPreviewRender;
 	std::atomic<bool> doRenderStamp;
@@ -107,11 +269,22 @@ public:
 	std::atomic<bool> useMaxTonemapper;
 	std::atomic<bool> regionMode;
 	Box2 region;
+	BitmapRect renderRect; // pixels updated by each render call: the region in region mode, the whole image otherwise
+
+	// Tiled mode: the image is rendered as a sequence of tiles, each into the same tile sized frame buffers, with the camera
+	// narrowed down to the part of the image the tile covers. The tiles are assembled in the output bitmap as they are read back.
+	std::vector<BitmapRect> tiles; // empty unless rendering tiled
+	int imageWidth = 0;
+	int imageHeight = 0;
+	int currentTile = -1;
+	ParsedView tileView;
+	frw::Camera tileCamera;
 
 	std::mutex frameDataBuffersLock;
 
 	// To ensure that we are finished with RPRCopyFrameData
 	Event rprCopyFrameDataDoneEvent;
+	Event frameDataTakenEvent; // fired by the helper thread when it takes the ready buffer, and on abort
 
 	ImageFilter* mDenoiser = nullptr;
 
@@ -127,6 +300,10 @@ public:
 	frw::FrameBuffer frameBufferBackground;
 	frw::FrameBuffer frameBufferComposite;
 	frw::FrameBuffer frameBufferCompositeResolve;
+	frw::FrameBuffer frameBufferBackgroundResolve;
+	std::unique_ptr<ShadowCatcherComposite> shadowCatcherComposite; // destroyed before the frame buffers it reads
+	std::vector<float> shadowCatcherData;
+	std::vector<float> backgroundData;
 
 	// denoiser buffers (doesn't need normilezed copies because they are equal to the original ones)
 	frw::FrameBuffer frameBufferShadingNormal;
@@ -145,6 +322,12 @@ private:
 
 	void SaveFrameData(void);
 	void RPRCopyFrameData(void);
+	void CompositeOutputCpu(FrameDataBuffer& frameData);
+
+	void ClearFramebuffers();
+	void RenderTiles();
+	bool IsTileConverged();
+	bool WaitForFrameDataTaken(int tile);
 
 	mutable struct StampCachedData
 	{
@@ -159,11 +342,27 @@ private:
 		bool hasGpuContext = false;
 		bool hasCpuContext = false;
 		bool isCacheCreated = false;
+
+		// the stamp template compiled by CompileStamp
+		std::wstring format;
+		std::vector<StampToken> tokens;
+		std::unique_ptr<TextRasterizer> rasterizer;
+
+		// buffers reused by each RenderStamp call
+		std::vector<float> stampPixels;
+		std::vector<BMM_Color_fl> row;
+
+		// bitmap pixels under the last stamp, as they were before blending
+		std::vector<BMM_Color_fl> background;
+		BitmapRect backgroundRect;
 	} m_stampCachedData;
 
+	void CompileStamp() const;
+	void RestoreStampBackground(Bitmap* DstBuffer) const;
+
 public:
 	bool CopyFrameDataToBitmap(::Bitmap* bitmap);
-	void RenderStamp(Bitmap* DstBuffer, std::unique_ptr<ProductionRenderCore::FrameDataBuffer>& frameData) const;
+	void RenderStamp(Bitmap* DstBuffer, const ProductionRenderCore::FrameDataBuffer& frameData) const;
 
 	explicit ProductionRenderCore(frw::Scope rscope, int width, int height,
 		bool bRenderAlpha, bool bDenoiserEnabled, bool bAdaptiveEnabled,
@@ -171,17 +370,34 @@ public:
 
 	void InitFramebuffers();
 
+	/// Switches to tiled mode: the frame buffers are tile sized, and the image of given size is rendered tile by tile through
+	/// the camera, which must have been set up for the whole image by PRManagerMax::SetupCamera
+	void SetTiles(int imageWidth, int imageHeight, const ParsedView& view, frw::Camera camera);
+
+	inline int GetTileCount() const
+	{
+		return int_cast(tiles.size());
+	}
+
+	std::atomic<int> tilesDone;
+
 	void Worker() override;
 
 	void Done(TerminationResult res, rpr_int err)
 	{
 		rprCopyFrameDataDoneEvent.Wait();
 
+		wchar_t readbackStr[256 + 1] = {};
+		wsprintf(readbackStr, L"ProductionRenderCore: %d passes rendered, %d frames read back", int(passesDone), int(framesReadBack));
+		debugPrint(readbackStr);
+
 		errorCode = err;
 		rpr_int errorCode = RPR_SUCCESS;
 		result = res;
 		PRManagerMaxDone.Fire();
 
+		shadowCatcherComposite.reset();
+
 		if(bImmediateAbort)
 			scope.DestroyFrameBuffers();
 	}
@@ -190,6 +406,7 @@ public:
 	{
 		BaseThread::AbortImmediate();
 		bImmediateAbort = true;
+		frameDataTakenEvent.Fire();
 	}
 
 	void Restart();
@@ -205,34 +422,49 @@ public:
 void ProductionRenderCore::RPRCopyFrameData()
 {
 	// get data from RPR and put it to back buffer
-	std::unique_ptr<ProductionRenderCore::FrameDataBuffer> tmpFrameData = std::make_unique<ProductionRenderCore::FrameDataBuffer>();
+	FrameDataBuffer& frameData = frameDataRing[frameDataWrite];
 
 	if (isShadowCatcherEnabled)
 	{
-		tmpFrameData->colorData = frameBufferCompositeResolve.GetPixelData();
+		if (isShadowCatcherOnCpu)
+			frameBufferColorResolve.GetPixelData(frameData.colorData);
+		else
+			frameBufferCompositeResolve.GetPixelData(frameData.colorData);
 	}
 	else if (mDenoiser)
 	{
-		tmpFrameData->colorData = mDenoiser->GetData();
+		frameData.colorData = mDenoiser->GetData();
 	}
 	else
 	{
-		tmpFrameData->colorData = frameBufferColorResolve.GetPixelData();
+		frameBufferColorResolve.GetPixelData(frameData.colorData);
 	}
 
 	// get alpha
 	if (frameBufferAlpha)
 	{
-		tmpFrameData->alphaData = frameBufferAlphaResolve.GetPixelData();
+		frameBufferAlphaResolve.GetPixelData(frameData.alphaData);
+	}
+	else
+	{
+		frameData.alphaData.clear();
+	}
+
+	if (isShadowCatcherEnabled && isShadowCatcherOnCpu)
+	{
+		CompositeOutputCpu(frameData);
 	}
 
 	// Save additional frame data
-	tmpFrameData->timePassed = timePassed;
-	tmpFrameData->passesDone = passesDone;
+	frameData.timePassed = timePassed;
+	frameData.passesDone = passesDone;
+	frameData.dirtyRect = renderRect;
+	frameData.tile = currentTile;
 
 	// Swap new frame with the old one in the buffer
 	frameDataBuffersLock.lock();
-	pLastFrameData = std::move(tmpFrameData);
+	std::swap(frameDataWrite, frameDataReady);
+	isFrameDataReady = true;
 	frameDataBuffersLock.unlock();
 
 	rprCopyFrameDataDoneEvent.Fire();
@@ -248,6 +480,12 @@ void ProductionRenderCore::SaveFrameData()
 			CompositeOutput(false);
 			frameBufferComposite.Resolve(frameBufferCompositeResolve);
 		}
+		else if (isShadowCatcherEnabled)
+		{
+			// composited in RPRCopyFrameData; the shadow catcher AOV needs its own normalization, so it is read unresolved
+			frameBufferColor.Resolve(frameBufferColorResolve);
+			frameBufferBackground.Resolve(frameBufferBackgroundResolve);
+		}
 		else
 		{
 			frameBufferColor.Resolve(frameBufferColorResolve);
@@ -265,13 +503,9 @@ void ProductionRenderCore::SaveFrameData()
 			frameBufferAlpha.Resolve(frameBufferAlphaResolve);
 		}
 
-		if( frameBufferVariance )
-		{	// Resolve the Variance AOV, used for Adaptive Sampling with the CMJ sampler
-			frameBufferVariance.Resolve(frameBufferVarianceResolve, true);
-		}
-
 		rprCopyFrameDataDoneEvent.Reset();
 		RPRCopyFrameData();
+		++framesReadBack;
 	}
 	catch (std::exception& e)
 	{
@@ -285,19 +519,42 @@ void ProductionRenderCore::SaveFrameData()
 bool ProductionRenderCore::CopyFrameDataToBitmap(::Bitmap* bitmap)
 {
 	frameDataBuffersLock.lock();
-	std::unique_ptr<ProductionRenderCore::FrameDataBuffer> pFrameData = std::move(pLastFrameData);
+	const bool hasFrameData = isFrameDataReady;
+	if (hasFrameData)
+	{
+		std::swap(frameDataRead, frameDataReady);
+		isFrameDataReady = false;
+	}
 	frameDataBuffersLock.unlock();
 
-	if (pFrameData.get() == nullptr)
+	if (hasFrameData)
+		frameDataTakenEvent.Fire();
+
+	if (!hasFrameData)
 		return false;
 
+	// the read buffer belongs to this thread until the next call
+	FrameDataBuffer& frameData = frameDataRing[frameDataRead];
+
+	// region and tile updates don't rewrite the pixels under the stamp, so they are put back before blending it again
+	RestoreStampBackground(bitmap);
+
 	float _exposure = IsReal((float)exposure) ? (float)exposure : 1.f;
-	CompositeFrameBuffersToBitmap(pFrameData->colorData, pFrameData->alphaData, bitmap, _exposure, isNormals, isToneOperatorPreviewRender);
+	if (frameData.tile >= 0)
+	{
+		CompositeTileToBitmap(frameData.colorData, frameData.alphaData, width, frameData.dirtyRect, bitmap, _exposure, isNormals,
+			isToneOperatorPreviewRender);
+	}
+	else
+	{
+		CompositeFrameBuffersToBitmap(frameData.colorData, frameData.alphaData, bitmap, _exposure, isNormals, isToneOperatorPreviewRender,
+			&frameData.dirtyRect);
+	}
 
 	if (useMaxTonemapper)
-		UpdateBitmapWithToneOperator(bitmap);
+		UpdateBitmapWithToneOperator(bitmap, &frameData.dirtyRect);
 
-	RenderStamp(bitmap, pFrameData);
+	RenderStamp(bitmap, frameData);
 
 	return true;
 }
@@ -322,6 +579,8 @@ ProductionRenderCore::ProductionRenderCore(frw::Scope rscope, int width, int hei
 	term = Termination_None;
 	errorCode = RPR_SUCCESS;
 	lastFrameDataWritedCount = 0;
+	refreshInterval = 0;
+	framesReadBack = 0;
 
 	isNormals = false;
 	isToneOperatorPreviewRender = false;
@@ -331,6 +590,10 @@ ProductionRenderCore::ProductionRenderCore(frw::Scope rscope, int width, int hei
 	exposure = 1.f;
 	useMaxTonemapper = true;
 	regionMode = false;
+	tilesDone = 0;
+
+	// the RPR composite graph is the default, the CPU path is selected in the settings file
+	isShadowCatcherOnCpu = std::atoi(FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::ShadowCatcherCpuComposite).c_str()) != 0;
 
 	// Setup AOVs - first pass (apply AOVs for denoiser, required BEFORE translation)
 	InitFramebuffers();
@@ -381,10 +644,18 @@ void ProductionRenderCore::InitFramebuffers()
 			frameBufferDepth = scope.GetFrameBuffer(width, height, FramebufferTypeId_Depth);
 
 		// buffers for results
-		if( !frameBufferComposite )
-			frameBufferComposite = scope.GetFrameBuffer(width, height, FrameBufferTypeId_Composite);
-		if( !frameBufferCompositeResolve )
-			frameBufferCompositeResolve = scope.GetFrameBuffer(width, height, FrameBufferTypeId_CompositeResolve);
+		if (isShadowCatcherOnCpu)
+		{
+			if( !frameBufferBackgroundResolve )
+				frameBufferBackgroundResolve = scope.GetFrameBuffer(width, height, FrameBufferTypeId_BackgroundResolve);
+		}
+		else
+		{
+			if( !frameBufferComposite )
+				frameBufferComposite = scope.GetFrameBuffer(width, height, FrameBufferTypeId_Composite);
+			if( !frameBufferCompositeResolve )
+				frameBufferCompositeResolve = scope.GetFrameBuffer(width, height, FrameBufferTypeId_CompositeResolve);
+		}
 
 		isAlphaEnabled = true;
 		useMaxTonemapper = false;
@@ -450,87 +721,290 @@ void ProductionRenderCore::InitFramebuffers()
 // Shadow catcher Impl
 void ProductionRenderCore::CompositeOutput(bool flip)
 {
-	unsigned int width = scope.Width();
-	unsigned int height = scope.Height();
+	//Find first shadow catcher shader
+	frw::Shader shadowCatcherShader = scope.GetShadowCatcherShader();
+	assert(shadowCatcherShader);
 
-	frw::Context context = scope.GetContext();
+	if (!shadowCatcherComposite)
+	{
+		shadowCatcherComposite.reset(new ShadowCatcherComposite(scope.GetContext().Handle(), frameBufferColor.Handle(),
+			frameBufferBackground.Handle(), frameBufferAlpha.Handle(), frameBufferShadowCatcher.Handle()));
+	}
 
-	// Step 1.
-	// Combine normalized color, background and opacity AOVs using lerp
-	RprComposite compositeBg(context.Handle(), RPR_COMPOSITE_FRAMEBUFFER);
-	compositeBg.SetInputFb("framebuffer.input", frameBufferBackground.Handle());
+	shadowCatcherComposite->SetParams(ShadowCatcherParams(shadowCatcherShader));
 
-	RprComposite compositeColor(context.Handle(), RPR_COMPOSITE_FRAMEBUFFER);
-	compositeColor.SetInputFb("framebuffer.input", frameBufferColor.Handle());
+	rpr_int status = shadowCatcherComposite->Compute(frameBufferComposite.Handle());
+	FASSERT(RPR_SUCCESS == status);
+}
 
-	RprComposite compositeOpacity(context.Handle(), RPR_COMPOSITE_FRAMEBUFFER);
-	compositeOpacity.SetInputFb("framebuffer.input", frameBufferAlpha.Handle());
+// Same result as CompositeOutput, computed from the resolved color, background and opacity AOVs and the raw shadow catcher AOV.
+// The color and alpha data must have been read already.
+void ProductionRenderCore::CompositeOutputCpu(FrameDataBuffer& frameData)
+{
+	frw::Shader shadowCatcherShader = scope.GetShadowCatcherShader();
+	assert(shadowCatcherShader);
 
-	RprComposite compositeBgNorm(context.Handle(), RPR_COMPOSITE_NORMALIZE);
-	compositeBgNorm.SetInputC("normalize.color", compositeBg);
+	frameBufferBackgroundResolve.GetPixelData(backgroundData);
+	frameBufferShadowCatcher.GetPixelData(shadowCatcherData);
 
-	RprComposite compositeColorNorm(context.Handle(), RPR_COMPOSITE_NORMALIZE);
-	compositeColorNorm.SetInputC("normalize.color", compositeColor);
+	FASSERT(frameData.alphaData.size() == frameData.colorData.size());
+	FASSERT(backgroundData.size() == frameData.colorData.size());
+	FASSERT(shadowCatcherData.size() == frameData.colorData.size());
 
-	RprComposite compositeOpacityNorm(context.Handle(), RPR_COMPOSITE_NORMALIZE);
-	compositeOpacityNorm.SetInputC("normalize.color", compositeOpacity);
+	const ShadowCatcherParams params(shadowCatcherShader);
+	CompositeShadowCatcherPixels(frameData.colorData.data(), backgroundData.data(), frameData.alphaData.data(),
+		shadowCatcherData.data(), frameData.colorData.size() / 4, params.color, params.weight, params.bgIsEnv);
+}
 
-	RprComposite compositeLerp1(context.Handle(), RPR_COMPOSITE_LERP_VALUE);
-	compositeLerp1.SetInputC("lerp.color0", compositeBgNorm);
-	compositeLerp1.SetInputC("lerp.color1", compositeColorNorm);
-	compositeLerp1.SetInputC("lerp.weight", compositeOpacityNorm);
+void ProductionRenderCore::ClearFramebuffers()
+{
+	frameBufferColor.Clear();
 
-	// Step 2.
-	// Combine result from step 1, black color and normalized shadow catcher AOV
-	RprComposite compositeShadowCatcher(context.Handle(), RPR_COMPOSITE_FRAMEBUFFER);
-	compositeShadowCatcher.SetInputFb("framebuffer.input", frameBufferShadowCatcher.Handle());
+	if( frameBufferAlpha )
+	{
+		frameBufferAlpha.Clear();
+	}
 
-	//Find first shadow catcher shader
-	frw::Shader shadowCatcherShader = scope.GetShadowCatcherShader();
-	assert(shadowCatcherShader);
-	
-	float r = 0.0f;
-	float g = 0.0f;
-	float b = 0.0f;
-	float a = 0.0f;
-	
-	shadowCatcherShader.GetShadowColor(&r, &g, &b, &a);
+	if( frameBufferShadowCatcher )
+	{
+		frameBufferShadowCatcher.Clear();
+	}
 
-	float weight = shadowCatcherShader.GetShadowWeight();
+	if( frameBufferBackground )
+	{
+		frameBufferBackground.Clear();
+	}
 
-	RprComposite compositeShadowColor(context.Handle(), RPR_COMPOSITE_CONSTANT);
+	if( frameBufferVariance )
+	{
+		frameBufferVariance.Clear();
+	}
+}
 
-	// We have "Shadow Transparency" parameter in Shadow Catcher, but not "Shadow opacity"
-	// It means we should invert this parameter
-	compositeShadowColor.SetInput4f("constant.input", r, g, b, 1.0f - a);
+// Narrows a camera set up for the whole image by PRManagerMax::SetupCamera down to a window of the image. The sensor (or ortho)
+// size is scaled to the window, and the lens shift, which is in units of the sensor size, moves its center over the window.
+static void SetupTileCamera(const ParsedView& view, int imageWidth, int imageHeight, const BitmapRect& window, rpr_camera outCamera)
+{
+	rpr_int res;
 
-	RprComposite compositeShadowWeight(context.Handle(), RPR_COMPOSITE_CONSTANT);
-	compositeShadowWeight.SetInput4f("constant.input", weight, weight, weight, weight);
+	const float scaleX = float(window.Width()) / float(imageWidth);
+	const float scaleY = float(window.Height()) / float(imageHeight);
 
-	RprComposite compositeShadowCatcherNorm(context.Handle(), RPR_COMPOSITE_NORMALIZE);
-	compositeShadowCatcherNorm.SetInputC("normalize.color", compositeShadowCatcher);
-	rprCompositeSetInput1u(compositeShadowCatcherNorm, "normalize.aovtype", RPR_AOV_SHADOW_CATCHER);
+	if (view.projection == P_ORTHO)
+	{
+		res = rprCameraSetOrthoWidth(outCamera, view.orthoSize * scaleX);
+		FCHECK(res);
+		res = rprCameraSetOrthoHeight(outCamera, view.orthoSize / float(imageWidth) * float(imageHeight) * scaleY);
+		FCHECK(res);
+	}
+	else
+	{
+		res = rprCameraSetSensorSize(outCamera, view.sensorWidth * scaleX, view.sensorWidth / float(imageWidth) * float(imageHeight) * scaleY);
+		FCHECK(res);
+	}
 
-	RprComposite compositeSCWeight(context.Handle(), RPR_COMPOSITE_ARITHMETIC);
-	compositeSCWeight.SetInputC("arithmetic.color0", compositeShadowCatcherNorm);
-	compositeSCWeight.SetInputC("arithmetic.color1", compositeShadowWeight);
-	compositeSCWeight.SetInputOp("arithmetic.op", RPR_MATERIAL_NODE_OP_MUL);
+	// bitmap rows go from the top down, while the y axis of the sensor goes up
+	float shiftX = (0.5f * (window.xmin + window.xmax) / float(imageWidth) - 0.5f) / scaleX;
+	float shiftY = (0.5f - 0.5f * (window.ymin + window.ymax) / float(imageHeight)) / scaleY;
+#ifdef SWITCH_AXES
+	shiftX = -shiftX;
+#endif
 
-	RprComposite compositeLerp2(context.Handle(), RPR_COMPOSITE_LERP_VALUE);
+	res = rprCameraSetLensShift(outCamera, shiftX, shiftY);
+	FCHECK(res);
+}
 
-	//Setting BgIsEnv to false means that we should use shadow catcher color instead of environment background
-	if (shadowCatcherShader.BgIsEnv())
-		compositeLerp2.SetInputC("lerp.color0", compositeLerp1);
-	else
-		compositeLerp2.SetInputC("lerp.color0", compositeColorNorm);
+void ProductionRenderCore::SetTiles(int imageWidth, int imageHeight, const ParsedView& view, frw::Camera camera)
+{
+	this->imageWidth = imageWidth;
+	this->imageHeight = imageHeight;
+	tileView = view;
+	tileCamera = camera;
 
-	compositeLerp2.SetInputC("lerp.color1", compositeShadowColor);
-	compositeLerp2.SetInputC("lerp.weight", compositeSCWeight);
+	tiles.clear();
+	for (int y = 0; y < imageHeight; y += height)
+	{
+		for (int x = 0; x < imageWidth; x += width)
+			tiles.push_back(BitmapRect(x, y, std::min(x + width, imageWidth), std::min(y + height, imageHeight)));
+	}
 
-	// Step 3.
-	// Compute results from step 2 into separate framebuffer
-	rpr_int status = rprCompositeCompute(compositeLerp2, frameBufferComposite.Handle());
-	FASSERT(RPR_SUCCESS == status);
+	// render from the center of the image outwards, where the subject usually is
+	struct DistanceToCenter
+	{
+		float cx, cy;
+
+		inline float operator()(const BitmapRect& tile) const
+		{
+			const float dx = 0.5f * (tile.xmin + tile.xmax) - cx;
+			const float dy = 0.5f * (tile.ymin + tile.ymax) - cy;
+			return dx * dx + dy * dy;
+		}
+	};
+
+	struct CloserToCenter
+	{
+		DistanceToCenter distance;
+
+		inline bool operator()(const BitmapRect& a, const BitmapRect& b) const
+		{
+			return distance(a) < distance(b);
+		}
+	};
+
+	CloserToCenter closer = { { 0.5f * imageWidth, 0.5f * imageHeight } };
+	std::stable_sort(tiles.begin(), tiles.end(), closer);
+}
+
+bool ProductionRenderCore::IsTileConverged()
+{
+	// with adaptive sampling, RPR stops sampling the pixels whose noise is below the threshold
+	if (!isAdaptiveEnabled)
+		return false;
+
+	// cores which can't report the active pixels fail the query; their tiles then keep rendering up to the pass or time limit
+	rpr_int activePixels = -1;
+	rpr_int res = rprContextGetInfo(scope.GetContext().Handle(), RPR_CONTEXT_ACTIVE_PIXEL_COUNT, sizeof(activePixels), &activePixels, nullptr);
+	if (res != RPR_SUCCESS)
+		return false;
+
+	return activePixels == 0;
+}
+
+bool ProductionRenderCore::WaitForFrameDataTaken(int tile)
+{
+	// Unlike passes, tiles don't supersede each other: the last frame read back for a tile has to reach the bitmap before
+	// the frame of another tile takes its place
+	while (true)
+	{
+		frameDataBuffersLock.lock();
+		const bool pending = isFrameDataReady && (frameDataRing[frameDataReady].tile != tile);
+		frameDataBuffersLock.unlock();
+
+		if (!pending)
+			return true;
+
+		if (bImmediateAbort)
+			return false;
+
+		// the event is auto-reset, so a take that happened since the check above leaves it signaled
+		frameDataTakenEvent.Wait();
+	}
+}
+
+void ProductionRenderCore::RenderTiles()
+{
+	// Each tile gets the full pass count. Without a pass limit (time limit or no limit), the time limit is shared evenly
+	// by the tiles, and a render without any limit renders the pass limit per tile instead of refining forever.
+	const unsigned int numPasses = std::max(int(passLimit), 1);
+	const bool limitPasses = (term != Termination_Time);
+	const bool limitTime = (term == Termination_Time) || (term == Termination_PassesOrTime);
+	const DWORD tileTimeLimit = DWORD(std::max<__time64_t>(timeLimit * 1000 / __time64_t(tiles.size()), 1));
+
+	__time64_t startedAt = time(0);
+
+	framesReadBack = 0;
+	tilesDone = 0;
+
+	for (int i = 0; i < int(tiles.size()); ++i)
+	{
+		const BitmapRect& tile = tiles[i];
+
+		// the frame buffers cover a full tile, edge tiles only use their top left part
+		SetupTileCamera(tileView, imageWidth, imageHeight, BitmapRect(tile.xmin, tile.ymin, tile.xmin + width, tile.ymin + height),
+			tileCamera.Handle());
+		const bool partialTile = (tile.Width() < width) || (tile.Height() < height);
+
+		ClearFramebuffers();
+		currentTile = i;
+		renderRect = tile;
+		passesDone = 0;
+
+		int lastPassReadBack = 0;
+		DWORD tileStartedAt = GetTickCount();
+		DWORD lastReadbackTime = tileStartedAt;
+
+		bool tileFinished = false;
+		while (!tileFinished)
+		{
+			// Stop thread
+			if (mStop.Wait(0) || bImmediateAbort)
+			{
+				// keep the passes rendered since the last readback when the user stops the render
+				if (!bImmediateAbort && passesDone > lastPassReadBack && WaitForFrameDataTaken(i))
+					SaveFrameData();
+
+				Done(Result_Aborted, RPR_SUCCESS);
+				return;
+			}
+
+			// Render
+			rpr_int status = RPR_SUCCESS;
+
+			try
+			{
+				frw::Context& ctx = scope.GetContext();
+				status = partialTile ? ctx.RenderTile(0, tile.Width(), 0, tile.Height()) : ctx.Render();
+			}
+			catch (...) // Exception
+			{
+				debugPrint("Exception occurred in render call");
+				Done(Result_Catastrophic, RPR_ERROR_INTERNAL_ERROR);
+				return;
+			}
+
+			// Render failed
+			if (status != RPR_SUCCESS)
+			{
+				Done(Result_Catastrophic, status);
+				return;
+			}
+
+			// Stop thread
+			if (bImmediateAbort)
+			{
+				Done(Result_Aborted, RPR_SUCCESS);
+				return;
+			}
+
+			// One more pass got rendered
+			++passesDone;
+
+			if( frameBufferVariance )
+			{	// Resolve the Variance AOV, used for Adaptive Sampling with the CMJ sampler
+				frameBufferVariance.Resolve(frameBufferVarianceResolve, true);
+			}
+
+			timePassed = time(0) - startedAt;
+
+			DWORD now = GetTickCount();
+			tileFinished = (limitPasses && (unsigned int)passesDone >= numPasses) ||
+				(limitTime && (now - tileStartedAt) >= tileTimeLimit) ||
+				IsTileConverged();
+
+			// Intermediate passes are read back at the refresh rate of the frame buffer window, as in Worker()
+			bool readback = tileFinished;
+			if (!readback && (now - lastReadbackTime) >= DWORD(refreshInterval))
+			{
+				frameDataBuffersLock.lock();
+				readback = !isFrameDataReady;
+				frameDataBuffersLock.unlock();
+			}
+
+			if (readback && WaitForFrameDataTaken(i))
+			{
+				SaveFrameData();
+				lastPassReadBack = passesDone;
+				lastReadbackTime = now;
+			}
+		}
+
+		++tilesDone;
+	}
+
+	// let the helper thread take the last tile before reporting the render as done
+	WaitForFrameDataTaken(-1);
+
+	Done(Result_OK, RPR_SUCCESS);
 }
 
 void ProductionRenderCore::Worker()
@@ -564,14 +1038,31 @@ void ProductionRenderCore::Worker()
 		}
 	}
 
+	renderRect = regionMode ? BitmapRect(xmin, ymin, xmax, ymax) : BitmapRect(0, 0, width, height);
+
 	rprCopyFrameDataDoneEvent.Fire();
 
+	if (!tiles.empty())
+	{
+		RenderTiles();
+		return;
+	}
+
+	// Frame data is read back at the refresh rate of the frame buffer window rather than after every pass
+	framesReadBack = 0;
+	int lastPassReadBack = 0;
+	DWORD lastReadbackTime = GetTickCount();
+
 	// render all passes, unless the render is cancelled (and even then render at least a single pass)
 	while (1)
 	{
 		// Stop thread
 		if (mStop.Wait(0) || bImmediateAbort)
 		{
+			// keep the passes rendered since the last readback when the user stops the render
+			if (!bImmediateAbort && passesDone > lastPassReadBack)
+				SaveFrameData();
+
 			Done(Result_Aborted, RPR_SUCCESS);
 			return;
 		}
@@ -581,34 +1072,14 @@ void ProductionRenderCore::Worker()
 		{
 			clearFramebuffer = true;
 			passesDone = 0;
+			lastPassReadBack = 0;
 		}
 		
 		// Clear the frame buffers we render into
 		// Only do this for the first render pass
 		if (clearFramebuffer)
 		{
-			frameBufferColor.Clear();
-
-			if( frameBufferAlpha )
-			{
-				frameBufferAlpha.Clear();
-			}
-
-			if( frameBufferShadowCatcher )
-			{
-				frameBufferShadowCatcher.Clear();
-			}
-
-			if( frameBufferBackground )
-			{
-				frameBufferBackground.Clear();
-			}
-
-			if( frameBufferVariance )
-			{
-				frameBufferVariance.Clear();
-			}
-
+			ClearFramebuffers();
 			clearFramebuffer = false;
 		}
 
@@ -644,25 +1115,46 @@ void ProductionRenderCore::Worker()
 		// One more pass got rendered
 		++passesDone;
 
-		// Save rendered frame buffer + elapsed time etc (frame data for blitting), for main thread for further processing & blitting
-		SaveFrameData();
-		
+		if( frameBufferVariance )
+		{	// Resolve the Variance AOV, used for Adaptive Sampling with the CMJ sampler
+			frameBufferVariance.Resolve(frameBufferVarianceResolve, true);
+		}
+
 		// Terminate thread when we reach a specific (amount of time) or (pass count) set by the artist
 		__time64_t current = time(0);
 		timePassed = current - startedAt;
 
+		bool finished = false;
 		if (term != Termination_None)
 		{
 			if( ((term == Termination_Passes) || (term == Termination_PassesOrTime)) && (passesDone >= numPasses) ) // Passes done, terminate
-			{
-				Done(Result_OK, RPR_SUCCESS);
-				return;
-			}
+				finished = true;
 			else if( ((term == Termination_Time) || (term == Termination_PassesOrTime)) && (timePassed >= timeLimit)) // Time limit reached, terminate
-			{
-				Done(Result_OK, RPR_SUCCESS);
-				return;
-			}
+				finished = true;
+		}
+
+		// Save rendered frame buffer + elapsed time etc (frame data for blitting), for main thread for further processing & blitting.
+		// Intermediate passes are only read back when the refresh interval has elapsed and the previous frame has been taken.
+		DWORD now = GetTickCount();
+		bool readback = finished;
+		if (!readback && (now - lastReadbackTime) >= DWORD(refreshInterval))
+		{
+			frameDataBuffersLock.lock();
+			readback = !isFrameDataReady;
+			frameDataBuffersLock.unlock();
+		}
+
+		if (readback)
+		{
+			SaveFrameData();
+			lastPassReadBack = passesDone;
+			lastReadbackTime = now;
+		}
+
+		if (finished)
+		{
+			Done(Result_OK, RPR_SUCCESS);
+			return;
 		}
 	}
 }
@@ -674,37 +1166,31 @@ void ProductionRenderCore::Restart()
 		Start();
 }
 
-void ProductionRenderCore::RenderStamp(Bitmap* DstBuffer, std::unique_ptr<ProductionRenderCore::FrameDataBuffer>& frameData) const
+void ProductionRenderCore::CompileStamp() const
 {
-	if (!doRenderStamp)
-		return;
-	
-	if (!timeStampString || !timeStampString[0])
-		return; // empty string
-
-	const TCHAR* sourceStr = timeStampString;
-
-	auto scene = scope.GetScene();
+	StampCachedData& cache = m_stampCachedData;
+	std::vector<StampToken>& tokens = cache.tokens;
+	tokens.clear();
 
-	if (!m_stampCachedData.isCacheCreated)
+	// literal text and static fields collect here until the next dynamic field
+	std::wstringstream outStream;
+	auto flushText = [&]()
 	{
-		// cache not created yet => write values to cache
-		m_stampCachedData.gpuName = GetFriendlyUsedGPUName();
-		m_stampCachedData.cpuName = GetCPUName();
-		m_stampCachedData.computerName = ComputerName();
-		m_stampCachedData.lightsCount = scene.LightObjectCount();
-		m_stampCachedData.shapesCount = scene.ShapeObjectCount();
-		GetProductAndVersion(m_stampCachedData.product, m_stampCachedData.version, m_stampCachedData.coreVersion);
-
-		m_stampCachedData.hasCpuContext = ScopeManagerMax::TheManager.cpuInfo.isUsed;
-		m_stampCachedData.hasGpuContext = ScopeManagerMax::TheManager.getGpuUsedCount() > 0;
+		if (!outStream.str().empty())
+		{
+			tokens.emplace_back(StampToken::Text, outStream.str());
+			outStream.str(std::wstring());
+		}
+	};
+	auto addField = [&](StampToken::Type type)
+	{
+		flushText();
+		tokens.emplace_back(type);
+	};
 
-		m_stampCachedData.isCacheCreated = true;
-	}
+	const TCHAR* sourceStr = cache.format.c_str();
 
 	// parse string
-	std::wstringstream outStream;
-
 	while (MCHAR c = *sourceStr++)
 	{
 		if (c != '%')
@@ -735,21 +1221,11 @@ void ProductionRenderCore::RenderStamp(Bitmap* DstBuffer, std::unique_ptr<Produc
 			switch (c)
 			{
 			case 't': // %pt - total elapsed time
-			{
-				unsigned int secs = (int) frameData->timePassed;
-				unsigned int hrs = secs / (60 * 60);
-				secs = secs % (60 * 60);
-				unsigned int mins = secs / 60;
-				secs = secs % 60;
-
-				outStream << std::setw(2) << std::setfill(L'0') << std::to_wstring(hrs) << L":"
-					<< std::setw(2) << std::setfill(L'0') << std::to_wstring(mins) << L":"
-					<< std::setw(2) << std::setfill(L'0') << std::to_wstring(secs);
-			}
-			break;
+				addField(StampToken::ElapsedTime);
+				break;
 
 			case 'p': // %pp - passes
-				outStream << std::to_wstring(frameData->passesDone);
+				addField(StampToken::Passes);
 				break;
 			}
 		}
@@ -762,35 +1238,35 @@ void ProductionRenderCore::RenderStamp(Bitmap* DstBuffer, std::unique_ptr<Produc
 			switch (c)
 			{
 			case 'l': // %sl - number of light primitives
-				outStream << std::to_wstring(m_stampCachedData.lightsCount);
+				outStream << std::to_wstring(cache.lightsCount);
 				break;
 
 			case 'o': // %so - number of objects
-				outStream << std::to_wstring(m_stampCachedData.shapesCount);
+				outStream << std::to_wstring(cache.shapesCount);
 				break;
 			}
 		}
 		break;
 
 		case 'c': // CPU name
-			outStream << m_stampCachedData.cpuName;
+			outStream << cache.cpuName;
 			break;
 
 		case 'g': // GPU name
-			outStream << m_stampCachedData.gpuName;
+			outStream << cache.gpuName;
 			break;
 
 		case 'r': // rendering mode
 		{
-			if (m_stampCachedData.hasCpuContext && m_stampCachedData.hasGpuContext)
+			if (cache.hasCpuContext && cache.hasGpuContext)
 			{
 				outStream << L"CPU/GPU";
 			}
-			else if (m_stampCachedData.hasCpuContext)
+			else if (cache.hasCpuContext)
 			{
 				outStream << L"CPU";
 			}
-			else if (m_stampCachedData.hasGpuContext)
+			else if (cache.hasGpuContext)
 			{
 				outStream << L"GPU";
 			}
@@ -799,39 +1275,32 @@ void ProductionRenderCore::RenderStamp(Bitmap* DstBuffer, std::unique_ptr<Produc
 
 		case 'h': // used hardware
 		{
-			if (m_stampCachedData.hasCpuContext && m_stampCachedData.hasGpuContext)
+			if (cache.hasCpuContext && cache.hasGpuContext)
 			{
-				outStream << m_stampCachedData.cpuName + L" / " + m_stampCachedData.gpuName;
+				outStream << cache.cpuName + L" / " + cache.gpuName;
 			}
-			else if (m_stampCachedData.hasCpuContext)
+			else if (cache.hasCpuContext)
 			{
-				outStream << m_stampCachedData.cpuName;
+				outStream << cache.cpuName;
 			}
-			else if (m_stampCachedData.hasGpuContext)
+			else if (cache.hasGpuContext)
 			{
-				outStream << m_stampCachedData.gpuName;
+				outStream << cache.gpuName;
 			}
 		}
 		break;
 
 		case 'i': // computer name
-			outStream << m_stampCachedData.computerName;
+			outStream << cache.computerName;
 			break;
 
 		case 'd': // current date
-		{
-			auto now = std::chrono::system_clock::now();
-			auto in_time_t = std::chrono::system_clock::to_time_t(now);
-			std::tm tmBuffer;
-
-			localtime_s(&tmBuffer, &in_time_t);
-			outStream << std::put_time(&tmBuffer, L"%Y %b %d, %X"); // e.g. 2018 Jul 11, 11:42:30
-		}
-		break;
+			addField(StampToken::Date);
+			break;
 
 		case 'b': // build number
 		{
-			outStream << m_stampCachedData.version << L" (core " << m_stampCachedData.coreVersion << L")";
+			outStream << cache.version << L" (core " << cache.coreVersion << L")";
 		}
 		break;
 
@@ -849,15 +1318,173 @@ void ProductionRenderCore::RenderStamp(Bitmap* DstBuffer, std::unique_ptr<Produc
 		}
 	}
 
-	Bitmap* bmp = RenderTextToBitmap(outStream.str().c_str());
-	
-	// copy 'bmp' to 'DstBuffer' at bottom-right corner
-	int x = DstBuffer->Width() > bmp->Width() ? DstBuffer->Width() - bmp->Width() : 0;
-	int y = DstBuffer->Height() - bmp->Height() ? DstBuffer->Height() - bmp->Height() : 0;
+	flushText();
+}
+
+// Formats a field of the render stamp which changes during the render
+static std::wstring FormatStampField(StampToken::Type type, float timePassed, int passesDone)
+{
+	wchar_t buffer[64] = {};
+
+	switch (type)
+	{
+	case StampToken::ElapsedTime:
+	{
+		unsigned int secs = (int) timePassed;
+		unsigned int hrs = secs / (60 * 60);
+		secs = secs % (60 * 60);
+		unsigned int mins = secs / 60;
+		secs = secs % 60;
+
+		swprintf(buffer, 64, L"%02u:%02u:%02u", hrs, mins, secs);
+	}
+	break;
+
+	case StampToken::Passes:
+		swprintf(buffer, 64, L"%d", passesDone);
+		break;
+
+	case StampToken::Date:
+	{
+		auto now = std::chrono::system_clock::now();
+		auto in_time_t = std::chrono::system_clock::to_time_t(now);
+		std::tm tmBuffer;
+
+		localtime_s(&tmBuffer, &in_time_t);
+		wcsftime(buffer, 64, L"%Y %b %d, %X", &tmBuffer); // e.g. 2018 Jul 11, 11:42:30
+	}
+	break;
+	}
+
+	return buffer;
+}
+
+void ProductionRenderCore::RenderStamp(Bitmap* DstBuffer, const ProductionRenderCore::FrameDataBuffer& frameData) const
+{
+	if (!doRenderStamp)
+		return;
 	
-	BlitBitmap(DstBuffer, bmp, x, y, 0.5f);
+	if (!timeStampString || !timeStampString[0])
+		return; // empty string
+
+	StampCachedData& cache = m_stampCachedData;
+
+	if (!cache.isCacheCreated)
+	{
+		auto scene = scope.GetScene();
+
+		// cache not created yet => write values to cache
+		cache.gpuName = GetFriendlyUsedGPUName();
+		cache.cpuName = GetCPUName();
+		cache.computerName = ComputerName();
+		cache.lightsCount = scene.LightObjectCount();
+		cache.shapesCount = scene.ShapeObjectCount();
+		GetProductAndVersion(cache.product, cache.version, cache.coreVersion);
+
+		cache.hasCpuContext = ScopeManagerMax::TheManager.cpuInfo.isUsed;
+		cache.hasGpuContext = ScopeManagerMax::TheManager.getGpuUsedCount() > 0;
+
+		cache.rasterizer.reset(new TextRasterizer());
+
+		cache.isCacheCreated = true;
+	}
+
+	if (cache.format != timeStampString)
+	{
+		cache.format = timeStampString;
+		CompileStamp();
+	}
+
+	// Rasterize the tokens whose text changed: the static text once, the fields when their value changes
+	int textWidth = 0;
+	for (StampToken& token : cache.tokens)
+	{
+		if (token.type != StampToken::Text)
+		{
+			std::wstring text = FormatStampField(token.type, frameData.timePassed, frameData.passesDone);
+			if (text != token.text)
+			{
+				token.text.swap(text);
+				token.isRasterized = false;
+			}
+		}
+
+		if (!token.isRasterized)
+		{
+			cache.rasterizer->Render(token.text, token.strip);
+			token.isRasterized = true;
+		}
+
+		textWidth += token.strip.width;
+	}
+
+	// Assemble the stamp, with some margins around the text
+	const int width = textWidth + 6;
+	const int height = cache.rasterizer->GetLineHeight() + 6;
+
+	std::vector<float>& stamp = cache.stampPixels;
+	stamp.assign(size_t(width) * height, 0.0f);
+
+	int left = 3;
+	for (const StampToken& token : cache.tokens)
+	{
+		const TextStrip& strip = token.strip;
+		for (int y = 0; y < strip.height && y + 3 < height; y++)
+		{
+			const float* src = strip.pixels.data() + size_t(y) * strip.width;
+			std::copy(src, src + strip.width, stamp.begin() + size_t(y + 3) * width + left);
+		}
+		left += strip.width;
+	}
+
+	// blend the stamp over 'DstBuffer' at bottom-right corner
+	const int x = std::max(DstBuffer->Width() - width, 0);
+	const int y = std::max(DstBuffer->Height() - height, 0);
+	const int dx = std::min(width, DstBuffer->Width() - x);
+	const int dy = std::min(height, DstBuffer->Height() - y);
+
+	if (dx <= 0)
+		return;
+
+	const float alpha = 0.5f;
+	std::vector<BMM_Color_fl>& row = cache.row;
+	row.resize(dx);
+
+	cache.background.resize(size_t(dx) * dy);
+	cache.backgroundRect = BitmapRect(x, y, x + dx, y + dy);
+
+	for (int cy = 0; cy < dy; cy++)
+	{
+		const float* src = stamp.data() + size_t(cy) * width;
+
+		DstBuffer->GetPixels(x, y + cy, dx, row.data());
+		std::copy(row.begin(), row.end(), cache.background.begin() + size_t(cy) * dx);
 
-	bmp->DeleteThis();
+		for (int i = 0; i < dx; i++)
+		{
+			row[i].r = row[i].r * (1 - alpha) + src[i] * alpha;
+			row[i].g = row[i].g * (1 - alpha) + src[i] * alpha;
+			row[i].b = row[i].b * (1 - alpha) + src[i] * alpha;
+		}
+		DstBuffer->PutPixels(x, y + cy, dx, row.data());
+	}
+}
+
+void ProductionRenderCore::RestoreStampBackground(Bitmap* DstBuffer) const
+{
+	StampCachedData& cache = m_stampCachedData;
+
+	const BitmapRect rect = cache.backgroundRect;
+	if (rect.IsEmpty())
+		return;
+
+	cache.backgroundRect = BitmapRect();
+
+	if (rect.xmax > DstBuffer->Width() || rect.ymax > DstBuffer->Height())
+		return;
+
+	for (int cy = 0; cy < rect.Height(); cy++)
+		DstBuffer->PutPixels(rect.xmin, rect.ymin + cy, rect.Width(), &cache.background[size_t(cy) * rect.Width()]);
 }
 
 
@@ -1115,6 +1742,23 @@ void PRManagerMax::Close(FireRenderer *pRenderer, HWND hwnd, RendProgressCallbac
 }
 
 
+// Returns true if any of the render elements is rendered by RPR as an AOV
+static bool HasRenderElementAOVs(RenderParameters& parameters)
+{
+	auto renderElementMgr = parameters.rendParams.GetRenderElementMgr();
+	if (!renderElementMgr)
+		return false;
+
+	for (int i = 0; i < renderElementMgr->NumRenderElements(); ++i)
+	{
+		rpr_aov getAOVRenderElementFRId(IRenderElement* renderElement);  // external, defined in AOVs.cpp
+		if (getAOVRenderElementFRId(renderElementMgr->GetRenderElement(i)) != RPR_AOV_MAX)
+			return true;
+	}
+
+	return false;
+}
+
 int PRManagerMax::Render(FireRenderer* pRenderer, TimeValue t, ::Bitmap* frontBuffer, FrameRendParams &frp, HWND hwnd, RendProgressCallback* prog, ViewParams* viewPar)
 {
 	SuspendAll(TRUE, TRUE, TRUE, TRUE, TRUE, TRUE, TRUE);
@@ -1149,6 +1793,8 @@ int PRManagerMax::Render(FireRenderer* pRenderer, TimeValue t, ::Bitmap* frontBu
 	// Parse scene info
 	SceneCallbacks callbacks;
 	auto parser = std::make_unique<SceneParser>(parameters, callbacks, scope);
+	parser->mtlParser.SetDeferImages(std::atoi(FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::DeferredTextures).c_str()) != 0);
+	TrimGeometryCacheToSettings();
 
 	if (parameters.progress)
 		parameters.progress->SetTitle(_T("Synchronizing scene..."));
@@ -1168,8 +1814,23 @@ int PRManagerMax::Render(FireRenderer* pRenderer, TimeValue t, ::Bitmap* frontBu
 	// Disable Adaptive Sampling with the CMJ sampler, if noise threshold is zero
 	bool bAdaptiveEnabled = (data->adaptiveThreshold > 0);
 
+	// Frames larger than the tile size from the settings file are rendered tile by tile into tile sized frame buffers. Denoising,
+	// render elements, region renders and the panoramic cameras need the whole frame at once and use a single full frame.
+	const int tileSize = std::atoi(FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::TileSize).c_str());
+	bool bTiled = (tileSize > 0) && ((renderWidth > tileSize) || (renderHeight > tileSize)) &&
+		!bDenoiserEnabled && (parameters.rendParams.rendType != RENDTYPE_REGION) && !HasRenderElementAOVs(parameters);
+
+	if (bTiled)
+	{
+		int cameraType = FRCameraType_Default;
+		BOOL res = CamManagerMax::TheManager.GetProperty(PARAM_CAM_TYPE, cameraType); FASSERT(res);
+		bTiled = (cameraType == FRCameraType_Default);
+	}
+
 	// create frame buffer
-	data->renderThread = new ProductionRenderCore(scope, renderWidth, renderHeight,
+	data->renderThread = new ProductionRenderCore(scope,
+		bTiled ? std::min(renderWidth, tileSize) : renderWidth,
+		bTiled ? std::min(renderHeight, tileSize) : renderHeight,
 		bool_cast(bRenderAlpha), bDenoiserEnabled, bAdaptiveEnabled);
 
 	// Render Elements
@@ -1354,6 +2015,9 @@ int PRManagerMax::Render(FireRenderer* pRenderer, TimeValue t, ::Bitmap* frontBu
 
 	SetupCamera(parser->view, renderWidth, renderHeight, camera.Handle());
 
+	if (bTiled)
+		data->renderThread->SetTiles(renderWidth, renderHeight, parser->view, camera);
+
 	// synchronize scene
 	parser->Synchronize(true);
 
@@ -1460,6 +2124,7 @@ int PRManagerMax::Render(FireRenderer* pRenderer, TimeValue t, ::Bitmap* frontBu
 	data->renderThread->exposure = data->toneMappingExposure;
 	data->renderThread->useMaxTonemapper = isShadowCatcherEnabled ? false : !overrideTonemappers;
 	data->renderThread->regionMode = (parameters.rendParams.rendType == RENDTYPE_REGION);
+	data->renderThread->refreshInterval = GetFromPb<int>(parameters.pblock, PARAM_VFB_REFRESH);
 	data->isAlphaEnabled = bool_cast(bRenderAlpha);
 	data->isDenoiserEnabled = bDenoiserEnabled;
 	data->isAdaptiveEnabled = bAdaptiveEnabled;
@@ -1545,8 +2210,12 @@ int PRManagerMax::Render(FireRenderer* pRenderer, TimeValue t, ::Bitmap* frontBu
 		{
 			if (parameters.progress)
 			{
+				const int tileCount = data->renderThread->GetTileCount();
+
 				bool doCancel = false;
-				if( (data->termCriteria == Termination_Passes) || (data->termCriteria == Termination_PassesOrTime) )
+				if (tileCount > 0)
+					doCancel = (parameters.progress->Progress(data->renderThread->tilesDone, tileCount) != RENDPROG_CONTINUE);
+				else if( (data->termCriteria == Termination_Passes) || (data->termCriteria == Termination_PassesOrTime) )
 					doCancel = (parameters.progress->Progress(data->renderThread->passesDone, data->passLimit) != RENDPROG_CONTINUE);
 				else if( data->termCriteria == Termination_Time )
 					doCancel = (parameters.progress->Progress(data->renderThread->timePassed * 1000, data->timeLimit * 1000) != RENDPROG_CONTINUE);
@@ -1590,7 +2259,10 @@ int PRManagerMax::Render(FireRenderer* pRenderer, TimeValue t, ::Bitmap* frontBu
 						shaderCacheDlg = NULL;
 					}
 
-					ss << _T("Rendering (pass ") << data->renderThread->passesDone;
+					ss << _T("Rendering (");
+					if (tileCount > 0)
+						ss << _T("tile ") << std::min(data->renderThread->tilesDone + 1, tileCount) << _T(" of ") << tileCount << _T(", ");
+					ss << _T("pass ") << data->renderThread->passesDone;
 					if( (data->termCriteria == Termination_Passes) || (data->termCriteria == Termination_PassesOrTime) )
 						ss << _T(" of ") << data->passLimit;
 					ss << _T(", elapsed: ") << (int)data->renderThread->timePassed << _T("s)...");
@@ -1667,78 +2339,158 @@ void PRManagerMax::PostProcessAOVs(const RenderParameters& parameters, frw::Scop
 	int renderWidth = parameters.rendParams.width;
 	int renderHeight = parameters.rendParams.height;
 
-	if (renderElementMgr)
+	if (!renderElementMgr)
+		return;
+
+	// Render elements rendered by RPR, together with the bitmap they are written to
+	struct AOVOutput
 	{
-		int renderElementCount = renderElementMgr->NumRenderElements();
+		rpr_aov aov;
+		Bitmap* bitmap;
+		std::vector<float> data;
+	};
 
-		for (int i = 0; i < renderElementCount; ++i)
-		{
-			IRenderElement* renderElement = renderElementMgr->GetRenderElement(i);
-			rpr_aov getAOVRenderElementFRId(IRenderElement* renderElement);
-			rpr_aov aov = getAOVRenderElementFRId(renderElement);
+	std::vector<AOVOutput> outputs;
 
-			if (RPR_AOV_MAX != aov)
-			{
-				frw::FrameBuffer fb = scope.GetFrameBuffer(GetFramebufferTypeIdForAOV(aov));
+	int renderElementCount = renderElementMgr->NumRenderElements();
 
-				if (fb.Handle())
-				{
-					frw::FrameBuffer fbResolve = scope.GetFrameBuffer(renderWidth, renderHeight, GetFramebufferTypeIdForAOVResolve(aov));
+	for (int i = 0; i < renderElementCount; ++i)
+	{
+		IRenderElement* renderElement = renderElementMgr->GetRenderElement(i);
+		rpr_aov getAOVRenderElementFRId(IRenderElement* renderElement);
+		rpr_aov aov = getAOVRenderElementFRId(renderElement);
 
-					if( GetFramebufferTypeIdForAOVResolve(aov) == FrameBufferTypeId_VarianceResolve )
-						fb.Resolve(fbResolve, true); // Special case: Variance needs a "normalize only" resolve
-					else // Normal case
-						fb.Resolve(fbResolve);
+		if (RPR_AOV_MAX == aov || !scope.GetFrameBuffer(GetFramebufferTypeIdForAOV(aov)).Handle())
+			continue;
 
-					std::vector<float> colorData = fbResolve.GetPixelData();
+		PBBitmap* b = nullptr;
 
-					if (RPR_AOV_DEPTH == aov)
-					{
-						PostProcessDepth(colorData, renderWidth, renderHeight);
-					}
+		renderElement->GetPBBitmap(b);
+
+		if (b && b->bm)
+			outputs.push_back({ aov, b->bm, std::vector<float>() });
+	}
 
-					MSTR name = renderElement->GetName();
+	if (outputs.empty())
+		return;
 
-					PBBitmap* b = nullptr;
+	// The AOVs are processed as a pipeline: a reader thread resolves them, reads them back and post-processes them, while this
+	// thread writes the previous ones to their bitmaps, as the Max SDK calls have to be made from the main thread. The reader
+	// runs at most MaxPendingAOVs images ahead, to bound the memory held by full resolution pixel data.
+	const size_t MaxPendingAOVs = 2;
 
-					renderElement->GetPBBitmap(b);
+	std::mutex lock;
+	std::condition_variable changed;
+	size_t readCount = 0; // outputs [0, readCount) hold their pixel data
+	size_t writtenCount = 0; // outputs [0, writtenCount) have been written to their bitmaps
+	bool readFailed = false;
 
-					if (b && b->bm)
-					{
-						CopyDataToBitmap(colorData, std::vector<float>(), b->bm, 1.0f, false);
-						b->bm->RefreshWindow();
-					}
+	std::thread reader([&]()
+	{
+		try
+		{
+			for (size_t i = 0; i < outputs.size(); ++i)
+			{
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					changed.wait(guard, [&]() { return i < writtenCount + MaxPendingAOVs; });
 				}
+
+				AOVOutput& output = outputs[i];
+
+				frw::FrameBuffer fb = scope.GetFrameBuffer(GetFramebufferTypeIdForAOV(output.aov));
+				frw::FrameBuffer fbResolve = scope.GetFrameBuffer(renderWidth, renderHeight, GetFramebufferTypeIdForAOVResolve(output.aov));
+
+				if( GetFramebufferTypeIdForAOVResolve(output.aov) == FrameBufferTypeId_VarianceResolve )
+					fb.Resolve(fbResolve, true); // Special case: Variance needs a "normalize only" resolve
+				else // Normal case
+					fb.Resolve(fbResolve);
+
+				fbResolve.GetPixelData(output.data);
+
+				if (RPR_AOV_DEPTH == output.aov)
+				{
+					PostProcessDepth(output.data, renderWidth, renderHeight);
+				}
+
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					readCount = i + 1;
+				}
+				changed.notify_all();
+			}
+		}
+		catch (...)
+		{
+			debugPrint("Exception occurred while reading back render elements");
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				readFailed = true;
 			}
+			changed.notify_all();
+		}
+	});
+
+	for (size_t i = 0; i < outputs.size(); ++i)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			changed.wait(guard, [&]() { return (readCount > i) || readFailed; });
+
+			if (readCount <= i)
+				break;
+		}
+
+		AOVOutput& output = outputs[i];
+
+		CopyDataToBitmap(output.data, std::vector<float>(), output.bitmap, 1.0f, false);
+		output.bitmap->RefreshWindow();
+
+		std::vector<float>().swap(output.data);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			writtenCount = i + 1;
 		}
+		changed.notify_all();
 	}
+
+	reader.join();
+}
+
+namespace
+{
+	const size_t DepthChunkPixels = 16 * 1024; // pixels per OpenMP work item of the depth kernels
 }
 
 std::tuple<float, float> PRManagerMax::SearchMinMax(const std::vector<float>& data, int width, int height) const
 {
+	FASSERT(FbComponentsNumber == 4);
+
 	float min = std::numeric_limits<float>::max();
 	float max = std::numeric_limits<float>::lowest();
 
-	// Search Min and Max values automatically
-	for (int y = 0; y < height; y++)
+	// Search Min and Max values automatically, each thread over its own chunks first
+	const size_t pixelCount = std::min(size_t(width) * height, data.size() / 4);
+	const int chunkCount = int((pixelCount + DepthChunkPixels - 1) / DepthChunkPixels);
+
+	#pragma omp parallel
 	{
-		for (int x = 0; x < width; x++)
+		float localMin = std::numeric_limits<float>::max();
+		float localMax = std::numeric_limits<float>::lowest();
+
+		#pragma omp for nowait
+		for (int chunk = 0; chunk < chunkCount; ++chunk)
 		{
-			int index = (y * width + x) * FbComponentsNumber;
-			float val = data[index];
-			
-			if (!isinf<float>(val))
-			{
-				if (min > val)
-				{
-					min = val;
-				}
+			const size_t begin = chunk * DepthChunkPixels;
+			SearchDepthMinMax(data.data(), begin, std::min(begin + DepthChunkPixels, pixelCount), localMin, localMax);
+		}
 
-				if (max < val)
-				{
-					max = val;
-				}
-			}
+		#pragma omp critical
+		{
+			min = std::min(min, localMin);
+			max = std::max(max, localMax);
 		}
 	}
 
@@ -1747,40 +2499,21 @@ std::tuple<float, float> PRManagerMax::SearchMinMax(const std::vector<float>& da
 
 void PRManagerMax::PostProcessDepth(std::vector<float>& data, int width, int height) const
 {
+	FASSERT(FbComponentsNumber == 4);
+
 	float min = 0.0f;
 	float max = 1.0f;
 
 	std::tie(min, max) = SearchMinMax(data, width, height);
 
-	for (int y = 0; y < height; y++)
-	{
-		for (int x = 0; x < width; x++)
-		{
-			int index = (y * width + x) * FbComponentsNumber;
-			float val = data[index];
-
-			if (!isinf<float>(val))
-			{
-				if (val >= max)
-				{
-					val = 1.0f;
-				}
-				else if (val <= min)
-				{
-					val = 0.0f;
-				}
-				else
-				{
-					val = (val - min) / (max - min);
-				}
-			}
-			else
-			{
-				val = 1.0f;
-			}
+	const size_t pixelCount = std::min(size_t(width) * height, data.size() / 4);
+	const int chunkCount = int((pixelCount + DepthChunkPixels - 1) / DepthChunkPixels);
 
-			data[index] = data[index+1] = data[index+2] = val;
-		}
+	#pragma omp parallel for
+	for (int chunk = 0; chunk < chunkCount; ++chunk)
+	{
+		const size_t begin = chunk * DepthChunkPixels;
+		NormalizeDepth(data.data(), begin, std::min(begin + DepthChunkPixels, pixelCount), min, max);
 	}
 }
 
@@ -134,7 +134,7 @@ enum Parameter : ParamID
     PARAM_IMAGE_FILTER_WIDTH            = 408,
 
     /// INT (milliseconds): The minimum period after which the VFB redraws
-    PARAM_VFB_REFRESH                   = 410, // not used
+    PARAM_VFB_REFRESH                   = 410, // also limits how often production render reads back the frame buffers
 
     /// INT: Which tone mapping operator to use. It is updated in real time. Values are from enum fr_tonemapping_operator
 	OBSOLETE_PARAM_TONEMAP_OPERATOR              = 411,
@@ -240,6 +240,11 @@ ScopeID ScopeManagerMax::CreateScope(IParamBlock2 *pblock)
 	if (!theScope.IsValid())
 		return -1;
 
+	// Texture memory ceiling of this workstation, in megabytes (0 or missing for no limit)
+	const int imageCacheBudget = std::atoi(FRSettingsFileHandler::getAttributeSettingsFor(FRSettingsFileHandler::ImageCacheBudget).c_str());
+	if (imageCacheBudget > 0)
+		theScope.SetImageCacheBudget(size_t(imageCacheBudget) << 20);
+
 	scopes.insert(std::make_pair(nextScopeId, theScope));
 
 	ScopeID ret = nextScopeId;
@@ -17,151 +17,156 @@ limitations under the License.
 * Copyright (c) 2017 AMD
 * All Rights Reserved
 *
-* CRC32 based hash
+* 64-bit streaming hash
 *
-* Parts of this code based on the work of Stephan Brumme (CRC32)
-* Slicing-by-16 contributed by Bulat Ziganshin
-* Tableless bytewise CRC contributed by Hagai Gold
-* see http://create.stephan-brumme.com/disclaimer.html
+* The mixing core is wyhash by Wang Yi (public domain, see https://github.com/wangyi-fudan/wyhash). Every block appended to
+* the hash is hashed with the current value as the seed, so a sequence of values hashes the same way each time it is fed.
 *********************************************************************************************************************************/
 
 #pragma once
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
-#define CRC32_USE_LOOKUP_TABLE_BYTE
-#define CRC32_USE_LOOKUP_TABLE_SLICING_BY_8
-#define CRC32_USE_LOOKUP_TABLE_SLICING_BY_4
-#define CRC32_USE_LOOKUP_TABLE_SLICING_BY_16
-
-/// Slicing-By-16
-#ifdef CRC32_USE_LOOKUP_TABLE_SLICING_BY_16
-#define MaxSlice 16
-#elif defined(CRC32_USE_LOOKUP_TABLE_SLICING_BY_8)
-#define MaxSlice 8
-#elif defined(CRC32_USE_LOOKUP_TABLE_SLICING_BY_4)
-#define MaxSlice 4
-#elif defined(CRC32_USE_LOOKUP_TABLE_BYTE)
-#define MaxSlice 1
-#else
-#define NO_LUT // don't use Crc32Lookup at all
-#endif
-
-// define endianess and some integer data types
-#if defined(_MSC_VER) || defined(__MINGW32__)
-#define __LITTLE_ENDIAN 1234
-#define __BIG_ENDIAN    4321
-#define __BYTE_ORDER    __LITTLE_ENDIAN
-
-#include <xmmintrin.h>
-#ifdef __MINGW32__
-#define PREFETCH(location) __builtin_prefetch(location)
-#else
-#define PREFETCH(location) _mm_prefetch(location, _MM_HINT_T0)
-#endif
-#else
-// defines __BYTE_ORDER as __LITTLE_ENDIAN or __BIG_ENDIAN
-#include <sys/param.h>
-
-#ifdef __GNUC__
-#define PREFETCH(location) __builtin_prefetch(location)
-#else
-#define PREFETCH(location) ;
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
 #endif
-#endif
-
 
 class HashValue
 {
 private:
-	// crc32_fast selects the fastest algorithm depending on flags (CRC32_USE_LOOKUP_...)
-	/// compute CRC32 using the fastest algorithm for large datasets on modern CPUs
-	uint32_t crc32_fast(const void* data, size_t length, uint32_t previousCrc32 = 0);
-
-	/// compute CRC32 (bitwise algorithm)
-	uint32_t crc32_bitwise(const void* data, size_t length, uint32_t previousCrc32 = 0);
-	/// compute CRC32 (half-byte algoritm)
-	uint32_t crc32_halfbyte(const void* data, size_t length, uint32_t previousCrc32 = 0);
-
-#ifdef CRC32_USE_LOOKUP_TABLE_BYTE
-	/// compute CRC32 (standard algorithm)
-	uint32_t crc32_1byte(const void* data, size_t length, uint32_t previousCrc32 = 0);
-#endif
+	static const uint64_t Secret0 = 0x2d358dccaa6c78a5ull;
+	static const uint64_t Secret1 = 0x8bb84b93962eacc9ull;
+	static const uint64_t Secret2 = 0x4b33a62ed433d4a3ull;
+	static const uint64_t Secret3 = 0x4d5a2da51de1aa47ull;
 
-	/// compute CRC32 (byte algorithm) without lookup tables
-	uint32_t crc32_1byte_tableless(const void* data, size_t length, uint32_t previousCrc32 = 0);
-	/// compute CRC32 (byte algorithm) without lookup tables
-	uint32_t crc32_1byte_tableless2(const void* data, size_t length, uint32_t previousCrc32 = 0);
-
-#ifdef CRC32_USE_LOOKUP_TABLE_SLICING_BY_4
-	/// compute CRC32 (Slicing-by-4 algorithm)
-	uint32_t crc32_4bytes(const void* data, size_t length, uint32_t previousCrc32 = 0);
+	/// 64x64 -> 128 bit multiplication, returns the low half in a and the high half in b
+	static inline void Multiply(uint64_t& a, uint64_t& b)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		a = _umul128(a, b, &b);
+#elif defined(__SIZEOF_INT128__)
+		__uint128_t r = __uint128_t(a) * b;
+		a = uint64_t(r);
+		b = uint64_t(r >> 64);
+#else
+		const uint64_t ha = a >> 32, hb = b >> 32, la = uint32_t(a), lb = uint32_t(b);
+		const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+		const uint64_t t = rl + (rm0 << 32);
+		uint64_t c = t < rl;
+		const uint64_t lo = t + (rm1 << 32);
+		c += lo < t;
+		a = lo;
+		b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
 #endif
+	}
 
-#ifdef CRC32_USE_LOOKUP_TABLE_SLICING_BY_8
-	/// compute CRC32 (Slicing-by-8 algorithm)
-	uint32_t crc32_8bytes(const void* data, size_t length, uint32_t previousCrc32 = 0);
-	/// compute CRC32 (Slicing-by-8 algorithm), unroll inner loop 4 times
-	uint32_t crc32_4x8bytes(const void* data, size_t length, uint32_t previousCrc32 = 0);
-#endif
+	static inline uint64_t Mix(uint64_t a, uint64_t b)
+	{
+		Multiply(a, b);
+		return a ^ b;
+	}
 
-#ifdef CRC32_USE_LOOKUP_TABLE_SLICING_BY_16
-	/// compute CRC32 (Slicing-by-16 algorithm)
-	uint32_t crc32_16bytes(const void* data, size_t length, uint32_t previousCrc32 = 0);
-	/// compute CRC32 (Slicing-by-16 algorithm, prefetch upcoming data blocks)
-	uint32_t crc32_16bytes_prefetch(const void* data, size_t length, uint32_t previousCrc32 = 0, size_t prefetchAhead = 256);
-#endif
+	static inline uint64_t Read8(const uint8_t* p)
+	{
+		uint64_t v;
+		memcpy(&v, p, 8);
+		return v;
+	}
 
-	/// swap endianess
-	inline uint32_t swap(uint32_t x)
+	static inline uint64_t Read4(const uint8_t* p)
 	{
-#if defined(__GNUC__) || defined(__clang__)
-		return __builtin_bswap32(x);
-#else
-		return (x >> 24) |
-			((x >> 8) & 0x0000FF00) |
-			((x << 8) & 0x00FF0000) |
-			(x << 24);
-#endif
+		uint32_t v;
+		memcpy(&v, p, 4);
+		return v;
 	}
 
-private:
-	const uint32_t Polynomial = 0xEDB88320;
+	static inline uint64_t Read3(const uint8_t* p, size_t length)
+	{
+		return (uint64_t(p[0]) << 16) | (uint64_t(p[length >> 1]) << 8) | p[length - 1];
+	}
 
-#ifndef NO_LUT
-	/// look-up table, already declared above
-	static const uint32_t Crc32Lookup[MaxSlice][256];
-#endif
+	/// Hashes blocks longer than 16 bytes; returns the seed and the last 16 bytes to finish with in a and b
+	static uint64_t HashLong(const uint8_t* p, size_t length, uint64_t seed, uint64_t& a, uint64_t& b);
+
+	/// Hashes the block with given seed. Blocks up to 16 bytes, such as the scalars, colors and points fed to operator<<, are
+	/// handled inline; longer ones, such as a Box3 or Matrix3, and the arrays passed to Append, go through HashLong.
+	static inline uint64_t Hash(const void* data, size_t length, uint64_t seed)
+	{
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+
+		uint64_t a, b;
+		if (length <= 16)
+		{
+			// wyhash scrambles the seed with a multiplication first. Seeds here are the output of the previous block's final
+			// mix already, so small values, which make up most of the input, only offset it: a zero seed (the initial value)
+			// would otherwise zero the multiplication below for inputs shorter than 4 bytes.
+			seed ^= Secret2;
+
+			if (length >= 4)
+			{
+				a = (Read4(p) << 32) | Read4(p + ((length >> 3) << 2));
+				b = (Read4(p + length - 4) << 32) | Read4(p + length - 4 - ((length >> 3) << 2));
+			}
+			else if (length > 0)
+			{
+				a = Read3(p, length);
+				b = 0;
+			}
+			else
+			{
+				a = b = 0;
+			}
+		}
+		else
+		{
+			seed ^= Mix(seed ^ Secret0, Secret1);
+			seed = HashLong(p, length, seed, a, b);
+		}
+
+		a ^= Secret1;
+		b ^= seed;
+		Multiply(a, b);
+		return Mix(a ^ Secret0 ^ length, b ^ Secret1);
+	}
 
-	uint32_t crc = 0;
+	uint64_t value = 0;
 
 public:
-	HashValue(uint32_t v = 0)
-	: crc(v)
+	HashValue(uint64_t v = 0)
+	: value(v)
 	{
 	}
 	
 	HashValue(const HashValue &other)
-	: crc(other.crc)
+	: value(other.value)
 	{
 	}
 
 	template <class T>
 	HashValue& operator<<(const T& v)
 	{
-		crc = crc32_fast(&v, sizeof(v), crc);
+		value = Hash(&v, sizeof(v), value);
+		return *this;
+	}
+
+	/// Hashes a block of memory, e.g. a whole vertex array, in a single call
+	HashValue& Append(const void* data, size_t length)
+	{
+		value = Hash(data, length, value);
 		return *this;
 	}
 
 	inline HashValue& operator = (const HashValue& other)
 	{
-		crc = other.crc;
+		value = other.value;
 		return *this;
 	}
 
-	inline operator uint32_t() const
+	inline operator uint64_t() const
 	{
-		return crc;
+		return value;
 	}
 };
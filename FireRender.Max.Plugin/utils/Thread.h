@@ -169,10 +169,17 @@ public:
 
 class Event : public BaseSynchObject
 {
+private:
+	bool mAutoReset;
+
 public:
-	inline Event(bool autoreset = true) {
+	inline Event(bool autoreset = true)
+		: mAutoReset(autoreset) {
 		handle = CreateEventA(NULL, !autoreset, FALSE, NULL);
 	}
+	inline bool IsAutoReset() const {
+		return mAutoReset;
+	}
 	inline bool Wait(DWORD timeout = INFINITE) {
 		bool ret = false;
 		if (WaitForSingleObject(handle, timeout) == WAIT_OBJECT_0)
@@ -311,6 +318,9 @@ public:
 // - spin is decremented by one
 // - if spin has reached zero, the event is reset
 //
+// A second manual event is signalled whenever the spin is zero, so that
+// consumers can block until all actors are done instead of polling.
+//
 
 class EventSpin
 {
@@ -318,18 +328,24 @@ private:
 	LONG mSpin = 0;
 	CriticalSection mSec;
 	Event mEvent;
+	Event mReleased;
 
 public:
 	EventSpin()
 		: mEvent(false)
+		, mReleased(false)
 	{
+		mReleased.Fire();
 	}
 
 	void Fire()
 	{
 		mSec.Lock();
 		if (mSpin == 0)
+		{
+			mReleased.Reset();
 			mEvent.Fire();
+		}
 		mSpin++;
 		mSec.Unlock();
 	}
@@ -346,10 +362,19 @@ public:
 		{
 			mSpin--;
 			if (mSpin == 0)
+			{
 				mEvent.Reset();
+				mReleased.Fire();
+			}
 		}
 		mSec.Unlock();
 	}
+
+	// signalled while the spin is zero
+	Event& Released()
+	{
+		return mReleased;
+	}
 };
 
 class BaseThread
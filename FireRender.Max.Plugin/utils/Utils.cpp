@@ -31,6 +31,10 @@ limitations under the License.
 
 #include <iomanip>
 #include <vector>
+#include <cmath>
+#include <limits>
+#include <intrin.h>
+#include <immintrin.h>
 #include <codecvt>
 #include <experimental/filesystem>
 
@@ -189,77 +193,248 @@ float GetDeterminant(const Matrix3& input) {
         - input[2][0] * input[1][1] * input[0][2];
 }
 
-void CompositeFrameBuffersToBitmap(std::vector<float>& fbData, std::vector<float>& fbAlphaData, Bitmap* output, const float exposure, const bool isNormals, bool toneOperatorPreviewExecuting)
+void CompositeFrameBuffersToBitmap(std::vector<float>& fbData, std::vector<float>& fbAlphaData, Bitmap* output, const float exposure, const bool isNormals, bool toneOperatorPreviewExecuting,
+	const BitmapRect* dirtyRect)
 {
 	if (toneOperatorPreviewExecuting) {
-		CopyDataToPreviewBitmap(fbData, output, isNormals);
+		CopyDataToPreviewBitmap(fbData, output, isNormals, dirtyRect);
 	}
 	else {
-		CopyDataToBitmap(fbData, fbAlphaData, output, exposure, isNormals);
+		CopyDataToBitmap(fbData, fbAlphaData, output, exposure, isNormals, dirtyRect);
 	}
 }
 
-void CopyDataToPreviewBitmap(const std::vector<float>& fbData, Bitmap* output, const bool isNormals) {
-	if (!output)
-		return;
-
-	int height = output->Height();
-	int width = output->Width();
+namespace
+{
+	/// Per channel transform of RGBA pixels read from RPR frame buffers, applied in a single pass over the data:
+	/// out = (in / weight) * scale + offset, with alpha optionally taken from a separate frame buffer
+	struct PixelTransform
+	{
+		float scale[4];
+		float offset[4];
+		bool normalize; // divide r, g, b by the fourth (weight) component, as RPR requires for not yet resolved frame buffers
 
-	ULONG chan = output->ChannelsPresent();
+		PixelTransform(bool isNormals, bool normalizeByWeight)
+			: normalize(normalizeByWeight)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				// We were requested to map the -1..1 RPR normals to 0..1 3ds Max normals
+				scale[i] = isNormals ? 0.5f : 1.f;
+				offset[i] = isNormals ? 0.5f : 0.f;
+			}
+		}
+	};
 
-	chan = output->ChannelsPresent();
+	bool IsAvxSupported()
+	{
+		int info[4] = {};
+		__cpuid(info, 1);
 
-	if (chan & BMM_CHAN_COVERAGE) {
-		DebugPrint(_T("G-Buffer requests Pixel Coverage\n"));
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
 
-		ulong type;
-		UBYTE *pixels = (UBYTE*)output->GetChannel(BMM_CHAN_COVERAGE, type);
-		memset(pixels, 255, height * width);
+		// the OS must save the upper halves of the YMM registers too
+		return osxsave && avx && (_xgetbv(0) & 6) == 6;
 	}
 
+	const bool cpuHasAvx = IsAvxSupported();
 
-	float r, g, b;
+	/// SSE2 version, one pixel per iteration. Also used for the remainder of the AVX version.
+	/// \param alpha RGBA frame buffer whose first component replaces the alpha of the output, or nullptr
+	void TransformPixelsSse(const float* src, const float* alpha, float* dst, size_t count, const PixelTransform& tf)
+	{
+		const __m128 scale = _mm_loadu_ps(tf.scale);
+		const __m128 offset = _mm_loadu_ps(tf.offset);
+		const __m128 alphaMask = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+		const __m128 one = _mm_set1_ps(1.f);
 
-	if (chan & BMM_CHAN_REALPIX) {
-		ulong type;
-		RealPixel *pixels = (RealPixel*)output->GetChannel(BMM_CHAN_REALPIX, type);
+		for (size_t i = 0; i < count; ++i)
+		{
+			__m128 v = _mm_loadu_ps(src + 4 * i);
 
-		#pragma omp parallel for
-		for (int y = 0; y < height; ++y)
+			if (tf.normalize)
+			{
+				__m128 weight = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+				weight = _mm_or_ps(_mm_andnot_ps(alphaMask, weight), _mm_and_ps(alphaMask, one));
+				v = _mm_div_ps(v, weight);
+			}
+
+			v = _mm_add_ps(_mm_mul_ps(v, scale), offset);
+
+			if (alpha)
+			{
+				__m128 a = _mm_load1_ps(alpha + 4 * i);
+				v = _mm_or_ps(_mm_andnot_ps(alphaMask, v), _mm_and_ps(alphaMask, a));
+			}
+
+			_mm_storeu_ps(dst + 4 * i, v);
+		}
+	}
+
+	/// AVX version, two pixels per iteration
+	void TransformPixelsAvx(const float* src, const float* alpha, float* dst, size_t count, const PixelTransform& tf)
+	{
+		const __m256 scale = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(tf.scale));
+		const __m256 offset = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(tf.offset));
+		const __m256 one = _mm256_set1_ps(1.f);
+
+		const size_t pairs = count / 2;
+		for (size_t i = 0; i < pairs; ++i)
 		{
+			__m256 v = _mm256_loadu_ps(src + 8 * i);
+
+			if (tf.normalize)
+			{
+				__m256 weight = _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3));
+				weight = _mm256_blend_ps(weight, one, 0x88);
+				v = _mm256_div_ps(v, weight);
+			}
+
+			v = _mm256_add_ps(_mm256_mul_ps(v, scale), offset);
 
-			RealPixel *row = pixels + y * width;
-			const int basey = (y << 2) * width;
-			for (int x = 0; x < width; ++x)
+			if (alpha)
 			{
-				const int base = (x << 2) + basey;
+				__m256 a = _mm256_permute_ps(_mm256_loadu_ps(alpha + 8 * i), _MM_SHUFFLE(0, 0, 0, 0));
+				v = _mm256_blend_ps(v, a, 0x88);
+			}
+
+			_mm256_storeu_ps(dst + 8 * i, v);
+		}
+
+		// avoid the penalty of switching back to SSE code with dirty upper register halves
+		_mm256_zeroupper();
+
+		if (count & 1)
+		{
+			const size_t last = count - 1;
+			TransformPixelsSse(src + 4 * last, alpha ? alpha + 4 * last : nullptr, dst + 4 * last, 1, tf);
+		}
+	}
+
+	/// Transforms count RGBA pixels from src to dst, which may be the same buffer
+	void TransformPixels(const float* src, const float* alpha, float* dst, size_t count, const PixelTransform& tf)
+	{
+		if (cpuHasAvx)
+			TransformPixelsAvx(src, alpha, dst, count, tf);
+		else
+			TransformPixelsSse(src, alpha, dst, count, tf);
+	}
+
+	/// Part of a width x height bitmap to update: the dirty rectangle if given, the whole bitmap otherwise
+	BitmapRect GetUpdateRect(const BitmapRect* dirtyRect, int width, int height)
+	{
+		return dirtyRect ? dirtyRect->Clamped(width, height) : BitmapRect(0, 0, width, height);
+	}
+
+	/// Writes the rect part of the bitmap's real pixel channel (used by the tone operator preview)
+	/// \param data RGBA frame buffer data whose first pixel maps to bitmap pixel (x0, y0), with rows of stride pixels
+	void WritePreviewPixels(const float* data, size_t stride, int x0, int y0, Bitmap* output, const BitmapRect& rect, bool isNormals)
+	{
+		ULONG chan = output->ChannelsPresent();
+
+		if (chan & BMM_CHAN_COVERAGE) {
+			DebugPrint(_T("G-Buffer requests Pixel Coverage\n"));
 
-				// RPR requires us to normalize the image using the fourth component. 
+			ulong type;
+			UBYTE *pixels = (UBYTE*)output->GetChannel(BMM_CHAN_COVERAGE, type);
+			memset(pixels, 255, output->Height() * output->Width());
+		}
 
-				r = fbData[base] / fbData[base + 3];
-				g = fbData[base + 1] / fbData[base + 3];
-				b = fbData[base + 2] / fbData[base + 3];
+		if ((chan & BMM_CHAN_REALPIX) && !rect.IsEmpty()) {
+			ulong type;
+			RealPixel *pixels = (RealPixel*)output->GetChannel(BMM_CHAN_REALPIX, type);
+			const int width = output->Width();
 
-				if (isNormals)
+			// RPR requires us to normalize the image using the fourth component. 
+			const PixelTransform transform(isNormals, true);
+
+			#pragma omp parallel
+			{
+				std::vector<float> converted(size_t(rect.Width()) * 4);
+
+				#pragma omp for
+				for (int y = rect.ymin; y < rect.ymax; ++y)
 				{
-					// We were requested to map the -1..1 RPR normals to 0..1 3ds Max normals
-					r *= 0.5f;
-					g *= 0.5f;
-					b *= 0.5f;
-					r += 0.5f;
-					g += 0.5f;
-					b += 0.5f;
+					const float* src = data + (size_t(y - y0) * stride + (rect.xmin - x0)) * 4;
+					TransformPixels(src, nullptr, converted.data(), rect.Width(), transform);
+
+					RealPixel *row = pixels + size_t(y) * width + rect.xmin;
+					for (int x = 0; x < rect.Width(); ++x)
+					{
+						const float* p = &converted[x << 2];
+						*row++ = MakeRealPixel(p[0], p[1], p[2]);
+					}
 				}
+			}
+		}
+	}
 
-				*row++ = MakeRealPixel(r,g,b);
+	/// Converts the rect part of the frame buffer data in place and writes it to the bitmap
+	/// \param data RGBA frame buffer data whose first pixel maps to bitmap pixel (x0, y0), with rows of stride pixels
+	/// \param alpha RGBA frame buffer laid out as data, whose first component replaces the alpha, or nullptr
+	void WritePixels(float* data, const float* alpha, size_t stride, int x0, int y0, Bitmap* output, const BitmapRect& rect, bool isNormals)
+	{
+		if (rect.IsEmpty())
+			return;
+
+		if (alpha)
+			output->SetFlag(MAP_HAS_ALPHA);
+
+		// convert normals from RPR representation to Max's and add alpha, in place and in a single pass
+		if (isNormals || alpha)
+		{
+			const PixelTransform transform(isNormals, false);
+
+			#pragma omp parallel for
+			for (int y = rect.ymin; y < rect.ymax; ++y)
+			{
+				const size_t rowStart = (size_t(y - y0) * stride + (rect.xmin - x0)) * 4;
+				TransformPixels(data + rowStart, alpha ? alpha + rowStart : nullptr, data + rowStart, rect.Width(), transform);
 			}
 		}
+
+		// write data to output
+		// max sdk can recieve picture data only by lines, thus loop is needed
+		for (int y = rect.ymin; y < rect.ymax; ++y)
+		{
+			// the reason of using reinterpret_cast here is to avoide unnecessary copying
+			// BMM_Color_fl is a structure with 4 float values (r,g,b,a)
+			const size_t rowStart = (size_t(y - y0) * stride + (rect.xmin - x0)) * 4;
+			output->PutPixels(rect.xmin, y, rect.Width(), reinterpret_cast<BMM_Color_fl*>(data + rowStart));
+		}
 	}
 }
 
+bool IsPixelKernelSupported(PixelKernel kernel)
+{
+	return kernel == PixelKernel::Sse || cpuHasAvx;
+}
+
+void TransformFrameBufferPixels(PixelKernel kernel, const float* src, const float* alpha, float* dst, size_t count, bool isNormals,
+	bool normalizeByWeight)
+{
+	const PixelTransform transform(isNormals, normalizeByWeight);
+
+	if (kernel == PixelKernel::Avx && cpuHasAvx)
+		TransformPixelsAvx(src, alpha, dst, count, transform);
+	else
+		TransformPixelsSse(src, alpha, dst, count, transform);
+}
+
+void CopyDataToPreviewBitmap(const std::vector<float>& fbData, Bitmap* output, const bool isNormals, const BitmapRect* dirtyRect) {
+	if (!output)
+		return;
+
+	int height = output->Height();
+	int width = output->Width();
+
+	WritePreviewPixels(fbData.data(), width, 0, 0, output, GetUpdateRect(dirtyRect, width, height), isNormals);
+}
+
 
-void CopyDataToBitmap(std::vector<float>& fbData, const std::vector<float>& alphaData, Bitmap* output, const float exposure, const bool isNormals)
+void CopyDataToBitmap(std::vector<float>& fbData, const std::vector<float>& alphaData, Bitmap* output, const float exposure, const bool isNormals,
+	const BitmapRect* dirtyRect)
 {
 	if (fbData.size() == 0)
 		return;
@@ -281,42 +456,205 @@ void CopyDataToBitmap(std::vector<float>& fbData, const std::vector<float>& alph
 	if (!sizeValid)
 		return;
 
-	// convert normals from RPR representation to Max's
-	if (isNormals)
-	{
-		std::for_each(fbData.begin(), fbData.end(), [](float& element)
-		{
-			element = element * 0.5f + 0.5f;
-		});
-	}
-
 	// add alpha
 	bool hasAlpha = !alphaData.empty();
 
 	if (hasAlpha)
 	{
-		output->SetFlag(MAP_HAS_ALPHA);
-
 		// fbData values are r g b alpha quadruplets; alpha is 1 by default
-		// If we have input alpha values, we should replace alpha elementa in fbData
-		// array (each 4-th element) with valus from alphaData array.
+		// If we have input alpha values, we should replace alpha elements in fbData
+		// array (each 4-th element) with values from alphaData array.
 		FASSERT( fbData.size() == alphaData.size() );
 
-		for (size_t idx = 3; idx < fbData.size(); idx += 4)
-			fbData[idx] = alphaData[idx - 3];
+		if (fbData.size() != alphaData.size())
+			hasAlpha = false;
 	}
 
-	// write data to output
-	// max sdk can recieve picture data only by lines, thus loop is needed
-	for (int y = 0; y < height; ++y)
+	// only the pixels a region render has touched need to be converted and written
+	WritePixels(fbData.data(), hasAlpha ? alphaData.data() : nullptr, width, 0, 0, output, GetUpdateRect(dirtyRect, width, height), isNormals);
+}
+
+void CompositeTileToBitmap(std::vector<float>& tileData, std::vector<float>& tileAlphaData, int tileStride, const BitmapRect& tile, Bitmap* output,
+	const float exposure, const bool isNormals, bool toneOperatorPreviewExecuting)
+{
+	FASSERT(output);
+	FASSERT(IsReal(exposure));
+
+	if (!output || tileData.empty() || tileStride < tile.Width())
+		return;
+
+	// the tile buffer may extend past the bitmap, but must hold all its rows
+	bool sizeValid = tileData.size() >= size_t(tileStride) * tile.Height() * 4;
+
+	FASSERT(sizeValid);
+
+	if (!sizeValid)
+		return;
+
+	const bool hasAlpha = tileAlphaData.size() == tileData.size();
+	const BitmapRect rect = tile.Clamped(output->Width(), output->Height());
+
+	if (toneOperatorPreviewExecuting)
+		WritePreviewPixels(tileData.data(), tileStride, tile.xmin, tile.ymin, output, rect, isNormals);
+	else
+		WritePixels(tileData.data(), hasAlpha ? tileAlphaData.data() : nullptr, tileStride, tile.xmin, tile.ymin, output, rect, isNormals);
+}
+
+namespace
+{
+	inline __m128 Lerp4(__m128 color0, __m128 color1, __m128 weight)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		return _mm_add_ps(_mm_mul_ps(color0, _mm_sub_ps(one, weight)), _mm_mul_ps(color1, weight));
+	}
+}
+
+void CompositeShadowCatcherPixels(float* color, const float* background, const float* opacity, const float* shadowCatcher,
+	size_t pixelCount, const float shadowColor[4], float shadowWeight, bool bgIsEnv)
+{
+	const __m128 shadow = _mm_loadu_ps(shadowColor);
+	const __m128 weightScale = _mm_set1_ps(shadowWeight);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	const int count = int_cast(pixelCount);
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; ++i)
 	{
-		// the reason of using reinterpret_cast here is to avoide unnecessary copying
-		// BMM_Color_fl is a structure with 4 float values (r,g,b,a)
-		output->PutPixels(0, y, width, reinterpret_cast<BMM_Color_fl*>(fbData.data() + y*(width * 4)));
+		const size_t offset = 4 * size_t(i);
+
+		__m128 pixel = _mm_loadu_ps(color + offset);
+		if (bgIsEnv)
+			pixel = Lerp4(_mm_loadu_ps(background + offset), pixel, _mm_loadu_ps(opacity + offset));
+
+		// shadow catcher normalization: divide by the accumulated weight and clamp to 0..1, pixels without samples get 0
+		const __m128 accumulated = _mm_loadu_ps(shadowCatcher + offset);
+		const __m128 w = _mm_shuffle_ps(accumulated, accumulated, _MM_SHUFFLE(3, 3, 3, 3));
+		__m128 normalized = _mm_and_ps(_mm_div_ps(accumulated, w), _mm_cmpgt_ps(w, zero));
+		normalized = _mm_min_ps(_mm_max_ps(normalized, zero), one);
+
+		_mm_storeu_ps(color + offset, Lerp4(pixel, shadow, _mm_mul_ps(normalized, weightScale)));
 	}
 }
 
 // don't do unit conversion here... all 3dsmax classes should retain system units
+namespace
+{
+namespace
+{
+	// Depth AOV kernels: four pixels are processed per iteration, with their depths gathered into a single SSE register
+
+	inline __m128 LoadDepth4(const float* pixels)
+	{
+		const __m128 ab = _mm_unpacklo_ps(_mm_loadu_ps(pixels), _mm_loadu_ps(pixels + 4));
+		const __m128 cd = _mm_unpacklo_ps(_mm_loadu_ps(pixels + 8), _mm_loadu_ps(pixels + 12));
+		return _mm_shuffle_ps(ab, cd, _MM_SHUFFLE(1, 0, 1, 0));
+	}
+
+	inline __m128 IsInf4(__m128 v)
+	{
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		return _mm_cmpeq_ps(_mm_and_ps(v, absMask), _mm_set1_ps(std::numeric_limits<float>::infinity()));
+	}
+
+	inline __m128 Select4(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	inline float NormalizeDepth(float val, float min, float max)
+	{
+		if (isinf<float>(val))
+			return 1.0f;
+		if (val >= max)
+			return 1.0f;
+		if (val <= min)
+			return 0.0f;
+		return (val - min) / (max - min);
+	}
+}
+
+void SearchDepthMinMax(const float* data, size_t begin, size_t end, float& min, float& max)
+{
+	__m128 vmin = _mm_set1_ps(min);
+	__m128 vmax = _mm_set1_ps(max);
+	const __m128 lowest = _mm_set1_ps(std::numeric_limits<float>::lowest());
+	const __m128 highest = _mm_set1_ps(std::numeric_limits<float>::max());
+
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		const __m128 v = LoadDepth4(data + 4 * i);
+		const __m128 inf = IsInf4(v);
+
+		// min/max return their second operand if either is NaN
+		vmin = _mm_min_ps(Select4(inf, highest, v), vmin);
+		vmax = _mm_max_ps(Select4(inf, lowest, v), vmax);
+	}
+
+	float mins[4], maxs[4];
+	_mm_storeu_ps(mins, vmin);
+	_mm_storeu_ps(maxs, vmax);
+	for (int k = 0; k < 4; ++k)
+	{
+		if (min > mins[k])
+			min = mins[k];
+		if (max < maxs[k])
+			max = maxs[k];
+	}
+
+	for (; i < end; ++i)
+	{
+		const float val = data[4 * i];
+		if (!isinf<float>(val))
+		{
+			if (min > val)
+				min = val;
+			if (max < val)
+				max = val;
+		}
+	}
+}
+
+void NormalizeDepth(float* data, size_t begin, size_t end, float min, float max)
+{
+	const __m128 vmin = _mm_set1_ps(min);
+	const __m128 vmax = _mm_set1_ps(max);
+	const __m128 range = _mm_set1_ps(max - min);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 alphaMask = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+
+	size_t i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		float* pixels = data + 4 * i;
+		const __m128 v = LoadDepth4(pixels);
+
+		// same precedence as the scalar NormalizeDepth: infinity, then max, then min
+		__m128 r = _mm_div_ps(_mm_sub_ps(v, vmin), range);
+		r = Select4(_mm_cmple_ps(v, vmin), zero, r);
+		r = Select4(_mm_cmpge_ps(v, vmax), one, r);
+		r = Select4(IsInf4(v), one, r);
+
+		const __m128 r0 = _mm_shuffle_ps(r, r, _MM_SHUFFLE(0, 0, 0, 0));
+		const __m128 r1 = _mm_shuffle_ps(r, r, _MM_SHUFFLE(1, 1, 1, 1));
+		const __m128 r2 = _mm_shuffle_ps(r, r, _MM_SHUFFLE(2, 2, 2, 2));
+		const __m128 r3 = _mm_shuffle_ps(r, r, _MM_SHUFFLE(3, 3, 3, 3));
+		_mm_storeu_ps(pixels, Select4(alphaMask, _mm_loadu_ps(pixels), r0));
+		_mm_storeu_ps(pixels + 4, Select4(alphaMask, _mm_loadu_ps(pixels + 4), r1));
+		_mm_storeu_ps(pixels + 8, Select4(alphaMask, _mm_loadu_ps(pixels + 8), r2));
+		_mm_storeu_ps(pixels + 12, Select4(alphaMask, _mm_loadu_ps(pixels + 12), r3));
+	}
+
+	for (; i < end; ++i)
+	{
+		float* pixel = data + 4 * i;
+		pixel[0] = pixel[1] = pixel[2] = NormalizeDepth(pixel[0], min, max);
+	}
+}
+
 ViewParams ViewExp2viewParams(ViewExp& viewExp, INode*& outCameraNode) {
     ViewParams result;
     viewExp.GetAffineTM(result.affineTM);
@@ -488,25 +826,27 @@ float GetUnitScale()
 	return float(GetMasterScale(UNITS_METERS));
 }
 
-void UpdateBitmapWithToneOperator(Bitmap *bitmap) {
+void UpdateBitmapWithToneOperator(Bitmap *bitmap, const BitmapRect* dirtyRect) {
 	//change type of toneoperator if needed
 	ToneOperatorInterface* toneOpInt = (ToneOperatorInterface*)(GetCOREInterface(TONE_OPERATOR_INTERFACE));
 	ToneOperator *toneOp = toneOpInt->GetToneOperator();
 	if (bitmap && toneOp && toneOp->Active(0)) {
 		toneOp->Update(0, Interval());
-		int height = bitmap->Height();
+		const BitmapRect rect = GetUpdateRect(dirtyRect, bitmap->Width(), bitmap->Height());
+		if (rect.IsEmpty())
+			return;
 		#pragma omp parallel for
-		for (int y = 0; y < height; y++) {
-			int numberOfPixels = bitmap->Width();
+		for (int y = rect.ymin; y < rect.ymax; y++) {
+			int numberOfPixels = rect.Width();
 			PixelBufFloat l64(numberOfPixels);
 			BMM_Color_fl *pixelColors = l64.Ptr();
 
-			bitmap->GetPixels(0, y, numberOfPixels, pixelColors);
+			bitmap->GetPixels(rect.xmin, y, numberOfPixels, pixelColors);
 
 			for (int i = 0; i < numberOfPixels; i++) {
 				toneOp->ScaledToRGB(pixelColors[i]);
 			}
-			int result = bitmap->PutPixels(0, y, numberOfPixels, pixelColors);
+			int result = bitmap->PutPixels(rect.xmin, y, numberOfPixels, pixelColors);
 		}
 	}
 }
@@ -610,9 +950,8 @@ void DumpFRParms(const rpr_material_node& node)
 #endif
 }
 
-Bitmap* RenderTextToBitmap(const MCHAR* text)
+static HFONT CreateTextFont()
 {
-	// create font
 	HFONT hf = CreateFont(
 		/*fontSize*/ -12,
 		0, 0, 0,
@@ -629,6 +968,14 @@ Bitmap* RenderTextToBitmap(const MCHAR* text)
 	);
 	FASSERT(hf);
 
+	return hf;
+}
+
+Bitmap* RenderTextToBitmap(const MCHAR* text)
+{
+	// create font
+	HFONT hf = CreateTextFont();
+
 	// create DC
 	HDC dc = CreateCompatibleDC(NULL);
 	FASSERT(dc);
@@ -704,6 +1051,72 @@ Bitmap* RenderTextToBitmap(const MCHAR* text)
 	return bm;
 }
 
+TextRasterizer::TextRasterizer()
+{
+	mFont = CreateTextFont();
+
+	mDC = CreateCompatibleDC(NULL);
+	FASSERT(mDC);
+
+	SetTextColor(mDC, RGB(255, 255, 255));
+	SetBkColor(mDC, RGB(0, 0, 0));
+	SelectObject(mDC, mFont);
+}
+
+TextRasterizer::~TextRasterizer()
+{
+	SelectObject(mDC, GetStockObject(DEFAULT_GUI_FONT));
+
+	DeleteObject(mFont);
+	DeleteDC(mDC);
+}
+
+int TextRasterizer::GetLineHeight() const
+{
+	TEXTMETRIC metrics;
+	GetTextMetrics(mDC, &metrics);
+	return metrics.tmHeight;
+}
+
+void TextRasterizer::Render(const std::wstring& text, TextStrip& out)
+{
+	SIZE textSize = {};
+	GetTextExtentPoint32(mDC, text.c_str(), int_cast(text.size()), &textSize);
+
+	out.width = textSize.cx;
+	out.height = GetLineHeight();
+	out.pixels.assign(size_t(out.width) * out.height, 0.0f);
+
+	if (out.width == 0 || out.height == 0)
+		return;
+
+	// top-down DIB, so that its rows are in the order of the strip
+	RGBQUAD* bits = NULL;
+	BITMAPINFO bmi;
+	BITMAPINFOHEADER &head = bmi.bmiHeader;
+	memset(&bmi, 0, sizeof(bmi));
+	head.biSize        = sizeof(BITMAPINFOHEADER);
+	head.biWidth       = out.width;
+	head.biHeight      = -out.height;
+	head.biPlanes      = 1;
+	head.biBitCount    = 32;
+	head.biCompression = BI_RGB;
+
+	HBITMAP dib = CreateDIBSection(mDC, &bmi, DIB_RGB_COLORS, (void**)&bits, NULL, 0);
+	FASSERT(dib);
+
+	HBITMAP oldbitmap = (HBITMAP)SelectObject(mDC, dib);
+
+	TextOut(mDC, 0, 0, text.c_str(), int_cast(text.size()));
+	GdiFlush();
+
+	for (size_t i = 0; i < out.pixels.size(); i++)
+		out.pixels[i] = (bits[i].rgbRed + bits[i].rgbGreen + bits[i].rgbBlue) / (3 * 255.0f);
+
+	SelectObject(mDC, oldbitmap);
+	DeleteObject(dib);
+}
+
 static float lerp(float A, float B, float Alpha)
 {
 	return A * (1 - Alpha) + B * Alpha;
@@ -29,6 +29,7 @@ limitations under the License.
 #include <iparamm2.h>
 
 #include <vector>
+#include <algorithm>
 
 FIRERENDER_NAMESPACE_BEGIN
 
@@ -140,25 +141,112 @@ inline Matrix3 fxLightTm(Matrix3 in) {
     return in;
 }
 
-/// Creates 4*4 column-major matrix (used by RPR) in out parameter from given 3ds Max 4*3 matrix
-inline void CreateFrMatrix(Matrix3 in, float out[16]) {
-    in = FlipAxes(in);
+/// Packs given 3ds Max 4*3 matrix as it is into the 4*4 column-major matrix used by RPR
+inline void PackFrMatrix(const Matrix3& in, float out[16]) {
     for (int x = 0; x < 4; ++x) {
-        for (int y = 0; y < 3; ++y) {
-            *out++ = in.GetRow(x)[y];
-        }
+        const Point3& row = in.GetRow(x);
+        *out++ = row.x;
+        *out++ = row.y;
+        *out++ = row.z;
         *out++ = (x == 3) ? 1.f : 0.f;
     }
 }
 
+/// Creates 4*4 column-major matrix (used by RPR) in out parameter from given 3ds Max 4*3 matrix
+inline void CreateFrMatrix(Matrix3 in, float out[16]) {
+    PackFrMatrix(FlipAxes(in), out);
+}
+
+/// Rectangle of bitmap pixels [xmin, xmax) x [ymin, ymax), e.g. the part of the frame buffer updated by a region render
+struct BitmapRect
+{
+	int xmin = 0;
+	int ymin = 0;
+	int xmax = 0;
+	int ymax = 0;
+
+	BitmapRect() = default;
+
+	BitmapRect(int x0, int y0, int x1, int y1)
+		: xmin(x0), ymin(y0), xmax(x1), ymax(y1)
+	{
+	}
+
+	inline bool IsEmpty() const
+	{
+		return xmin >= xmax || ymin >= ymax;
+	}
+
+	inline int Width() const
+	{
+		return xmax - xmin;
+	}
+
+	inline int Height() const
+	{
+		return ymax - ymin;
+	}
+
+	/// Returns the part of the rectangle which lies inside a bitmap of given size
+	inline BitmapRect Clamped(int width, int height) const
+	{
+		return BitmapRect(std::max(xmin, 0), std::max(ymin, 0), std::min(xmax, width), std::min(ymax, height));
+	}
+};
+
 /// Stores data from RPR frame buffer in 3ds Max Bitmap class. Possibly runs multiple threads to speed the process up
 /// \param exposure A constant with which the read data is multiplied before writing it to the bitmap
 /// \param isNormals If true, the colors are transformed between RPR and 3ds Max interpretation of normal channel 
 ///                  (RPR outputs normals in -1..1 range, 3ds Max and other applications expect 0..1 range)
-void CompositeFrameBuffersToBitmap(std::vector<float>& fbData, std::vector<float>& fbAlphaData, Bitmap* output, const float exposure, const bool isNormals, bool toneOperatorPreviewExecuting);
+/// \param dirtyRect If set, only this part of the frame buffer is converted and written, the rest of the bitmap is left alone
+void CompositeFrameBuffersToBitmap(std::vector<float>& fbData, std::vector<float>& fbAlphaData, Bitmap* output, const float exposure, const bool isNormals, bool toneOperatorPreviewExecuting,
+	const BitmapRect* dirtyRect = nullptr);
+
+/// Same as CompositeFrameBuffersToBitmap, for a frame buffer holding a single tile of the bitmap
+/// \param tileStride Number of pixels in a row of the tile data, at least the width of the tile
+/// \param tile Part of the bitmap the data covers; pixels outside the bitmap are ignored
+void CompositeTileToBitmap(std::vector<float>& tileData, std::vector<float>& tileAlphaData, int tileStride, const BitmapRect& tile, Bitmap* output,
+	const float exposure, const bool isNormals, bool toneOperatorPreviewExecuting);
+
+/// CPU version of the shadow catcher composite graph of the production renderer, fused into a single pass. The result is
+/// written over the color pixels.
+/// \param color, background, opacity Resolved RGBA pixels of the color, background and opacity AOVs
+/// \param shadowCatcher Raw (not resolved) RGBA pixels of the shadow catcher AOV, normalized here the same way as by the
+///        normalize composite node with aovtype RPR_AOV_SHADOW_CATCHER
+/// \param shadowColor Shadow color, with the shadow opacity in alpha
+/// \param bgIsEnv If true, the color is first composited over the background using the opacity
+void CompositeShadowCatcherPixels(float* color, const float* background, const float* opacity, const float* shadowCatcher,
+	size_t pixelCount, const float shadowColor[4], float shadowWeight, bool bgIsEnv);
+
+/// Depth AOV kernels of the production renderer, which runs them on chunks of the frame buffer in parallel. The depth is the
+/// first component of RGBA pixels; infinite depths (background) are left out of the range and mapped to 1.
+
+/// Extends [min, max] by the finite depths of pixels [begin, end). NaNs are ignored, as they fail all comparisons.
+void SearchDepthMinMax(const float* data, size_t begin, size_t end, float& min, float& max);
+
+/// Maps the depths of pixels [begin, end) from [min, max] to [0, 1] and writes them to r, g and b, keeping the alpha
+void NormalizeDepth(float* data, size_t begin, size_t end, float min, float max);
+
+void CopyDataToPreviewBitmap(const std::vector<float>& fbData, Bitmap* output, const bool isNormals, const BitmapRect* dirtyRect = nullptr);
+void CopyDataToBitmap(std::vector<float>& data, const std::vector<float>& alphaData, Bitmap* output, const float exposure, const bool isNormals,
+	const BitmapRect* dirtyRect = nullptr);
+
+/// Instruction sets of the pixel conversion used by CopyDataToBitmap and CopyDataToPreviewBitmap, which pick the best one the
+/// CPU supports
+enum class PixelKernel
+{
+	Sse,
+	Avx
+};
+
+bool IsPixelKernelSupported(PixelKernel kernel);
 
-void CopyDataToPreviewBitmap(const std::vector<float>& fbData, Bitmap* output, const bool isNormals);
-void CopyDataToBitmap(std::vector<float>& data, const std::vector<float>& alphaData, Bitmap* output, const float exposure, const bool isNormals);
+/// Runs the pixel conversion of the bitmap copies with the given kernel, so each kernel can be checked and timed on its own.
+/// Converts count RGBA pixels from src to dst, which may be the same buffer.
+/// \param alpha RGBA frame buffer whose first component replaces the alpha of the output, or nullptr
+/// \param normalizeByWeight If true, r, g and b are divided by the fourth (weight) component, as for the tone operator preview
+void TransformFrameBufferPixels(PixelKernel kernel, const float* src, const float* alpha, float* dst, size_t count, bool isNormals,
+	bool normalizeByWeight);
 
 
 /// Calculates an average (gray) value of a color
@@ -267,11 +355,40 @@ T* GetSubAnimByType(Animatable* p, bool recursive = false)
 	return nullptr;
 }
 
-void UpdateBitmapWithToneOperator(Bitmap *bitmap);
+/// Applies the active 3ds Max tone operator to the bitmap, or to its dirtyRect part only if given
+void UpdateBitmapWithToneOperator(Bitmap *bitmap, const BitmapRect* dirtyRect = nullptr);
 
 Bitmap* RenderTextToBitmap(const MCHAR* text);
 void BlitBitmap(Bitmap* Dst, Bitmap* Src, int x, int y, float alpha);
 
+/// Single line of text rasterized by TextRasterizer: white on black intensities, rows from top to bottom
+struct TextStrip
+{
+	int width = 0;
+	int height = 0;
+	std::vector<float> pixels;
+};
+
+/// Rasterizes single lines of text in the font of RenderTextToBitmap. The font and the device context are created once and
+/// kept, so rendering many short strips is cheap.
+class TextRasterizer
+{
+	HFONT mFont = NULL;
+	HDC mDC = NULL;
+
+	TextRasterizer(const TextRasterizer&) = delete;
+	TextRasterizer& operator=(const TextRasterizer&) = delete;
+
+public:
+	TextRasterizer();
+	~TextRasterizer();
+
+	/// Height of a line of text, in pixels
+	int GetLineHeight() const;
+
+	void Render(const std::wstring& text, TextStrip& out);
+};
+
 std::wstring GetCPUName();
 std::wstring ComputerName();
 std::wstring GetFriendlyUsedGPUName();